@@ -0,0 +1,945 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "archive.h"
+#include "delta.h"
+#include "store.h"
+#include "log.h"
+
+#define INDEX_INITIAL_CAPACITY  (64)
+#define BLOB_INITIAL_CAPACITY   (256)
+#define VERSION_INITIAL_CAPACITY    (256)
+
+static int vt_load_index(struct vt_archive *archive, const uint8_t *map, size_t length);
+static uint64_t vt_scan_records(struct vt_archive *archive, const uint8_t *map, size_t length);
+static int vt_add_entry(struct vt_archive *archive, struct vt_archive_index_entry *entry);
+static struct vt_archive_index_entry *vt_find_exact(struct vt_archive *archive, const char *page, 
+    time_t when);
+static int vt_compare_entries(const void *a, const void *b);
+static int vt_add_blob(struct vt_archive *archive, uint64_t hash, uint64_t data_offset, uint32_t length);
+static uint64_t vt_find_blob(struct vt_archive *archive, uint64_t hash, const uint8_t *data, uint32_t length);
+static uint64_t vt_version_hash(const char *service, const char *page);
+static int vt_set_version(struct vt_archive *archive, const char *service, const char *page, uint64_t offset);
+static uint64_t vt_get_version(struct vt_archive *archive, const char *service, const char *page);
+static int vt_make_delta(struct vt_archive *archive, uint64_t base_offset, const uint8_t *data, 
+    uint32_t length, struct vt_archive_delta *header, uint8_t **delta);
+static const uint8_t *vt_rebuild(struct vt_archive *archive, const uint8_t *map, size_t map_length,
+    uint64_t offset, int depth, uint32_t *length);
+static int vt_read_at(struct vt_archive *archive, const uint8_t *map, size_t map_length,
+    void *buffer, size_t length, uint64_t offset);
+static int vt_grow_frame(struct vt_archive *archive, uint32_t size);
+
+bool
+vt_archive_is_archive(int fd)
+{
+    struct vt_archive_header header;
+
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        return false;
+    }
+
+    return header.magic == ARCHIVE_MAGIC;
+}
+
+/*
+Open for appending, creating the archive if necessary. The index is rewritten by
+vt_archive_close. An existing file is left as it is unless it's a valid archive
+*/
+int
+vt_archive_open(struct vt_archive *archive, const char *path)
+{
+    memset(archive, 0, sizeof(struct vt_archive));
+    archive->fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    if (archive->fd == -1) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    if (fstat(archive->fd, &st) == -1) {
+        log_err();
+        goto abend;
+    }
+
+    if (st.st_size == 0) {
+        struct vt_archive_header header = {ARCHIVE_MAGIC, ARCHIVE_VERSION};
+
+        if (write(archive->fd, &header, sizeof(header)) != sizeof(header)) {
+            log_err();
+            goto abend;
+        }
+
+        archive->end_offset = sizeof(header);
+        archive->version = ARCHIVE_VERSION;
+        archive->is_writable = true;
+        return EXIT_SUCCESS;
+    }
+
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, archive->fd, 0);
+    if (map == MAP_FAILED) {
+        log_err();
+        goto abend;
+    }
+
+    int rv = vt_load_index(archive, map, st.st_size);
+    archive->version = ((const struct vt_archive_header *)map)->version;
+
+    //  Writers keep their own copy of the index
+    if (rv == EXIT_SUCCESS && archive->index != archive->index_buffer) {
+        archive->index_buffer = malloc((archive->index_count + INDEX_INITIAL_CAPACITY) 
+            * sizeof(struct vt_archive_index_entry));
+
+        if (archive->index_buffer == NULL) {
+            log_err();
+            rv = EXIT_FAILURE;
+        }
+        else {
+            memcpy(archive->index_buffer, archive->index, 
+                archive->index_count * sizeof(struct vt_archive_index_entry));
+            archive->index_capacity = archive->index_count + INDEX_INITIAL_CAPACITY;
+        }
+    }
+
+    archive->index = archive->index_buffer;
+
+    //  Sorted by time within each page, so the latest version of each is set last
+    for (uint32_t i = 0; rv == EXIT_SUCCESS && i < archive->index_count; ++i) {
+        struct vt_archive_index_entry *entry = &archive->index[i];
+
+        struct vt_archive_record record;
+
+        if (vt_read_at(archive, map, st.st_size, &record, sizeof(record), entry->offset) != EXIT_SUCCESS) {
+            continue;
+        }
+
+        //  A delta's bytes aren't the frame's
+        if ((record.flags & ARCHIVE_RECORD_DELTA) == 0) {
+            rv = vt_add_blob(archive, entry->hash, entry->data_offset, entry->length);
+        }
+
+        if (rv == EXIT_SUCCESS && entry->page[0] != 0) {
+            rv = vt_set_version(archive, record.service, record.page, entry->offset);
+        }
+    }
+
+    munmap(map, st.st_size);
+
+    //  Records are appended over the old index. Without it and its trailer, a
+    //  crash before vt_archive_close leaves an archive whose index is rebuilt
+    //  from the records rather than one that points at overwritten bytes
+    if (rv == EXIT_SUCCESS && archive->end_offset < (uint64_t)st.st_size 
+        && ftruncate(archive->fd, archive->end_offset) == -1) {
+        log_err();
+        rv = EXIT_FAILURE;
+    }
+
+    if (rv != EXIT_SUCCESS) {
+        goto abend;
+    }
+
+    archive->is_writable = true;
+    return EXIT_SUCCESS;
+abend:
+    //  Not writable, so nothing is written to a file that may not be an archive
+    vt_archive_close(archive);
+    return EXIT_FAILURE;
+}
+
+/*
+A frame already in the archive is appended as a shared record. Otherwise, a
+later version of a page already in the archive is appended as a delta record
+*/
+int
+vt_archive_append(struct vt_archive *archive, const char *service, const char *page, 
+    time_t when, const uint8_t *data, uint32_t length)
+{
+    struct vt_archive_record record;
+    memset(&record, 0, sizeof(record));
+    record.magic = ARCHIVE_RECORD_MAGIC;
+    record.length = length;
+    record.time = when;
+
+    if (service != NULL) {
+        strncpy(record.service, service, ARCHIVE_SERVICE_MAX - 1);
+    }
+
+    if (page != NULL) {
+        strncpy(record.page, page, PAGE_NUMBER_MAX - 1);
+    }
+
+    uint64_t hash = vt_store_hash(data, length);
+    uint64_t data_offset = vt_find_blob(archive, hash, data, length);
+    bool is_shared = data_offset != 0;
+    uint64_t base_offset = is_shared || record.page[0] == 0 ? 0 : vt_get_version(archive, record.service, record.page);
+    struct vt_archive_delta header;
+    uint8_t *delta = NULL;
+    int delta_length = base_offset != 0 ? vt_make_delta(archive, base_offset, data, length, &header, &delta) : -1;
+    struct iovec iov[3] = {{.iov_base = &record, .iov_len = sizeof(record)}};
+    int iov_count = 2;
+
+    if (is_shared) {
+        record.flags |= ARCHIVE_RECORD_SHARED;
+        record.length = sizeof(uint64_t);
+        iov[1] = (struct iovec){.iov_base = &data_offset, .iov_len = record.length};
+    }
+    else if (delta_length >= 0) {
+        record.flags |= ARCHIVE_RECORD_DELTA;
+        record.length = sizeof(header) + delta_length;
+        data_offset = archive->end_offset + sizeof(record);
+        iov[1] = (struct iovec){.iov_base = &header, .iov_len = sizeof(header)};
+        iov[2] = (struct iovec){.iov_base = delta, .iov_len = delta_length};
+        iov_count = 3;
+    }
+    else {
+        data_offset = archive->end_offset + sizeof(record);
+        iov[1] = (struct iovec){.iov_base = (void *)data, .iov_len = record.length};
+    }
+
+    //  Shared and delta records can't be read by older versions, so the archive
+    //  is only upgraded when the first is appended
+    if ((record.flags & (ARCHIVE_RECORD_SHARED | ARCHIVE_RECORD_DELTA)) && archive->version != ARCHIVE_VERSION) {
+        struct vt_archive_header upgraded = {ARCHIVE_MAGIC, ARCHIVE_VERSION};
+
+        if (pwrite(archive->fd, &upgraded, sizeof(upgraded), 0) != sizeof(upgraded)) {
+            log_err();
+            free(delta);
+            return EXIT_FAILURE;
+        }
+
+        archive->version = ARCHIVE_VERSION;
+    }
+
+    ssize_t total = sizeof(record) + record.length;
+    ssize_t written = pwritev(archive->fd, iov, iov_count, archive->end_offset);
+    free(delta);
+
+    if (written != total) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    struct vt_archive_index_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.offset = archive->end_offset;
+    entry.time = record.time;
+    entry.length = length;
+    entry.hash = hash;
+    entry.data_offset = data_offset;
+    memcpy(entry.page, record.page, PAGE_NUMBER_MAX);
+
+    archive->end_offset += total;
+
+    if (is_shared) {
+        ++archive->shared_count;
+    }
+    else if (delta_length >= 0) {
+        ++archive->delta_count;
+    }
+    else if (vt_add_blob(archive, hash, data_offset, length) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    if (record.page[0] != 0 && vt_set_version(archive, record.service, record.page, entry.offset) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    return vt_add_entry(archive, &entry);
+}
+
+/*
+Map an archive for reading. Nothing is copied unless the index is missing (e.g. the
+writer crashed), in which case it's rebuilt from the records
+*/
+int
+vt_archive_map(struct vt_archive *archive, int fd)
+{
+    memset(archive, 0, sizeof(struct vt_archive));
+    archive->fd = -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    archive->map_length = st.st_size;
+    archive->map = mmap(NULL, archive->map_length, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (archive->map == MAP_FAILED) {
+        log_err();
+        archive->map = NULL;
+        return EXIT_FAILURE;
+    }
+
+    if (vt_load_index(archive, archive->map, archive->map_length) != EXIT_SUCCESS) {
+        vt_archive_close(archive);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+The most recent capture of page. A page without a frame letter, e.g. "91", 
+matches frame "91a"
+*/
+struct vt_archive_index_entry *
+vt_archive_find(struct vt_archive *archive, const char *page)
+{
+    return vt_archive_find_at(archive, page, ARCHIVE_LATEST);
+}
+
+/*
+The capture of page that was current at when: the last made no later than it.
+when may be ARCHIVE_LATEST
+*/
+struct vt_archive_index_entry *
+vt_archive_find_at(struct vt_archive *archive, const char *page, time_t when)
+{
+    struct vt_archive_index_entry *entry = vt_find_exact(archive, page, when);
+    size_t len = strlen(page);
+
+    if (entry == NULL && len > 0 && len + 1 < PAGE_NUMBER_MAX && page[len - 1] >= '0' && page[len - 1] <= '9') {
+        char frame[PAGE_NUMBER_MAX];
+        snprintf(frame, PAGE_NUMBER_MAX, "%sa", page);
+        entry = vt_find_exact(archive, frame, when);
+    }
+
+    return entry;
+}
+
+/*
+The most recent capture made no later than when, which may be ARCHIVE_LATEST
+*/
+struct vt_archive_index_entry *
+vt_archive_latest(struct vt_archive *archive, time_t when)
+{
+    struct vt_archive_index_entry *latest = NULL;
+
+    for (uint32_t i = 0; i < archive->index_count; ++i) {
+        struct vt_archive_index_entry *entry = &archive->index[i];
+
+        if (when != ARCHIVE_LATEST && entry->time > when) {
+            continue;
+        }
+
+        if (latest == NULL || entry->time > latest->time 
+            || (entry->time == latest->time && entry->offset > latest->offset)) {
+            latest = entry;
+        }
+    }
+
+    return latest;
+}
+
+/*
+Only valid for mapped archives. Records are at any byte offset, so the record
+is copied out of the map. The frame of a delta record is rebuilt, and is only
+valid until the next call
+*/
+int
+vt_archive_get_record(struct vt_archive *archive, struct vt_archive_index_entry *entry, 
+    struct vt_archive_record *record, const uint8_t **data)
+{
+    if (archive->map == NULL 
+        || vt_read_at(archive, archive->map, archive->map_length, record, sizeof(struct vt_archive_record), 
+            entry->offset) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    if (record->flags & ARCHIVE_RECORD_DELTA) {
+        uint32_t length = 0;
+        *data = vt_rebuild(archive, archive->map, archive->map_length, entry->offset, -1, &length);
+        return *data != NULL && length == entry->length ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (entry->data_offset + entry->length > archive->map_length) {
+        return EXIT_FAILURE;
+    }
+
+    *data = archive->map + entry->data_offset;
+    return EXIT_SUCCESS;
+}
+
+/*
+Writers get the index and trailer written after the last record
+*/
+int
+vt_archive_close(struct vt_archive *archive)
+{
+    int rv = EXIT_SUCCESS;
+
+    if (archive->is_writable && archive->fd > -1) {
+        qsort(archive->index, archive->index_count, sizeof(struct vt_archive_index_entry), vt_compare_entries);
+
+        struct vt_archive_trailer trailer = {archive->end_offset, archive->index_count, ARCHIVE_INDEX_MAGIC};
+        size_t index_len = archive->index_count * sizeof(struct vt_archive_index_entry);
+        struct iovec iov[2] = {
+            {.iov_base = archive->index, .iov_len = index_len},
+            {.iov_base = &trailer, .iov_len = sizeof(trailer)}
+        };
+
+        if (pwritev(archive->fd, iov, 2, archive->end_offset) != (ssize_t)(index_len + sizeof(trailer))
+            || ftruncate(archive->fd, archive->end_offset + index_len + sizeof(trailer)) == -1) {
+            log_err();
+            rv = EXIT_FAILURE;
+        }
+    }
+
+    if (archive->fd > -1 && close(archive->fd) == -1) {
+        log_err();
+        rv = EXIT_FAILURE;
+    }
+
+    if (archive->map != NULL) {
+        munmap(archive->map, archive->map_length);
+    }
+
+    free(archive->index_buffer);
+    free(archive->blobs);
+    free(archive->versions);
+    free(archive->frame);
+    memset(archive, 0, sizeof(struct vt_archive));
+    archive->fd = -1;
+    return rv;
+}
+
+/*
+Point archive->index at the trailing index, or rebuild it into index_buffer if
+there isn't a valid one. Sets end_offset to just after the last record
+*/
+static int
+vt_load_index(struct vt_archive *archive, const uint8_t *map, size_t length)
+{
+    const struct vt_archive_header *header = (const struct vt_archive_header *)map;
+
+    if (length < sizeof(struct vt_archive_header) || header->magic != ARCHIVE_MAGIC) {
+        fprintf(stderr, "Not a frame archive\n");
+        return EXIT_FAILURE;
+    }
+
+    if (header->version < ARCHIVE_VERSION_MIN || header->version > ARCHIVE_VERSION) {
+        fprintf(stderr, "Unsupported frame archive version %u\n", header->version);
+        return EXIT_FAILURE;
+    }
+
+    //  Version 1 indexes have no hashes, so are rebuilt
+    if (header->version > 1 
+        && length >= sizeof(struct vt_archive_header) + sizeof(struct vt_archive_trailer)) {
+        struct vt_archive_trailer trailer;
+        memcpy(&trailer, map + length - sizeof(trailer), sizeof(trailer));
+        uint64_t index_len = (uint64_t)trailer.index_count * sizeof(struct vt_archive_index_entry);
+
+        if (trailer.magic == ARCHIVE_INDEX_MAGIC 
+            && trailer.index_offset + index_len + sizeof(trailer) == length) {
+            archive->index_count = trailer.index_count;
+            archive->end_offset = trailer.index_offset;
+
+            //  The index follows the last record, so is only aligned by chance.
+            //  Otherwise it's copied
+            if (trailer.index_offset % _Alignof(struct vt_archive_index_entry) == 0) {
+                archive->index = (struct vt_archive_index_entry *)(map + trailer.index_offset);
+                return EXIT_SUCCESS;
+            }
+
+            archive->index_buffer = malloc(index_len > 0 ? index_len : 1);
+
+            if (archive->index_buffer == NULL) {
+                log_err();
+                return EXIT_FAILURE;
+            }
+
+            memcpy(archive->index_buffer, map + trailer.index_offset, index_len);
+            archive->index = archive->index_buffer;
+            archive->index_capacity = archive->index_count;
+            return EXIT_SUCCESS;
+        }
+    }
+
+    archive->end_offset = vt_scan_records(archive, map, length);
+    archive->index = archive->index_buffer;
+    qsort(archive->index, archive->index_count, sizeof(struct vt_archive_index_entry), vt_compare_entries);
+    return EXIT_SUCCESS;
+}
+
+static uint64_t
+vt_scan_records(struct vt_archive *archive, const uint8_t *map, size_t length)
+{
+    uint64_t offset = sizeof(struct vt_archive_header);
+
+    //  Records are at any byte offset, so are copied out of the map
+    struct vt_archive_record record;
+
+    while (vt_read_at(archive, map, length, &record, sizeof(record), offset) == EXIT_SUCCESS) {
+        if (record.magic != ARCHIVE_RECORD_MAGIC 
+            || offset + sizeof(record) + record.length > length) {
+            break;
+        }
+
+        struct vt_archive_index_entry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.offset = offset;
+        entry.time = record.time;
+        entry.length = record.length;
+        entry.data_offset = offset + sizeof(record);
+
+        if (record.flags & ARCHIVE_RECORD_SHARED) {
+            //  Must point back to an earlier record that isn't shared
+            struct vt_archive_record blob;
+
+            if (record.length != sizeof(uint64_t)) {
+                break;
+            }
+
+            memcpy(&entry.data_offset, map + entry.data_offset, sizeof(uint64_t));
+
+            if (entry.data_offset < sizeof(struct vt_archive_header) + sizeof(blob) 
+                || entry.data_offset > offset
+                || vt_read_at(archive, map, offset, &blob, sizeof(blob), entry.data_offset - sizeof(blob)) != EXIT_SUCCESS
+                || blob.magic != ARCHIVE_RECORD_MAGIC 
+                || (blob.flags & (ARCHIVE_RECORD_SHARED | ARCHIVE_RECORD_DELTA))
+                || entry.data_offset + blob.length > offset) {
+                break;
+            }
+
+            entry.length = blob.length;
+        }
+
+        if (record.flags & ARCHIVE_RECORD_DELTA) {
+            //  Must be built on earlier records
+            const uint8_t *frame = vt_rebuild(archive, map, entry.data_offset + record.length, 
+                offset, -1, &entry.length);
+
+            if (frame == NULL) {
+                break;
+            }
+
+            entry.hash = vt_store_hash(frame, entry.length);
+        }
+        else {
+            entry.hash = vt_store_hash(map + entry.data_offset, entry.length);
+        }
+        memcpy(entry.page, record.page, PAGE_NUMBER_MAX);
+        entry.page[PAGE_NUMBER_MAX - 1] = 0;
+
+        if (vt_add_entry(archive, &entry) != EXIT_SUCCESS) {
+            break;
+        }
+
+        offset += sizeof(record) + record.length;
+    }
+
+    return offset;
+}
+
+static int
+vt_add_entry(struct vt_archive *archive, struct vt_archive_index_entry *entry)
+{
+    if (archive->index_count == archive->index_capacity) {
+        uint32_t capacity = archive->index_capacity == 0 ? INDEX_INITIAL_CAPACITY : archive->index_capacity * 2;
+        struct vt_archive_index_entry *buffer 
+            = realloc(archive->index_buffer, capacity * sizeof(struct vt_archive_index_entry));
+
+        if (buffer == NULL) {
+            log_err();
+            return EXIT_FAILURE;
+        }
+
+        archive->index_buffer = buffer;
+        archive->index = buffer;
+        archive->index_capacity = capacity;
+    }
+
+    archive->index_buffer[archive->index_count++] = *entry;
+    return EXIT_SUCCESS;
+}
+
+/*
+Binary search for the last (i.e. latest) entry for page made no later than when
+*/
+static struct vt_archive_index_entry *
+vt_find_exact(struct vt_archive *archive, const char *page, time_t when)
+{
+    uint32_t lo = 0;
+    uint32_t hi = archive->index_count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int rv = strncmp(archive->index[mid].page, page, PAGE_NUMBER_MAX);
+
+        if (rv < 0 || (rv == 0 && (when == ARCHIVE_LATEST || archive->index[mid].time <= when))) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    if (lo > 0 && strncmp(archive->index[lo - 1].page, page, PAGE_NUMBER_MAX) == 0) {
+        return &archive->index[lo - 1];
+    }
+
+    return NULL;
+}
+
+static int
+vt_add_blob(struct vt_archive *archive, uint64_t hash, uint64_t data_offset, uint32_t length)
+{
+    if ((archive->blob_count + 1) * 2 > archive->blob_capacity) {
+        uint32_t capacity = archive->blob_capacity == 0 ? BLOB_INITIAL_CAPACITY : archive->blob_capacity * 2;
+        struct vt_archive_blob *blobs = calloc(capacity, sizeof(struct vt_archive_blob));
+
+        if (blobs == NULL) {
+            log_err();
+            return EXIT_FAILURE;
+        }
+
+        for (uint32_t i = 0; i < archive->blob_capacity; ++i) {
+            struct vt_archive_blob *blob = &archive->blobs[i];
+
+            if (blob->data_offset != 0) {
+                uint32_t slot = blob->hash & (capacity - 1);
+
+                while (blobs[slot].data_offset != 0) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+
+                blobs[slot] = *blob;
+            }
+        }
+
+        free(archive->blobs);
+        archive->blobs = blobs;
+        archive->blob_capacity = capacity;
+    }
+
+    uint32_t slot = hash & (archive->blob_capacity - 1);
+
+    while (archive->blobs[slot].data_offset != 0) {
+        if (archive->blobs[slot].data_offset == data_offset) {
+            return EXIT_SUCCESS;
+        }
+
+        slot = (slot + 1) & (archive->blob_capacity - 1);
+    }
+
+    archive->blobs[slot] = (struct vt_archive_blob){hash, data_offset, length};
+    ++archive->blob_count;
+    return EXIT_SUCCESS;
+}
+
+/*
+Where the bytes of a copy of data are, or 0 if there isn't one. Candidates are
+read back to make sure the hash isn't a coincidence
+*/
+static uint64_t
+vt_find_blob(struct vt_archive *archive, uint64_t hash, const uint8_t *data, uint32_t length)
+{
+    uint64_t data_offset = 0;
+    uint8_t *buffer = NULL;
+
+    if (archive->blob_capacity == 0) {
+        return 0;
+    }
+
+    for (uint32_t slot = hash & (archive->blob_capacity - 1); 
+        archive->blobs[slot].data_offset != 0 && data_offset == 0; 
+        slot = (slot + 1) & (archive->blob_capacity - 1)) {
+        struct vt_archive_blob *blob = &archive->blobs[slot];
+
+        if (blob->hash != hash || blob->length != length) {
+            continue;
+        }
+
+        if (buffer == NULL && (buffer = malloc(length > 0 ? length : 1)) == NULL) {
+            log_err();
+            break;
+        }
+
+        if (pread(archive->fd, buffer, length, blob->data_offset) == (ssize_t)length 
+            && memcmp(buffer, data, length) == 0) {
+            data_offset = blob->data_offset;
+        }
+    }
+
+    free(buffer);
+    return data_offset;
+}
+
+static int
+vt_compare_entries(const void *a, const void *b)
+{
+    const struct vt_archive_index_entry *ea = a;
+    const struct vt_archive_index_entry *eb = b;
+    int rv = strncmp(ea->page, eb->page, PAGE_NUMBER_MAX);
+
+    if (rv == 0) {
+        rv = (ea->time > eb->time) - (ea->time < eb->time);
+    }
+
+    if (rv == 0) {
+        rv = (ea->offset > eb->offset) - (ea->offset < eb->offset);
+    }
+
+    return rv;
+}
+
+static uint64_t
+vt_version_hash(const char *service, const char *page)
+{
+    uint8_t key[ARCHIVE_SERVICE_MAX + PAGE_NUMBER_MAX];
+
+    memcpy(key, service, ARCHIVE_SERVICE_MAX);
+    memcpy(key + ARCHIVE_SERVICE_MAX, page, PAGE_NUMBER_MAX);
+    return vt_store_hash(key, sizeof(key));
+}
+
+/*
+Note offset as the record of the latest version of service's page. Both are
+the zero padded arrays of a vt_archive_record
+*/
+static int
+vt_set_version(struct vt_archive *archive, const char *service, const char *page, uint64_t offset)
+{
+    if ((archive->version_count + 1) * 2 > archive->version_capacity) {
+        uint32_t capacity = archive->version_capacity == 0 ? VERSION_INITIAL_CAPACITY : archive->version_capacity * 2;
+        struct vt_archive_version *versions = calloc(capacity, sizeof(struct vt_archive_version));
+
+        if (versions == NULL) {
+            log_err();
+            return EXIT_FAILURE;
+        }
+
+        for (uint32_t i = 0; i < archive->version_capacity; ++i) {
+            struct vt_archive_version *version = &archive->versions[i];
+
+            if (version->offset != 0) {
+                uint32_t slot = vt_version_hash(version->service, version->page) & (capacity - 1);
+
+                while (versions[slot].offset != 0) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+
+                versions[slot] = *version;
+            }
+        }
+
+        free(archive->versions);
+        archive->versions = versions;
+        archive->version_capacity = capacity;
+    }
+
+    uint32_t slot = vt_version_hash(service, page) & (archive->version_capacity - 1);
+
+    while (archive->versions[slot].offset != 0) {
+        struct vt_archive_version *version = &archive->versions[slot];
+
+        if (memcmp(version->service, service, ARCHIVE_SERVICE_MAX) == 0
+            && memcmp(version->page, page, PAGE_NUMBER_MAX) == 0) {
+            version->offset = offset;
+            return EXIT_SUCCESS;
+        }
+
+        slot = (slot + 1) & (archive->version_capacity - 1);
+    }
+
+    struct vt_archive_version *version = &archive->versions[slot];
+    memcpy(version->service, service, ARCHIVE_SERVICE_MAX);
+    memcpy(version->page, page, PAGE_NUMBER_MAX);
+    version->offset = offset;
+    ++archive->version_count;
+    return EXIT_SUCCESS;
+}
+
+/*
+The record of the latest version of service's page, or 0 if there isn't one
+*/
+static uint64_t
+vt_get_version(struct vt_archive *archive, const char *service, const char *page)
+{
+    if (archive->version_capacity == 0) {
+        return 0;
+    }
+
+    for (uint32_t slot = vt_version_hash(service, page) & (archive->version_capacity - 1); 
+        archive->versions[slot].offset != 0; 
+        slot = (slot + 1) & (archive->version_capacity - 1)) {
+        struct vt_archive_version *version = &archive->versions[slot];
+
+        if (memcmp(version->service, service, ARCHIVE_SERVICE_MAX) == 0
+            && memcmp(version->page, page, PAGE_NUMBER_MAX) == 0) {
+            return version->offset;
+        }
+    }
+
+    return 0;
+}
+
+/*
+Returns the length of the delta of data against the version at base_offset, 
+which is returned in delta for the caller to free, or -1 if the frame should be
+stored in full: because it's time for a keyframe or the delta, with its header,
+wouldn't be smaller
+*/
+static int
+vt_make_delta(struct vt_archive *archive, uint64_t base_offset, const uint8_t *data, 
+    uint32_t length, struct vt_archive_delta *header, uint8_t **delta)
+{
+    struct vt_archive_record record;
+    struct vt_archive_delta base_header = {0};
+    uint32_t base_length = 0;
+    int delta_max = (int)length - (int)sizeof(struct vt_archive_delta) - 1;
+
+    if (delta_max < 0 
+        || vt_read_at(archive, NULL, 0, &record, sizeof(record), base_offset) != EXIT_SUCCESS) {
+        return -1;
+    }
+
+    if ((record.flags & ARCHIVE_RECORD_DELTA)
+        && vt_read_at(archive, NULL, 0, &base_header, sizeof(base_header), 
+            base_offset + sizeof(record)) != EXIT_SUCCESS) {
+        return -1;
+    }
+
+    if (base_header.depth + 1 >= ARCHIVE_KEYFRAME_INTERVAL) {
+        return -1;
+    }
+
+    const uint8_t *base = vt_rebuild(archive, NULL, 0, base_offset, -1, &base_length);
+
+    if (base == NULL || (*delta = malloc(length)) == NULL) {
+        return -1;
+    }
+
+    int delta_length = vt_delta_encode(base, base_length, data, length, *delta, delta_max);
+
+    if (delta_length == -1) {
+        free(*delta);
+        *delta = NULL;
+        return -1;
+    }
+
+    header->base_offset = base_offset;
+    header->length = length;
+    header->depth = base_header.depth + 1;
+    return delta_length;
+}
+
+/*
+The frame of the record at offset, rebuilt into archive->frame. Read from map,
+which holds map_length bytes of the file, or from the file if it's NULL. depth
+is the number of deltas the record must be from a full record, or -1 for any.
+Each base must be one nearer, so a damaged archive can't make the walk longer
+than ARCHIVE_KEYFRAME_INTERVAL. Returns NULL if the records are damaged
+*/
+static const uint8_t *
+vt_rebuild(struct vt_archive *archive, const uint8_t *map, size_t map_length,
+    uint64_t offset, int depth, uint32_t *length)
+{
+    struct vt_archive_record record;
+    uint64_t data_offset = offset + sizeof(record);
+
+    if (vt_read_at(archive, map, map_length, &record, sizeof(record), offset) != EXIT_SUCCESS
+        || record.magic != ARCHIVE_RECORD_MAGIC) {
+        return NULL;
+    }
+
+    if (record.flags & ARCHIVE_RECORD_DELTA) {
+        struct vt_archive_delta header;
+        uint32_t base_length = 0;
+
+        if (record.length < sizeof(header)
+            || vt_read_at(archive, map, map_length, &header, sizeof(header), data_offset) != EXIT_SUCCESS
+            || header.base_offset >= offset
+            || header.depth == 0 || header.depth >= ARCHIVE_KEYFRAME_INTERVAL
+            || (depth != -1 && header.depth != (uint32_t)depth)
+            || vt_rebuild(archive, map, map_length, header.base_offset, header.depth - 1, &base_length) == NULL
+            || vt_grow_frame(archive, header.length > base_length ? header.length : base_length) != EXIT_SUCCESS) {
+            return NULL;
+        }
+
+        uint32_t delta_length = record.length - sizeof(header);
+        uint8_t *delta = malloc(delta_length > 0 ? delta_length : 1);
+
+        if (delta == NULL) {
+            log_err();
+            return NULL;
+        }
+
+        int rv = vt_read_at(archive, map, map_length, delta, delta_length, data_offset + sizeof(header));
+
+        if (rv == EXIT_SUCCESS) {
+            rv = vt_delta_apply(archive->frame, base_length, header.length, delta, delta_length);
+        }
+
+        free(delta);
+        *length = header.length;
+        return rv == EXIT_SUCCESS ? archive->frame : NULL;
+    }
+
+    if (depth > 0) {
+        return NULL;
+    }
+
+    if (record.flags & ARCHIVE_RECORD_SHARED) {
+        struct vt_archive_record blob;
+
+        if (vt_read_at(archive, map, map_length, &data_offset, sizeof(data_offset), offset + sizeof(record)) != EXIT_SUCCESS
+            || data_offset < sizeof(struct vt_archive_header) + sizeof(record) || data_offset > offset
+            || vt_read_at(archive, map, map_length, &blob, sizeof(blob), data_offset - sizeof(blob)) != EXIT_SUCCESS
+            || (blob.flags & (ARCHIVE_RECORD_SHARED | ARCHIVE_RECORD_DELTA))) {
+            return NULL;
+        }
+
+        record.length = blob.length;
+    }
+
+    if (vt_grow_frame(archive, record.length) != EXIT_SUCCESS
+        || vt_read_at(archive, map, map_length, archive->frame, record.length, data_offset) != EXIT_SUCCESS) {
+        return NULL;
+    }
+
+    *length = record.length;
+    return archive->frame;
+}
+
+static int
+vt_read_at(struct vt_archive *archive, const uint8_t *map, size_t map_length,
+    void *buffer, size_t length, uint64_t offset)
+{
+    if (map == NULL) {
+        return pread(archive->fd, buffer, length, offset) == (ssize_t)length ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (offset > map_length || length > map_length - offset) {
+        return EXIT_FAILURE;
+    }
+
+    memcpy(buffer, map + offset, length);
+    return EXIT_SUCCESS;
+}
+
+static int
+vt_grow_frame(struct vt_archive *archive, uint32_t size)
+{
+    if (size <= archive->frame_size && archive->frame != NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    uint8_t *frame = realloc(archive->frame, size > 0 ? size : 1);
+
+    if (frame == NULL) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    archive->frame = frame;
+    archive->frame_size = size;
+    return EXIT_SUCCESS;
+}
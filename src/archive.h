@@ -0,0 +1,160 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include "decoder.h"
+
+/*
+A single file holding many frames:
+    header | record | record | ... | index | trailer
+Each record is a vt_archive_record followed by the raw frame bytes. The index is 
+sorted by page number then capture time so frames can be found by page without 
+reading the records. All integers are in host byte order
+
+Frames are stored once. A capture of a frame already in the archive is a shared
+record, holding the offset of the first copy's bytes rather than the bytes
+themselves. Version 1 archives have no shared records or hashes in the index;
+they can be read, and are upgraded when the first shared record is appended
+
+Later versions of a service's page are delta records: a vt_archive_delta and a
+delta (see delta.h) against the previous version. Every ARCHIVE_KEYFRAME_INTERVAL
+versions, or when the delta wouldn't be smaller, the page is stored in full, so
+a version is rebuilt from at most that many records. Version 2 archives have no
+delta records, and are upgraded when the first is appended
+*/
+#define ARCHIVE_MAGIC           (0x41585456)    //  "VTXA"
+#define ARCHIVE_RECORD_MAGIC    (0x52585456)    //  "VTXR"
+#define ARCHIVE_INDEX_MAGIC     (0x49585456)    //  "VTXI"
+#define ARCHIVE_VERSION         (3)
+#define ARCHIVE_VERSION_MIN     (1)
+#define ARCHIVE_SERVICE_MAX     (32)
+#define ARCHIVE_KEYFRAME_INTERVAL   (16)
+//  For vt_archive_find_at and vt_archive_latest, to take the latest capture.
+//  mktime's error value, so never a time asked for
+#define ARCHIVE_LATEST          ((time_t)-1)
+
+enum vt_archive_record_flags
+{
+    //  The record's data is the uint64_t offset of the frame's bytes
+    ARCHIVE_RECORD_SHARED   = 1 << 0,
+    //  The record's data is a vt_archive_delta followed by the delta
+    ARCHIVE_RECORD_DELTA    = 1 << 1
+};
+
+struct vt_archive_header
+{
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct vt_archive_record
+{
+    uint32_t magic;
+    //  Number of frame bytes following the record
+    uint32_t length;
+    int64_t time;
+    char service[ARCHIVE_SERVICE_MAX];
+    char page[PAGE_NUMBER_MAX];
+    //  vt_archive_record_flags
+    uint32_t flags;
+};
+
+struct vt_archive_delta
+{
+    //  File offset of the vt_archive_record of the previous version
+    uint64_t base_offset;
+    //  Of the frame, not the delta
+    uint32_t length;
+    //  Deltas back to a frame stored in full, counting this one
+    uint32_t depth;
+};
+
+struct vt_archive_index_entry
+{
+    //  File offset of the vt_archive_record
+    uint64_t offset;
+    int64_t time;
+    char page[PAGE_NUMBER_MAX];
+    //  Of the frame, not the record
+    uint32_t length;
+    //  vt_store_hash of the frame, and where its bytes are. For a delta record,
+    //  where its vt_archive_delta is
+    uint64_t hash;
+    uint64_t data_offset;
+};
+
+//  The latest version of a service's page, for the next to be a delta against
+struct vt_archive_version
+{
+    char service[ARCHIVE_SERVICE_MAX];
+    char page[PAGE_NUMBER_MAX];
+    //  File offset of its vt_archive_record. 0 if the slot is empty
+    uint64_t offset;
+};
+
+//  A frame's bytes, for finding copies already in the archive
+struct vt_archive_blob
+{
+    uint64_t hash;
+    uint64_t data_offset;
+    uint32_t length;
+};
+
+struct vt_archive_trailer
+{
+    uint64_t index_offset;
+    uint32_t index_count;
+    uint32_t magic;
+};
+
+struct vt_archive
+{
+    int fd;
+    bool is_writable;
+    //  Of the file. Writers raise it to ARCHIVE_VERSION when a record needs it
+    uint32_t version;
+    //  Read-only mapping of the whole file (readers only)
+    uint8_t *map;
+    size_t map_length;
+    //  Points into the map, or to index_buffer if the index had to be rebuilt or
+    //  the archive is open for writing
+    struct vt_archive_index_entry *index;
+    struct vt_archive_index_entry *index_buffer;
+    uint32_t index_count;
+    uint32_t index_capacity;
+    //  Where the next record will be written
+    uint64_t end_offset;
+    //  Writers only. Open addressed by hash, empty slots have a data_offset of 0
+    struct vt_archive_blob *blobs;
+    uint32_t blob_capacity;
+    uint32_t blob_count;
+    //  Frames appended that were already in the archive
+    uint32_t shared_count;
+    //  Writers only. Open addressed by service and page
+    struct vt_archive_version *versions;
+    uint32_t version_capacity;
+    uint32_t version_count;
+    //  Frames appended as deltas
+    uint32_t delta_count;
+    //  Delta records are rebuilt here
+    uint8_t *frame;
+    uint32_t frame_size;
+};
+
+bool vt_archive_is_archive(int fd);
+int vt_archive_open(struct vt_archive *archive, const char *path);
+int vt_archive_append(struct vt_archive *archive, const char *service, const char *page, 
+    time_t when, const uint8_t *data, uint32_t length);
+int vt_archive_map(struct vt_archive *archive, int fd);
+struct vt_archive_index_entry *vt_archive_find(struct vt_archive *archive, const char *page);
+struct vt_archive_index_entry *vt_archive_find_at(struct vt_archive *archive, const char *page, 
+    time_t when);
+struct vt_archive_index_entry *vt_archive_latest(struct vt_archive *archive, time_t when);
+int vt_archive_get_record(struct vt_archive *archive, struct vt_archive_index_entry *entry, 
+    struct vt_archive_record *record, const uint8_t **data);
+int vt_archive_close(struct vt_archive *archive);
+
+#endif
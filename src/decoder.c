@@ -1,6 +1,10 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "decoder.h"
 #include "log.h"
 
@@ -17,28 +21,59 @@ static void vt_reset_after_flags(struct vt_decoder_state *state);
 static void vt_get_char_code(struct vt_decoder_state *state, 
     bool is_alpha, bool is_contiguous, int row_code, int col_code, struct vt_decoder_char *ch);
 static void vt_put_char(struct vt_decoder_state *state, 
-    int row, int col, wchar_t ch, struct vt_decoder_attr *attr);
+    int row, int col, wchar_t ch, const struct vt_decoder_attr *attr);
 static void vt_init_colors(void);
 static void vt_trace(struct vt_decoder_state *state, char *format, ...);
 static void vt_dump(struct vt_decoder_state *state, uint8_t *buffer, int count);
+static bool vt_grow_frame_buffer(struct vt_decoder_state *state);
+static void vt_refresh(struct vt_decoder_state *state);
+static void vt_build_glyphs(struct vt_decoder_state *state);
+static int vt_plain_run_length(const uint8_t *buffer, int count);
+static void vt_put_run(struct vt_decoder_state *state, const uint8_t *buffer, int count);
+static void vt_check_predictions(struct vt_decoder_state *state);
+static void vt_move_to_prediction(struct vt_decoder_state *state);
 void vt_move_cursor(struct vt_decoder_state *state);
 
+/*
+If state->win is NULL, curses isn't used. Cells are still maintained for the
+caller to render or inspect
+*/
 void 
 vt_decoder_init(struct vt_decoder_state *state)
 {
-    if (has_colors()) {
-        start_color();
+    if (state->win != NULL) {
+        if (has_colors()) {
+            start_color();
 
-        if (COLOR_PAIRS >= 64) {
-            vt_init_colors();
+            if (COLOR_PAIRS >= 64) {
+                vt_init_colors();
+            }
         }
+
+        curs_set(0);
     }
 
-    curs_set(0);
     state->flags.is_cursor_on = false;
+    state->prediction_count = 0;
     vt_new_frame(state);
     vt_get_char_code(state, true, false, 0, 2, &state->space);
-    wrefresh(state->win);
+
+    if (state->glyphs_map_char != state->map_char) {
+        vt_build_glyphs(state);
+    }
+
+    if (state->win != NULL) {
+        vt_refresh(state);
+    }
+}
+
+void
+vt_decoder_free(struct vt_decoder_state *state)
+{
+    free(state->frame_buffer);
+    state->frame_buffer = NULL;
+    state->frame_buffer_offset = 0;
+    state->frame_buffer_size = 0;
 }
 
 void
@@ -60,12 +95,28 @@ vt_decoder_decode(struct vt_decoder_state *state, uint8_t *buffer, int count)
         vt_dump(state, buffer, count);
     }
 
+    state->counters.bytes_decoded += count;
+
     //  n.b. After evaluating chars, we 'continue' if it shouldn't be displayed.
     //  'break' if it should
     for (int bidx = 0; bidx < count; ++bidx) {
+        //  Runs of printable characters change no attributes, so take them a
+        //  row at a time. Tracing needs to see every character
+        if (state->trace_file == NULL && !state->flags.is_escaped 
+            && state->glyphs_map_char == state->map_char) {
+            int limit = count - bidx < MAX_COLS - state->col ? count - bidx : MAX_COLS - state->col;
+            int run = vt_plain_run_length(buffer + bidx, limit);
+
+            if (run > 1) {
+                vt_put_run(state, buffer + bidx, run);
+                bidx += run - 1;
+                continue;
+            }
+        }
+
         uint8_t b = buffer[bidx];
 
-        if (state->frame_buffer_offset < FRAME_BUFFER_MAX) {
+        if (state->frame_buffer_offset < state->frame_buffer_size || vt_grow_frame_buffer(state)) {
             state->frame_buffer[state->frame_buffer_offset++] = b;
         }
 
@@ -141,13 +192,17 @@ vt_decoder_decode(struct vt_decoder_state *state, uint8_t *buffer, int count)
             vt_trace(state, "CR (fill to end)");
             continue;
         case 17:    //  DC1 - cursor on
-            curs_set(1);
+            if (state->win != NULL) {
+                curs_set(1);
+            }
             state->flags.is_cursor_on = true;
             vt_move_cursor(state);
             vt_trace(state, "DC1 (cursor on)");
             continue;
         case 20:    //  DC4 - cursor off
-            curs_set(0);
+            if (state->win != NULL) {
+                curs_set(0);
+            }
             state->flags.is_cursor_on = false;
             vt_move_cursor(state);
             vt_trace(state, "DC4 (cursor off)");
@@ -264,6 +319,7 @@ vt_decoder_decode(struct vt_decoder_state *state, uint8_t *buffer, int count)
 
             if (col_code == 0 || col_code == 1) {
                 ch = state->flags.is_mosaic_held ? state->flags.held_mosaic : state->space;
+                attr.bits |= state->flags.is_mosaic_held ? CELL_MOSAIC : 0;
 
                 if (state->flags.is_double_height) {
                     vt_trace(state, "%lc %04x (double height row upper half spacing character or held mosaic)", ch.upper, ch.upper);
@@ -281,6 +337,8 @@ vt_decoder_decode(struct vt_decoder_state *state, uint8_t *buffer, int count)
             else {
                 vt_get_char_code(state, state->flags.is_alpha, 
                     state->flags.is_contiguous, row_code, col_code, &ch);
+                //  Columns 4 and 5 are always alphanumeric ("blast through")
+                attr.bits |= !state->flags.is_alpha && col_code != 4 && col_code != 5 ? CELL_MOSAIC : 0;
 
                 if (state->flags.is_double_height) {
                     vt_trace(state, "%lc %04x (double height row upper half)", ch.upper, ch.upper);
@@ -322,18 +380,28 @@ vt_decoder_decode(struct vt_decoder_state *state, uint8_t *buffer, int count)
             vt_next_row(state);
         }
 
-        wmove(state->win, state->row, state->col);
-        wrefresh(state->win);
+        if (state->win != NULL) {
+            wmove(state->win, state->row, state->col);
+            vt_refresh(state);
+        }
+    }
+
+    if (state->prediction_count > 0) {
+        vt_check_predictions(state);
     }
 }
 
 void
 vt_move_cursor(struct vt_decoder_state *state)
 {
+    if (state->win == NULL) {
+        return;
+    }
+
     wmove(state->win, state->row, state->col);
 
     if (state->flags.is_cursor_on) {
-        wrefresh(state->win);
+        vt_refresh(state);
     }
 }
 
@@ -341,30 +409,35 @@ void
 vt_decoder_toggle_flash(struct vt_decoder_state *state)
 {
     bool needs_refresh = false;
-    int curs = curs_set(0);
+    int curs = state->win != NULL ? curs_set(0) : 0;
     state->screen_flash_state = !state->screen_flash_state;
+    ++state->counters.flash_toggles;
 
     if (curs) {
-        wrefresh(state->win);
+        vt_refresh(state);
     }
 
     for (int r = 0; r < MAX_ROWS; ++r) {
         for (int c = 0; c < MAX_COLS; ++c) {
             struct vt_decoder_cell *cell = &state->cells[r][c];
 
-            if (cell->attr.has_flash) {
+            if (cell->attr.bits & CELL_FLASH) {
                 vt_put_char(state, r, c, cell->character, &cell->attr);
                 needs_refresh = true;
             }
         }
     }
 
+    if (state->win == NULL) {
+        return;
+    }
+
     curs_set(curs);
 
     if (needs_refresh || curs) {
         //  restore cursor position
         wmove(state->win, state->row, state->col);
-        wrefresh(state->win);
+        vt_refresh(state);
     }
 }
 
@@ -372,36 +445,351 @@ void
 vt_decoder_toggle_reveal(struct vt_decoder_state *state)
 {
     bool needs_refresh = false;
-    int curs = curs_set(0);
+    int curs = state->win != NULL ? curs_set(0) : 0;
     state->screen_revealed_state = !state->screen_revealed_state;
 
     if (curs) {
-        wrefresh(state->win);
+        vt_refresh(state);
     }
 
     for (int r = 0; r < MAX_ROWS; ++r) {
         for (int c = 0; c < MAX_COLS; ++c) {
             struct vt_decoder_cell *cell = &state->cells[r][c];
 
-            if (cell->attr.has_concealed) {
+            if (cell->attr.bits & CELL_CONCEALED) {
                 vt_put_char(state, r, c, cell->character, &cell->attr);
                 needs_refresh = true;
             }
         }
     }
 
+    if (state->win == NULL) {
+        return;
+    }
+
     curs_set(curs);
 
     if (needs_refresh || curs) {
         //  restore cursor position
         wmove(state->win, state->row, state->col);
-        wrefresh(state->win);
+        vt_refresh(state);
+    }
+}
+
+/*
+The character to show for a cell, given the current flash and reveal states
+*/
+wchar_t
+vt_decoder_display_char(struct vt_decoder_state *state, struct vt_decoder_cell *cell)
+{
+    if ((cell->attr.bits & CELL_CONCEALED) && !state->screen_revealed_state) {
+        return WSPACE;
+    }
+
+    if ((cell->attr.bits & CELL_FLASH) && !state->screen_flash_state) {
+        return WSPACE;
+    }
+
+    return cell->character;
+}
+
+/*
+The alphanumeric text of the frame as ASCII, one line per row. Mosaics and 
+characters outside ASCII become spaces. Returns the length written to text
+*/
+int
+vt_decoder_get_text(struct vt_decoder_state *state, char *text, int len)
+{
+    int out = 0;
+
+    for (int r = 0; r < MAX_ROWS && out + MAX_COLS + 1 < len; ++r) {
+        for (int c = 0; c < MAX_COLS; ++c) {
+            struct vt_decoder_cell *cell = &state->cells[r][c];
+            wchar_t ch = cell->character;
+
+            text[out++] = !(cell->attr.bits & CELL_MOSAIC) && ch < 0x80 && isprint(ch) ? ch : SPACE;
+        }
+
+        text[out++] = '\n';
+    }
+
+    text[out] = 0;
+    return out;
+}
+
+/*
+Find the page number in the header row, i.e. the first run of digits followed by a 
+frame letter such as "91a". Teletext headers have no frame letter so we accept a 
+3 digit page instead
+*/
+bool
+vt_decoder_get_page_number(struct vt_decoder_state *state, char *page, int len)
+{
+    for (int c = 0; c < MAX_COLS; ++c) {
+        if (!isdigit(state->header_row[c]) || (c > 0 && isalnum(state->header_row[c - 1]))) {
+            continue;
+        }
+
+        int end = c;
+        while (end < MAX_COLS && isdigit(state->header_row[end])) {
+            ++end;
+        }
+
+        bool has_letter = end < MAX_COLS && islower(state->header_row[end]);
+        bool is_delimited = end == MAX_COLS || !isalnum(state->header_row[end]);
+
+        if (has_letter) {
+            ++end;
+        }
+        else if (!(is_delimited && end - c == 3)) {
+            c = end;
+            continue;
+        }
+
+        if (end - c >= len) {
+            return false;
+        }
+
+        memcpy(page, &state->header_row[c], end - c);
+        page[end - c] = 0;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+Bytes needed for vt_decoder_snapshot
+*/
+size_t
+vt_decoder_snapshot_size(struct vt_decoder_state *state)
+{
+    return sizeof(struct vt_decoder_snapshot) + state->frame_buffer_offset;
+}
+
+/*
+Returns the length written to buffer, or 0 if it's too small
+*/
+size_t
+vt_decoder_snapshot(struct vt_decoder_state *state, uint8_t *buffer, size_t len)
+{
+    size_t size = vt_decoder_snapshot_size(state);
+
+    if (len < size) {
+        return 0;
+    }
+
+    struct vt_decoder_snapshot *snapshot = (struct vt_decoder_snapshot *)buffer;
+    struct vt_decoder_flags *flags = &state->flags;
+    struct vt_decoder_after_flags *after = &state->after_flags;
+
+    memset(snapshot, 0, sizeof(struct vt_decoder_snapshot));
+    snapshot->magic = SNAPSHOT_MAGIC;
+    snapshot->version = SNAPSHOT_VERSION;
+    snapshot->bits = (flags->is_alpha ? SNAPSHOT_IS_ALPHA : 0)
+        | (flags->is_contiguous ? SNAPSHOT_IS_CONTIGUOUS : 0)
+        | (flags->is_flashing ? SNAPSHOT_IS_FLASHING : 0)
+        | (flags->is_escaped ? SNAPSHOT_IS_ESCAPED : 0)
+        | (flags->is_boxing ? SNAPSHOT_IS_BOXING : 0)
+        | (flags->is_concealed ? SNAPSHOT_IS_CONCEALED : 0)
+        | (flags->is_mosaic_held ? SNAPSHOT_IS_MOSAIC_HELD : 0)
+        | (flags->is_double_height ? SNAPSHOT_IS_DOUBLE_HEIGHT : 0)
+        | (flags->is_cursor_on ? SNAPSHOT_IS_CURSOR_ON : 0)
+        | (state->screen_flash_state ? SNAPSHOT_SCREEN_FLASH : 0)
+        | (state->screen_revealed_state ? SNAPSHOT_SCREEN_REVEALED : 0);
+    snapshot->bg_color = flags->bg_color;
+    snapshot->alpha_fg_color = flags->alpha_fg_color;
+    snapshot->mosaic_fg_color = flags->mosaic_fg_color;
+    snapshot->after_alpha_fg_color = after->alpha_fg_color;
+    snapshot->after_mosaic_fg_color = after->mosaic_fg_color;
+    snapshot->after_is_flashing = after->is_flashing;
+    snapshot->after_is_boxing = after->is_boxing;
+    snapshot->after_is_mosaic_held = after->is_mosaic_held;
+    snapshot->after_is_double_height = after->is_double_height;
+    snapshot->row = state->row;
+    snapshot->col = state->col;
+    snapshot->dheight_low_row = state->dheight_low_row;
+    snapshot->held_mosaic = flags->held_mosaic;
+    snapshot->space = state->space;
+    memcpy(snapshot->header_row, state->header_row, MAX_COLS);
+    snapshot->frame_buffer_length = state->frame_buffer_offset;
+
+    memcpy(snapshot->cells, state->cells, sizeof(state->cells));
+
+    //  Only what the host sent
+    for (int i = 0; i < state->prediction_count; ++i) {
+        struct vt_decoder_prediction *prediction = &state->predictions[i];
+
+        if (snapshot->cells[prediction->row][prediction->col].attr.bits & CELL_TENTATIVE) {
+            snapshot->cells[prediction->row][prediction->col] = prediction->saved;
+        }
+    }
+
+    if (state->frame_buffer_offset > 0) {
+        memcpy(buffer + sizeof(struct vt_decoder_snapshot), state->frame_buffer, state->frame_buffer_offset);
+    }
+
+    return size;
+}
+
+/*
+Carry on from a snapshot. The screen is redrawn from the cells rather than by
+decoding the frame buffer again
+*/
+int
+vt_decoder_restore(struct vt_decoder_state *state, const uint8_t *buffer, size_t len)
+{
+    const struct vt_decoder_snapshot *snapshot = (const struct vt_decoder_snapshot *)buffer;
+
+    if (len < sizeof(struct vt_decoder_snapshot) 
+        || snapshot->magic != SNAPSHOT_MAGIC 
+        || snapshot->version != SNAPSHOT_VERSION
+        || snapshot->frame_buffer_length > FRAME_BUFFER_LIMIT
+        || len < sizeof(struct vt_decoder_snapshot) + snapshot->frame_buffer_length
+        || snapshot->row < 0 || snapshot->row >= MAX_ROWS
+        || snapshot->col < 0 || snapshot->col >= MAX_COLS) {
+        return EXIT_FAILURE;
+    }
+
+    while (state->frame_buffer_size < (int)snapshot->frame_buffer_length) {
+        if (!vt_grow_frame_buffer(state)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct vt_decoder_flags *flags = &state->flags;
+    struct vt_decoder_after_flags *after = &state->after_flags;
+
+    //  The cells they were drawn over are about to go
+    state->prediction_count = 0;
+    flags->is_alpha = snapshot->bits & SNAPSHOT_IS_ALPHA;
+    flags->is_contiguous = snapshot->bits & SNAPSHOT_IS_CONTIGUOUS;
+    flags->is_flashing = snapshot->bits & SNAPSHOT_IS_FLASHING;
+    flags->is_escaped = snapshot->bits & SNAPSHOT_IS_ESCAPED;
+    flags->is_boxing = snapshot->bits & SNAPSHOT_IS_BOXING;
+    flags->is_concealed = snapshot->bits & SNAPSHOT_IS_CONCEALED;
+    flags->is_mosaic_held = snapshot->bits & SNAPSHOT_IS_MOSAIC_HELD;
+    flags->is_double_height = snapshot->bits & SNAPSHOT_IS_DOUBLE_HEIGHT;
+    flags->is_cursor_on = snapshot->bits & SNAPSHOT_IS_CURSOR_ON;
+    flags->bg_color = snapshot->bg_color;
+    flags->alpha_fg_color = snapshot->alpha_fg_color;
+    flags->mosaic_fg_color = snapshot->mosaic_fg_color;
+    flags->held_mosaic = snapshot->held_mosaic;
+    after->alpha_fg_color = snapshot->after_alpha_fg_color;
+    after->mosaic_fg_color = snapshot->after_mosaic_fg_color;
+    after->is_flashing = snapshot->after_is_flashing;
+    after->is_boxing = snapshot->after_is_boxing;
+    after->is_mosaic_held = snapshot->after_is_mosaic_held;
+    after->is_double_height = snapshot->after_is_double_height;
+    state->screen_flash_state = snapshot->bits & SNAPSHOT_SCREEN_FLASH;
+    state->screen_revealed_state = snapshot->bits & SNAPSHOT_SCREEN_REVEALED;
+    state->row = snapshot->row;
+    state->col = snapshot->col;
+    state->dheight_low_row = snapshot->dheight_low_row;
+    state->space = snapshot->space;
+    memcpy(state->header_row, snapshot->header_row, MAX_COLS);
+    state->header_row[MAX_COLS] = 0;
+    state->frame_buffer_offset = snapshot->frame_buffer_length;
+
+    if (snapshot->frame_buffer_length > 0) {
+        memcpy(state->frame_buffer, buffer + sizeof(struct vt_decoder_snapshot), snapshot->frame_buffer_length);
+    }
+
+    for (int r = 0; r < MAX_ROWS; ++r) {
+        for (int c = 0; c < MAX_COLS; ++c) {
+            const struct vt_decoder_cell *in = &snapshot->cells[r][c];
+            vt_put_char(state, r, c, in->character, &in->attr);
+        }
+    }
+
+    if (state->win != NULL) {
+        curs_set(flags->is_cursor_on ? 1 : 0);
+        vt_move_cursor(state);
+        vt_refresh(state);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+Draw ch, typed but not yet sent or echoed, where the host is expected to echo
+it: at its cursor, or after the last prediction. It's underlined until the host
+writes the same character there. Returns false if there's no room for it
+*/
+bool
+vt_decoder_predict(struct vt_decoder_state *state, uint8_t ch)
+{
+    if (ch < SPACE || ch > 0x7E || state->prediction_count == PREDICTION_MAX) {
+        return false;
+    }
+
+    int row = state->row;
+    int col = state->col;
+
+    if (state->prediction_count > 0) {
+        struct vt_decoder_prediction *last = &state->predictions[state->prediction_count - 1];
+        row = last->row;
+        col = last->col + 1;
+    }
+
+    if (col >= MAX_COLS || row == state->dheight_low_row) {
+        return false;
+    }
+
+    struct vt_decoder_prediction *prediction = &state->predictions[state->prediction_count++];
+    struct vt_decoder_attr attr;
+
+    vt_set_attr(state, &attr);
+    attr.bits |= CELL_TENTATIVE;
+    prediction->row = row;
+    prediction->col = col;
+    prediction->character = state->map_char(ch & 0xF, (ch & 0x70) >> 4, true, true, false, false);
+    prediction->saved = state->cells[row][col];
+    vt_put_char(state, row, col, prediction->character, &attr);
+    vt_move_to_prediction(state);
+    return true;
+}
+
+/*
+Put back what was under the predictions the host hasn't echoed
+*/
+void
+vt_decoder_cancel_predictions(struct vt_decoder_state *state)
+{
+    for (int i = state->prediction_count - 1; i >= 0; --i) {
+        struct vt_decoder_prediction *prediction = &state->predictions[i];
+        struct vt_decoder_cell *cell = &state->cells[prediction->row][prediction->col];
+
+        if (cell->attr.bits & CELL_TENTATIVE) {
+            vt_put_char(state, prediction->row, prediction->col, 
+                prediction->saved.character, &prediction->saved.attr);
+        }
+    }
+
+    state->prediction_count = 0;
+
+    if (state->win != NULL) {
+        wmove(state->win, state->row, state->col);
+        vt_refresh(state);
     }
 }
 
 static void 
 vt_new_frame(struct vt_decoder_state *state)
 {
+    if (state->frame_end != NULL) {
+        //  Less the FF that ended it, unless the frame buffer was full
+        int length = state->frame_buffer_offset;
+
+        if (length > 0 && state->frame_buffer[length - 1] == 12) {
+            --length;
+        }
+
+        if (length > 0) {
+            state->frame_end(state, length);
+        }
+    }
+
     state->row = 0;
     state->col = 0;
     state->dheight_low_row = -1;
@@ -448,11 +836,13 @@ vt_fill_end(struct vt_decoder_state *state)
         struct vt_decoder_cell *prev = &state->cells[state->row][state->col - 1];
         struct vt_decoder_attr attr;
         memset(&attr, 0, sizeof(struct vt_decoder_attr));
-        attr.attr = prev->attr.attr;
         attr.color_pair = prev->attr.color_pair;
 
         for (int col = state->col; col < MAX_COLS; ++col) {
-            wchar_t ch = state->cells[state->row][col].character;
+            struct vt_decoder_cell *cell = &state->cells[state->row][col];
+            wchar_t ch = cell->character;
+            //  Still a prediction until the host writes the cell itself
+            attr.bits = (prev->attr.bits & CELL_BOLD) | (cell->attr.bits & CELL_TENTATIVE);
             vt_trace(state, "%lc %04x (end fill)", ch, ch);
             vt_put_char(state, state->row, col, ch, &attr);
         }
@@ -532,11 +922,11 @@ static void
 vt_set_attr(struct vt_decoder_state *state, struct vt_decoder_attr *attr)
 {
     memset(attr, 0, sizeof(struct vt_decoder_attr));
-    attr->attr = state->bold_mode ? A_BOLD : 0;
-    attr->has_flash = state->flags.is_flashing;
-    attr->has_concealed = state->flags.is_concealed;
+    attr->bits = (state->bold_mode ? CELL_BOLD : 0)
+        | (state->flags.is_flashing ? CELL_FLASH : 0)
+        | (state->flags.is_concealed ? CELL_CONCEALED : 0);
 
-    if (has_colors()) {
+    if (state->win == NULL || has_colors()) {
         enum vt_decoder_color fg = state->flags.is_alpha ? 
             state->flags.alpha_fg_color : state->flags.mosaic_fg_color;
         attr->color_pair = vt_get_color_pair_number(fg, state->flags.bg_color);
@@ -568,28 +958,21 @@ vt_get_char_code(
 }
 
 static void
-vt_put_char(struct vt_decoder_state *state, int row, int col, wchar_t ch, struct vt_decoder_attr *attr)
+vt_put_char(struct vt_decoder_state *state, int row, int col, wchar_t ch, const struct vt_decoder_attr *attr)
 {
     struct vt_decoder_cell *cell = &state->cells[row][col];
-    short display_color = state->mono_mode ? 0 : attr->color_pair;
-    wchar_t display_ch = ch;
-    attr_t display_attr = attr->attr;
-
-    if (attr->has_concealed && !state->screen_revealed_state) {
-        display_ch = WSPACE;
-    }
-
-    if (attr->has_flash && !state->screen_flash_state) {
-        display_ch = WSPACE;
-    }
-
-    wchar_t vchar[2] = {display_ch, L'\0'};
-    cchar_t cc;
-    setcchar(&cc, vchar, display_attr, display_color, 0);
-    mvwadd_wch(state->win, row, col, &cc);
-
     cell->attr = *attr;
     cell->character = ch;
+    ++state->counters.cells_written;
+
+    if (state->win != NULL) {
+        short display_color = state->mono_mode ? 0 : attr->color_pair;
+        wchar_t vchar[2] = {vt_decoder_display_char(state, cell), L'\0'};
+        cchar_t cc;
+        attr_t attrs = ((attr->bits & CELL_BOLD) ? A_BOLD : 0) | ((attr->bits & CELL_TENTATIVE) ? A_UNDERLINE : 0);
+        setcchar(&cc, vchar, attrs, display_color, 0);
+        mvwadd_wch(state->win, row, col, &cc);
+    }
 }
 
 static void 
@@ -613,7 +996,9 @@ vt_trace(struct vt_decoder_state *state, char *format, ...)
     int cx = 0;
 
     if (state->trace_file != NULL) {
-        getyx(state->win, cy, cx);
+        if (state->win != NULL) {
+            getyx(state->win, cy, cx);
+        }
         fprintf(state->trace_file, "%02d,%02d (%02d,%02d)\t", state->row, state->col, cy, cx);
         va_list args;
         va_start(args, format);
@@ -623,6 +1008,190 @@ vt_trace(struct vt_decoder_state *state, char *format, ...)
     }
 }
 
+/*
+Frames are normally well under FRAME_BUFFER_MAX, but some services send long 
+streams of updates without clearing the screen
+*/
+static bool
+vt_grow_frame_buffer(struct vt_decoder_state *state)
+{
+    int size = state->frame_buffer_size == 0 ? FRAME_BUFFER_MAX : state->frame_buffer_size * 2;
+
+    if (size > FRAME_BUFFER_LIMIT) {
+        return false;
+    }
+
+    uint8_t *buffer = realloc(state->frame_buffer, size);
+    if (buffer == NULL) {
+        log_err();
+        return false;
+    }
+
+    state->frame_buffer = buffer;
+    state->frame_buffer_size = size;
+    return true;
+}
+
+static void
+vt_refresh(struct vt_decoder_state *state)
+{
+    ++state->counters.refreshes;
+    wrefresh(state->win);
+}
+
+static void
+vt_build_glyphs(struct vt_decoder_state *state)
+{
+    for (int is_alpha = 0; is_alpha < 2; ++is_alpha) {
+        for (int is_contiguous = 0; is_contiguous < 2; ++is_contiguous) {
+            for (int i = 0; i < GLYPH_CODES; ++i) {
+                int b = i + SPACE;
+                vt_get_char_code(state, is_alpha, is_contiguous, b & 0xF, (b & 0x70) >> 4, 
+                    &state->glyphs[is_alpha][is_contiguous][i]);
+            }
+        }
+    }
+
+    state->glyphs_map_char = state->map_char;
+}
+
+/*
+The number of bytes from the start of buffer that aren't control codes, i.e.
+have bit 5 or bit 6 set, up to count
+*/
+static int
+vt_plain_run_length(const uint8_t *buffer, int count)
+{
+    int n = 0;
+
+#ifdef __SSE2__
+    const __m128i code_bits = _mm_set1_epi8(0x60);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; n + 16 <= count; n += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(buffer + n));
+        int controls = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(bytes, code_bits), zero));
+
+        if (controls != 0) {
+            return n + __builtin_ctz(controls);
+        }
+    }
+#endif
+
+    while (n < count && (buffer[n] & 0x60) != 0) {
+        ++n;
+    }
+
+    return n;
+}
+
+/*
+Equivalent to decoding each byte in turn: no control codes means the
+attributes, and so the after flags, stay as they are for the whole run, which
+never goes past the end of the row
+*/
+static void
+vt_put_run(struct vt_decoder_state *state, const uint8_t *buffer, int count)
+{
+    struct vt_decoder_flags *flags = &state->flags;
+    struct vt_decoder_char *glyphs = state->glyphs[flags->is_alpha][flags->is_contiguous];
+    bool is_visible = state->row != state->dheight_low_row;
+    struct vt_decoder_attr attr;
+    vt_set_attr(state, &attr);
+    uint8_t bits = attr.bits;
+
+    while (state->frame_buffer_offset + count > state->frame_buffer_size && vt_grow_frame_buffer(state)) {
+    }
+
+    int room = state->frame_buffer_size - state->frame_buffer_offset;
+    int saved = count < room ? count : room;
+    if (saved > 0) {
+        memcpy(state->frame_buffer + state->frame_buffer_offset, buffer, saved);
+        state->frame_buffer_offset += saved;
+    }
+
+    for (int i = 0; i < count && is_visible; ++i) {
+        int b = buffer[i] & 0x7F;
+        struct vt_decoder_char *ch = &glyphs[b - SPACE];
+        int col = state->col + i;
+        //  Columns 4 and 5 are always alphanumeric ("blast through")
+        attr.bits = bits | (!flags->is_alpha && (b < 0x40 || b >= 0x60) ? CELL_MOSAIC : 0);
+
+        if (flags->is_double_height) {
+            vt_put_char(state, state->row, col, ch->upper, &attr);
+            vt_put_char(state, state->dheight_low_row, col, ch->lower, &attr);
+        }
+        else {
+            vt_put_char(state, state->row, col, ch->single, &attr);
+        }
+
+        if (!flags->is_alpha) {
+            flags->held_mosaic = *ch;
+        }
+
+        if (state->row == 0) {
+            state->header_row[col] = ch->single;
+        }
+    }
+
+    state->col += count;
+
+    if (state->col == MAX_COLS) {
+        vt_next_row(state);
+    }
+
+    if (state->win != NULL) {
+        wmove(state->win, state->row, state->col);
+        vt_refresh(state);
+    }
+}
+
+/*
+Drop the predictions the host has since written over, in the order typed. A 
+different character means the guess was wrong, and the rest are taken back too
+*/
+static void
+vt_check_predictions(struct vt_decoder_state *state)
+{
+    int confirmed = 0;
+
+    for (; confirmed < state->prediction_count; ++confirmed) {
+        struct vt_decoder_prediction *prediction = &state->predictions[confirmed];
+        struct vt_decoder_cell *cell = &state->cells[prediction->row][prediction->col];
+
+        if (cell->attr.bits & CELL_TENTATIVE) {
+            break;
+        }
+
+        if (cell->character != prediction->character) {
+            vt_decoder_cancel_predictions(state);
+            return;
+        }
+    }
+
+    state->prediction_count -= confirmed;
+    memmove(state->predictions, state->predictions + confirmed, 
+        state->prediction_count * sizeof(struct vt_decoder_prediction));
+
+    if (state->prediction_count > 0) {
+        vt_move_to_prediction(state);
+    }
+}
+
+/*
+Show the cursor after the last prediction rather than at the host's cursor
+*/
+static void
+vt_move_to_prediction(struct vt_decoder_state *state)
+{
+    struct vt_decoder_prediction *last = &state->predictions[state->prediction_count - 1];
+
+    if (state->win != NULL) {
+        wmove(state->win, last->row, last->col + 1 < MAX_COLS ? last->col + 1 : last->col);
+        vt_refresh(state);
+    }
+}
+
 static void 
 vt_dump(struct vt_decoder_state *state, uint8_t *buffer, int count)
 {
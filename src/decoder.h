@@ -1,5 +1,5 @@
 #ifndef DECODER_H
-#define DEODER_H
+#define DECODER_H
 
 #ifndef _XOPEN_SOURCE
 #define _XOPEN_SOURCE 700
@@ -14,7 +14,19 @@
 
 #define MAX_ROWS            (24)
 #define MAX_COLS            (40)
+//  The frame buffer starts at FRAME_BUFFER_MAX and doubles as needed up to FRAME_BUFFER_LIMIT
 #define FRAME_BUFFER_MAX    (2000)
+#define FRAME_BUFFER_LIMIT  (1 << 20)
+#define PAGE_NUMBER_MAX     (12)
+//  Printable codes 0x20-0x7F, looked up in vt_decoder_state.glyphs
+#define GLYPH_CODES         (96)
+//  Keys drawn ahead of the host's echo, see vt_decoder_predict
+#define PREDICTION_MAX      (16)
+//  Enough for vt_decoder_get_text
+#define FRAME_TEXT_MAX      (MAX_ROWS * (MAX_COLS + 1) + 1)
+//  "VTXS"
+#define SNAPSHOT_MAGIC      (0x53585456)
+#define SNAPSHOT_VERSION    (1)
 #define WSPACE              L' '
 #define SPACE               ' '
 
@@ -100,22 +112,55 @@ struct vt_decoder_after_flags
     enum vt_decoder_tristate is_double_height;
 };
 
+enum vt_decoder_cell_bits
+{
+    CELL_BOLD           = 1 << 0,
+    CELL_FLASH          = 1 << 1,
+    CELL_CONCEALED      = 1 << 2,
+    //  The cell holds a mosaic (graphics) character
+    CELL_MOSAIC         = 1 << 3,
+    //  Predicted locally and not yet echoed by the host. Drawn underlined
+    CELL_TENTATIVE      = 1 << 4
+};
+
 struct vt_decoder_attr
 {
-    //  Curses attr
-    attr_t attr;
-    //  Curses color pair
-    short color_pair;
-    //  Other flags
-    bool has_flash;
-    bool has_concealed;
+    //  See vt_get_color_pair_number. Becomes a curses color pair when drawn
+    uint8_t color_pair;
+    //  vt_decoder_cell_bits
+    uint8_t bits;
 };
 
+/*
+32 bits a cell, so a frame is under 4KB. Curses attributes are only worked
+out when a cell is drawn
+*/
 struct vt_decoder_cell
 {
+    //  Glyph from map_char
+    uint16_t character;
     struct vt_decoder_attr attr;
-    //  type used by ncursesw
-    wchar_t character;
+};
+
+/*
+A key drawn where the host is expected to echo it
+*/
+struct vt_decoder_prediction
+{
+    int8_t row;
+    int8_t col;
+    uint16_t character;
+    //  Put back if the host doesn't echo it
+    struct vt_decoder_cell saved;
+};
+
+//  Cheap enough to keep up to date in the decode loop
+struct vt_decoder_counters
+{
+    uint64_t bytes_decoded;
+    uint64_t cells_written;
+    uint64_t refreshes;
+    uint64_t flash_toggles;
 };
 
 struct vt_decoder_state
@@ -132,23 +177,91 @@ struct vt_decoder_state
     //  Set when we need to ignore double height row 2 in the input stream
     int dheight_low_row;
     //  Raw frame buffer as read from the socket/fd etc. Used when saving etc
-    uint8_t frame_buffer[FRAME_BUFFER_MAX];
+    uint8_t *frame_buffer;
     int frame_buffer_offset;
+    int frame_buffer_size;
     //  The first row of the frame buffer/screen; so we can check header data like frame number
     uint8_t header_row[MAX_COLS + 1];
     bool screen_flash_state;
     bool screen_revealed_state;
     struct vt_decoder_cell cells[MAX_ROWS][MAX_COLS];
     struct vt_decoder_char space;
+    struct vt_decoder_counters counters;
+    //  In the order typed. Checked against the cells after each decode
+    struct vt_decoder_prediction predictions[PREDICTION_MAX];
+    int prediction_count;
+    //  If set, called when a clear screen ends a frame, with the length of the
+    //  frame in the frame buffer
+    void (*frame_end)(struct vt_decoder_state *state, int length);
 
     uint16_t (*map_char)(int row_code, int col_code, bool is_alpha, 
         bool is_contiguous, bool is_dheight, bool is_dheight_lower);
+    //  map_char for every printable code, by is_alpha and is_contiguous. Built
+    //  by vt_decoder_init for glyphs_map_char
+    struct vt_decoder_char glyphs[2][2][GLYPH_CODES];
+    uint16_t (*glyphs_map_char)(int row_code, int col_code, bool is_alpha, 
+        bool is_contiguous, bool is_dheight, bool is_dheight_lower);
+};
+
+/*
+A compact, versioned copy of everything the decoder needs to carry on from where
+it was, followed by frame_buffer_length bytes of the frame buffer. Characters
+are glyphs from map_char, so a snapshot must be restored with the same map.
+Cells are stored as they are held
+*/
+enum vt_snapshot_bits
+{
+    SNAPSHOT_IS_ALPHA           = 1 << 0,
+    SNAPSHOT_IS_CONTIGUOUS      = 1 << 1,
+    SNAPSHOT_IS_FLASHING        = 1 << 2,
+    SNAPSHOT_IS_ESCAPED         = 1 << 3,
+    SNAPSHOT_IS_BOXING          = 1 << 4,
+    SNAPSHOT_IS_CONCEALED       = 1 << 5,
+    SNAPSHOT_IS_MOSAIC_HELD     = 1 << 6,
+    SNAPSHOT_IS_DOUBLE_HEIGHT   = 1 << 7,
+    SNAPSHOT_IS_CURSOR_ON       = 1 << 8,
+    SNAPSHOT_SCREEN_FLASH       = 1 << 9,
+    SNAPSHOT_SCREEN_REVEALED    = 1 << 10
+};
+
+struct vt_decoder_snapshot
+{
+    uint32_t magic;
+    uint16_t version;
+    //  vt_snapshot_bits
+    uint16_t bits;
+    int8_t bg_color;
+    int8_t alpha_fg_color;
+    int8_t mosaic_fg_color;
+    int8_t after_alpha_fg_color;
+    int8_t after_mosaic_fg_color;
+    int8_t after_is_flashing;
+    int8_t after_is_boxing;
+    int8_t after_is_mosaic_held;
+    int8_t after_is_double_height;
+    int8_t row;
+    int8_t col;
+    int8_t dheight_low_row;
+    struct vt_decoder_char held_mosaic;
+    struct vt_decoder_char space;
+    uint8_t header_row[MAX_COLS];
+    uint32_t frame_buffer_length;
+    struct vt_decoder_cell cells[MAX_ROWS][MAX_COLS];
 };
 
 void vt_decoder_init(struct vt_decoder_state *state);
+void vt_decoder_free(struct vt_decoder_state *state);
 void vt_decoder_save(struct vt_decoder_state *state, FILE *fout);
 void vt_decoder_decode(struct vt_decoder_state *state, uint8_t *buffer, int count);
 void vt_decoder_toggle_flash(struct vt_decoder_state *state);
 void vt_decoder_toggle_reveal(struct vt_decoder_state *state);
+wchar_t vt_decoder_display_char(struct vt_decoder_state *state, struct vt_decoder_cell *cell);
+int vt_decoder_get_text(struct vt_decoder_state *state, char *text, int len);
+bool vt_decoder_get_page_number(struct vt_decoder_state *state, char *page, int len);
+size_t vt_decoder_snapshot_size(struct vt_decoder_state *state);
+size_t vt_decoder_snapshot(struct vt_decoder_state *state, uint8_t *buffer, size_t len);
+int vt_decoder_restore(struct vt_decoder_state *state, const uint8_t *buffer, size_t len);
+bool vt_decoder_predict(struct vt_decoder_state *state, uint8_t ch);
+void vt_decoder_cancel_predictions(struct vt_decoder_state *state);
 
 #endif
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+#include "delta.h"
+
+//  Shorter runs of unchanged bytes cost more to skip than to copy
+#define DELTA_SKIP_MIN      (3)
+
+static int vt_put_varint(uint8_t *delta, int offset, int delta_max, uint32_t value);
+static int vt_get_varint(const uint8_t *delta, int offset, int delta_length, uint32_t *value);
+
+/*
+Returns the length of the delta, or -1 if it would be longer than delta_max.
+Pass the frame length as delta_max to only accept deltas that are smaller
+*/
+int
+vt_delta_encode(const uint8_t *base, int base_length, const uint8_t *frame, int length, 
+    uint8_t *delta, int delta_max)
+{
+    int out = 0;
+    int i = 0;
+
+    while (i < length) {
+        int start = i;
+
+        while (i < length && i < base_length && frame[i] == base[i]) {
+            ++i;
+        }
+
+        int skip = i - start;
+        int literal = i;
+        int same = 0;
+
+        //  Take changed bytes up to the next run worth skipping
+        while (i < length && same < DELTA_SKIP_MIN) {
+            same = i < base_length && frame[i] == base[i] ? same + 1 : 0;
+            ++i;
+        }
+
+        if (same == DELTA_SKIP_MIN) {
+            i -= same;
+        }
+
+        int count = i - literal;
+
+        if (count == 0 && i == length) {
+            break;
+        }
+
+        if ((out = vt_put_varint(delta, out, delta_max, skip)) == -1
+            || (out = vt_put_varint(delta, out, delta_max, count)) == -1
+            || out + count > delta_max) {
+            return -1;
+        }
+
+        for (int b = literal; b < i; ++b) {
+            delta[out++] = frame[b] ^ (b < base_length ? base[b] : 0);
+        }
+    }
+
+    return out;
+}
+
+/*
+frame holds the base_length bytes of the base and has room for length bytes.
+It's turned into the frame in place
+*/
+int
+vt_delta_apply(uint8_t *frame, int base_length, int length, const uint8_t *delta, int delta_length)
+{
+    int in = 0;
+    int i = 0;
+
+    if (length > base_length) {
+        memset(frame + base_length, 0, length - base_length);
+    }
+
+    while (in < delta_length) {
+        uint32_t skip;
+        uint32_t count;
+
+        if ((in = vt_get_varint(delta, in, delta_length, &skip)) == -1
+            || (in = vt_get_varint(delta, in, delta_length, &count)) == -1
+            || skip > (uint32_t)(length - i) || count > (uint32_t)(length - i - skip)
+            || count > (uint32_t)(delta_length - in)) {
+            return EXIT_FAILURE;
+        }
+
+        i += skip;
+
+        for (uint32_t b = 0; b < count; ++b) {
+            frame[i++] ^= delta[in++];
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int
+vt_put_varint(uint8_t *delta, int offset, int delta_max, uint32_t value)
+{
+    do {
+        if (offset >= delta_max) {
+            return -1;
+        }
+
+        delta[offset++] = (value & 0x7F) | (value > 0x7F ? 0x80 : 0);
+        value >>= 7;
+    } while (value != 0);
+
+    return offset;
+}
+
+static int
+vt_get_varint(const uint8_t *delta, int offset, int delta_length, uint32_t *value)
+{
+    *value = 0;
+
+    for (int shift = 0; shift < 32; shift += 7) {
+        if (offset >= delta_length) {
+            return -1;
+        }
+
+        uint8_t b = delta[offset++];
+        *value |= (uint32_t)(b & 0x7F) << shift;
+
+        if ((b & 0x80) == 0) {
+            return offset;
+        }
+    }
+
+    return -1;
+}
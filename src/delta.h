@@ -0,0 +1,17 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+
+/*
+A frame as the XOR of it with an earlier version of itself, run length encoded.
+The delta is a sequence of
+    varint skip | varint count | count bytes
+where skip bytes are unchanged and the count bytes are XORed with the base. A
+base shorter than the frame is taken to be padded with zeros
+*/
+int vt_delta_encode(const uint8_t *base, int base_length, const uint8_t *frame, int length, 
+    uint8_t *delta, int delta_max);
+int vt_delta_apply(uint8_t *frame, int base_length, int length, const uint8_t *delta, int delta_length);
+
+#endif
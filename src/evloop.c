@@ -0,0 +1,622 @@
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include "evloop.h"
+#include "log.h"
+
+//  io_uring user_data is the slot shifted up by this, or'd with the operation
+#define USER_DATA_SHIFT     (8)
+//  The largest completion queue the kernel allows
+#define CQ_ENTRIES_MAX      (65536)
+
+enum vt_uring_op
+{
+    URING_READ  = EVLOOP_READ,
+    URING_POLL  = EVLOOP_POLL,
+    URING_CANCEL
+};
+
+static int vt_uring_init(struct vt_evloop *loop);
+static struct io_uring_sqe *vt_uring_sqe(struct vt_evloop *loop, int slot, enum vt_uring_op op);
+static int vt_uring_enter(struct vt_evloop_uring *uring, uint32_t to_submit, uint32_t min_complete,
+    int timeout_ms);
+static int vt_uring_wait(struct vt_evloop *loop, struct vt_evloop_event *events, int max, int timeout_ms);
+static void vt_uring_free(struct vt_evloop_uring *uring);
+static void vt_epoll_mark(struct vt_evloop *loop, int slot);
+static int vt_epoll_wait(struct vt_evloop *loop, struct vt_evloop_event *events, int max, int timeout_ms);
+static void vt_release_slot(struct vt_evloop *loop, int slot);
+
+/*
+Room for capacity sockets at once. io_uring is tried first if allow_uring
+*/
+int
+vt_evloop_init(struct vt_evloop *loop, int capacity, bool allow_uring)
+{
+    memset(loop, 0, sizeof(struct vt_evloop));
+    loop->uring.fd = -1;
+    loop->epoll_fd = -1;
+    loop->capacity = capacity;
+    loop->slots = calloc(capacity, sizeof(struct vt_evloop_slot));
+    loop->free_slots = malloc(capacity * sizeof(int));
+    loop->dirty_slots = malloc(capacity * sizeof(int));
+    //  Page aligned, and untouched pages cost nothing
+    loop->buffers = mmap(NULL, (size_t)capacity * EVLOOP_BUFFER_LEN, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (loop->buffers == MAP_FAILED) {
+        loop->buffers = NULL;
+    }
+
+    if (loop->slots == NULL || loop->free_slots == NULL || loop->dirty_slots == NULL
+        || loop->buffers == NULL) {
+        log_err();
+        goto abend;
+    }
+
+    //  Lowest first
+    for (int i = capacity - 1; i >= 0; --i) {
+        loop->slots[i].fd = -1;
+        loop->slots[i].registered = -1;
+        loop->free_slots[loop->free_count++] = i;
+    }
+
+    if (allow_uring && vt_uring_init(loop) == EXIT_SUCCESS) {
+        loop->backend = EVLOOP_URING;
+        return EXIT_SUCCESS;
+    }
+
+    loop->backend = EVLOOP_EPOLL;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (loop->epoll_fd == -1) {
+        log_err();
+        goto abend;
+    }
+
+    return EXIT_SUCCESS;
+abend:
+    vt_evloop_free(loop);
+    return EXIT_FAILURE;
+}
+
+/*
+Returns the slot for fd, or -1 if the loop is full
+*/
+int
+vt_evloop_add(struct vt_evloop *loop, int fd, void *user)
+{
+    if (loop->free_count == 0) {
+        errno = EMFILE;
+        return -1;
+    }
+
+    int slot = loop->free_slots[--loop->free_count];
+    struct vt_evloop_slot *s = &loop->slots[slot];
+
+    memset(s, 0, sizeof(struct vt_evloop_slot));
+    s->fd = fd;
+    s->user = user;
+    s->is_used = true;
+    s->registered = -1;
+    return slot;
+}
+
+/*
+Start reading into the slot's buffer. The read completes as an EVLOOP_READ event
+*/
+int
+vt_evloop_read(struct vt_evloop *loop, int slot)
+{
+    struct vt_evloop_slot *s = &loop->slots[slot];
+
+    if (s->is_reading) {
+        return EXIT_SUCCESS;
+    }
+
+    if (loop->backend == EVLOOP_URING) {
+        struct io_uring_sqe *sqe = vt_uring_sqe(loop, slot, URING_READ);
+
+        if (sqe == NULL) {
+            return EXIT_FAILURE;
+        }
+
+        sqe->opcode = loop->uring.is_fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->addr = (uint64_t)(uintptr_t)(loop->buffers + (size_t)slot * EVLOOP_BUFFER_LEN);
+        sqe->len = EVLOOP_BUFFER_LEN;
+        //  Sockets have no position
+        sqe->off = (uint64_t)-1;
+        sqe->buf_index = 0;
+    }
+    else {
+        vt_epoll_mark(loop, slot);
+    }
+
+    s->is_reading = true;
+    return EXIT_SUCCESS;
+}
+
+/*
+Wait once for events (POLLIN, POLLOUT etc.) on the slot. Completes as an
+EVLOOP_POLL event
+*/
+int
+vt_evloop_poll(struct vt_evloop *loop, int slot, int events)
+{
+    struct vt_evloop_slot *s = &loop->slots[slot];
+
+    if (s->poll_events != 0) {
+        errno = EBUSY;
+        return EXIT_FAILURE;
+    }
+
+    if (loop->backend == EVLOOP_URING) {
+        struct io_uring_sqe *sqe = vt_uring_sqe(loop, slot, URING_POLL);
+
+        if (sqe == NULL) {
+            return EXIT_FAILURE;
+        }
+
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = events;
+    }
+    else {
+        vt_epoll_mark(loop, slot);
+    }
+
+    s->poll_events = events;
+    return EXIT_SUCCESS;
+}
+
+/*
+Stop watching the slot's fd, which may be closed straight after. Anything in
+flight is cancelled and no more events are returned for the slot
+*/
+void
+vt_evloop_remove(struct vt_evloop *loop, int slot)
+{
+    struct vt_evloop_slot *s = &loop->slots[slot];
+
+    if (!s->is_used || s->is_removed) {
+        return;
+    }
+
+    s->is_removed = true;
+
+    if (loop->backend == EVLOOP_EPOLL) {
+        if (s->registered != -1) {
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+        }
+
+        s->is_reading = false;
+        s->poll_events = 0;
+        //  Taken off the dirty list when it's next processed
+        if (!s->is_dirty) {
+            vt_release_slot(loop, slot);
+        }
+        return;
+    }
+
+    //  The kernel holds its own reference to the file, so the fd can go. The slot
+    //  waits for the cancelled operations to complete before it's reused
+    enum vt_uring_op ops[2] = {URING_READ, URING_POLL};
+    bool is_in_flight[2] = {s->is_reading, s->poll_events != 0};
+
+    for (int i = 0; i < 2; ++i) {
+        if (!is_in_flight[i]) {
+            continue;
+        }
+
+        struct io_uring_sqe *sqe = vt_uring_sqe(loop, slot, URING_CANCEL);
+
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = ((uint64_t)slot << USER_DATA_SHIFT) | ops[i];
+        }
+    }
+
+    if (!s->is_reading && s->poll_events == 0) {
+        vt_release_slot(loop, slot);
+    }
+}
+
+/*
+Submit everything started since the last call and wait up to timeout_ms (-1 for
+ever) for at least one event. Returns the number of events, 0 on timeout or -1
+on error
+*/
+int
+vt_evloop_wait(struct vt_evloop *loop, struct vt_evloop_event *events, int max, int timeout_ms)
+{
+    return loop->backend == EVLOOP_URING
+        ? vt_uring_wait(loop, events, max, timeout_ms)
+        : vt_epoll_wait(loop, events, max, timeout_ms);
+}
+
+const char *
+vt_evloop_backend_name(struct vt_evloop *loop)
+{
+    if (loop->backend != EVLOOP_URING) {
+        return "epoll";
+    }
+
+    return loop->uring.is_fixed ? "io_uring (registered buffers)" : "io_uring";
+}
+
+void
+vt_evloop_free(struct vt_evloop *loop)
+{
+    vt_uring_free(&loop->uring);
+
+    if (loop->epoll_fd > -1) {
+        close(loop->epoll_fd);
+    }
+
+    if (loop->buffers != NULL) {
+        munmap(loop->buffers, (size_t)loop->capacity * EVLOOP_BUFFER_LEN);
+    }
+
+    free(loop->slots);
+    free(loop->free_slots);
+    free(loop->dirty_slots);
+    memset(loop, 0, sizeof(struct vt_evloop));
+    loop->uring.fd = -1;
+    loop->epoll_fd = -1;
+}
+
+/*
+Set up the rings and register the buffers. Fails, so epoll is used instead, if
+the kernel doesn't have io_uring or is too old to wait with a timeout
+*/
+static int
+vt_uring_init(struct vt_evloop *loop)
+{
+    struct vt_evloop_uring *uring = &loop->uring;
+    struct io_uring_params params;
+    uint32_t cq_entries = (uint32_t)loop->capacity * 2;
+
+    memset(&params, 0, sizeof(params));
+    //  A read and a poll in flight for every slot, without overflowing
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+    params.cq_entries = cq_entries < EVLOOP_QUEUE_DEPTH * 2 ? EVLOOP_QUEUE_DEPTH * 2
+        : cq_entries > CQ_ENTRIES_MAX ? CQ_ENTRIES_MAX : cq_entries;
+
+    uring->fd = syscall(__NR_io_uring_setup, EVLOOP_QUEUE_DEPTH, &params);
+
+    if (uring->fd == -1) {
+        return EXIT_FAILURE;
+    }
+
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+        goto abend;
+    }
+
+    uring->sq_map_length = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    uring->cq_map_length = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cq_map_length > uring->sq_map_length) {
+            uring->sq_map_length = uring->cq_map_length;
+        }
+        uring->cq_map_length = 0;
+    }
+
+    uring->sq_map = mmap(NULL, uring->sq_map_length, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+
+    if (uring->sq_map == MAP_FAILED) {
+        uring->sq_map = NULL;
+        goto abend;
+    }
+
+    if (uring->cq_map_length > 0) {
+        uring->cq_map = mmap(NULL, uring->cq_map_length, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+
+        if (uring->cq_map == MAP_FAILED) {
+            uring->cq_map = NULL;
+            goto abend;
+        }
+    }
+    else {
+        uring->cq_map = uring->sq_map;
+    }
+
+    uring->sqe_map_length = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqe_map_length, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+
+    if (uring->sqes == MAP_FAILED) {
+        uring->sqes = NULL;
+        goto abend;
+    }
+
+    uint8_t *sq = uring->sq_map;
+    uint8_t *cq = uring->cq_map;
+
+    uring->sq_head = (uint32_t *)(sq + params.sq_off.head);
+    uring->sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+    uring->sq_mask = (uint32_t *)(sq + params.sq_off.ring_mask);
+    uring->sq_array = (uint32_t *)(sq + params.sq_off.array);
+    uring->sq_entries = params.sq_entries;
+    uring->cq_head = (uint32_t *)(cq + params.cq_off.head);
+    uring->cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+    uring->cq_mask = (uint32_t *)(cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    //  One region covering every slot's buffer, read into with READ_FIXED. Without
+    //  it (e.g. over RLIMIT_MEMLOCK) plain reads do
+    struct iovec iov = {loop->buffers, (size_t)loop->capacity * EVLOOP_BUFFER_LEN};
+    uring->is_fixed = syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    return EXIT_SUCCESS;
+abend:
+    vt_uring_free(uring);
+    return EXIT_FAILURE;
+}
+
+/*
+The next submission queue entry, cleared and tagged. Submits what's queued if
+the queue is full
+*/
+static struct io_uring_sqe *
+vt_uring_sqe(struct vt_evloop *loop, int slot, enum vt_uring_op op)
+{
+    struct vt_evloop_uring *uring = &loop->uring;
+    uint32_t tail = *uring->sq_tail;
+
+    if (tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) == uring->sq_entries) {
+        if (vt_uring_enter(uring, uring->sq_pending, 0, -1) == -1) {
+            log_err();
+            return NULL;
+        }
+
+        if (tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) == uring->sq_entries) {
+            errno = EBUSY;
+            log_err();
+            return NULL;
+        }
+    }
+
+    uint32_t index = tail & *uring->sq_mask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->fd = loop->slots[slot].fd;
+    sqe->user_data = ((uint64_t)slot << USER_DATA_SHIFT) | op;
+    uring->sq_array[index] = index;
+    //  The entry is filled in before the kernel can see it: nothing is submitted
+    //  until vt_uring_enter
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++uring->sq_pending;
+    return sqe;
+}
+
+static int
+vt_uring_enter(struct vt_evloop_uring *uring, uint32_t to_submit, uint32_t min_complete,
+    int timeout_ms)
+{
+    struct __kernel_timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    struct io_uring_getevents_arg arg;
+    unsigned flags = IORING_ENTER_EXT_ARG;
+
+    memset(&arg, 0, sizeof(arg));
+
+    if (min_complete > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+
+        if (timeout_ms >= 0) {
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+    }
+
+    int rv = syscall(__NR_io_uring_enter, uring->fd, to_submit, min_complete, flags, &arg, sizeof(arg));
+
+    if (rv > 0) {
+        uring->sq_pending -= (uint32_t)rv > uring->sq_pending ? uring->sq_pending : (uint32_t)rv;
+    }
+
+    return rv;
+}
+
+static int
+vt_uring_wait(struct vt_evloop *loop, struct vt_evloop_event *events, int max, int timeout_ms)
+{
+    struct vt_evloop_uring *uring = &loop->uring;
+    uint32_t head = *uring->cq_head;
+
+    //  Don't wait if there's something to return already
+    bool is_ready = head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+    if (uring->sq_pending > 0 || !is_ready) {
+        if (vt_uring_enter(uring, uring->sq_pending, is_ready ? 0 : 1, timeout_ms) == -1
+            && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            log_err();
+            return -1;
+        }
+    }
+
+    uint32_t tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+    int count = 0;
+
+    while (head != tail && count < max) {
+        struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+        int slot = cqe->user_data >> USER_DATA_SHIFT;
+        enum vt_uring_op op = cqe->user_data & ((1 << USER_DATA_SHIFT) - 1);
+        struct vt_evloop_slot *s = &loop->slots[slot];
+
+        ++head;
+
+        if (op == URING_CANCEL) {
+            continue;
+        }
+
+        if (op == URING_READ) {
+            s->is_reading = false;
+        }
+        else {
+            s->poll_events = 0;
+        }
+
+        if (s->is_removed) {
+            if (!s->is_reading && s->poll_events == 0) {
+                vt_release_slot(loop, slot);
+            }
+            continue;
+        }
+
+        struct vt_evloop_event *event = &events[count++];
+        event->slot = slot;
+        event->user = s->user;
+        event->type = (enum vt_evloop_type)op;
+        event->result = cqe->res;
+        event->data = loop->buffers + (size_t)slot * EVLOOP_BUFFER_LEN;
+    }
+
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+static void
+vt_uring_free(struct vt_evloop_uring *uring)
+{
+    if (uring->sqes != NULL) {
+        munmap(uring->sqes, uring->sqe_map_length);
+    }
+
+    if (uring->cq_map != NULL && uring->cq_map != uring->sq_map) {
+        munmap(uring->cq_map, uring->cq_map_length);
+    }
+
+    if (uring->sq_map != NULL) {
+        munmap(uring->sq_map, uring->sq_map_length);
+    }
+
+    if (uring->fd > -1) {
+        close(uring->fd);
+    }
+
+    memset(uring, 0, sizeof(struct vt_evloop_uring));
+    uring->fd = -1;
+}
+
+/*
+The events wanted for the slot have changed. The epoll set is brought up to
+date in one pass before the next wait, when most slots will want what they had
+*/
+static void
+vt_epoll_mark(struct vt_evloop *loop, int slot)
+{
+    struct vt_evloop_slot *s = &loop->slots[slot];
+
+    if (!s->is_dirty) {
+        s->is_dirty = true;
+        loop->dirty_slots[loop->dirty_count++] = slot;
+    }
+}
+
+static int
+vt_epoll_wait(struct vt_evloop *loop, struct vt_evloop_event *events, int max, int timeout_ms)
+{
+    for (int i = 0; i < loop->dirty_count; ++i) {
+        int slot = loop->dirty_slots[i];
+        struct vt_evloop_slot *s = &loop->slots[slot];
+
+        s->is_dirty = false;
+
+        if (s->is_removed) {
+            vt_release_slot(loop, slot);
+            continue;
+        }
+
+        int wanted = (s->is_reading ? EPOLLIN : 0) | s->poll_events;
+
+        if (wanted == s->registered) {
+            continue;
+        }
+
+        struct epoll_event ev = {.events = wanted, .data.u32 = slot};
+        int op = s->registered == -1 ? EPOLL_CTL_ADD : wanted == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+
+        if (op == EPOLL_CTL_DEL || wanted != 0) {
+            if (epoll_ctl(loop->epoll_fd, op, s->fd, &ev) == -1) {
+                log_err();
+            }
+            s->registered = wanted == 0 ? -1 : wanted;
+        }
+    }
+
+    loop->dirty_count = 0;
+
+    //  An fd can give a read and a poll event
+    struct epoll_event ready[EVLOOP_QUEUE_DEPTH];
+    int ready_max = max / 2 < EVLOOP_QUEUE_DEPTH ? max / 2 : EVLOOP_QUEUE_DEPTH;
+    int nready = epoll_wait(loop->epoll_fd, ready, ready_max > 0 ? ready_max : 1, timeout_ms);
+
+    if (nready == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+
+        log_err();
+        return -1;
+    }
+
+    int count = 0;
+
+    for (int i = 0; i < nready; ++i) {
+        int slot = ready[i].data.u32;
+        struct vt_evloop_slot *s = &loop->slots[slot];
+        int revents = ready[i].events;
+
+        if (!s->is_used || s->is_removed) {
+            continue;
+        }
+
+        if (s->is_reading && (revents & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+            uint8_t *buffer = loop->buffers + (size_t)slot * EVLOOP_BUFFER_LEN;
+            ssize_t nread = read(s->fd, buffer, EVLOOP_BUFFER_LEN);
+
+            if (nread != -1 || (errno != EAGAIN && errno != EINTR)) {
+                struct vt_evloop_event *event = &events[count++];
+                event->slot = slot;
+                event->user = s->user;
+                event->type = EVLOOP_READ;
+                event->result = nread == -1 ? -errno : (int)nread;
+                event->data = buffer;
+                s->is_reading = false;
+                vt_epoll_mark(loop, slot);
+            }
+        }
+
+        if (s->poll_events != 0 && (revents & (s->poll_events | EPOLLHUP | EPOLLERR)) && count < max) {
+            struct vt_evloop_event *event = &events[count++];
+            event->slot = slot;
+            event->user = s->user;
+            event->type = EVLOOP_POLL;
+            event->result = revents & (s->poll_events | POLLHUP | POLLERR);
+            event->data = loop->buffers + (size_t)slot * EVLOOP_BUFFER_LEN;
+            s->poll_events = 0;
+            vt_epoll_mark(loop, slot);
+        }
+    }
+
+    return count;
+}
+
+static void
+vt_release_slot(struct vt_evloop *loop, int slot)
+{
+    struct vt_evloop_slot *s = &loop->slots[slot];
+
+    memset(s, 0, sizeof(struct vt_evloop_slot));
+    s->fd = -1;
+    s->registered = -1;
+    loop->free_slots[loop->free_count++] = slot;
+}
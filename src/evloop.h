@@ -0,0 +1,108 @@
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//  Each slot reads into a buffer of its own of this size
+#define EVLOOP_BUFFER_LEN   (2048)
+//  Submission queue entries. Completion queue is twice this
+#define EVLOOP_QUEUE_DEPTH  (1024)
+
+enum vt_evloop_backend
+{
+    EVLOOP_URING,
+    EVLOOP_EPOLL
+};
+
+enum vt_evloop_type
+{
+    //  result is the bytes read into data, 0 at end of stream or -errno
+    EVLOOP_READ,
+    //  result is the poll events that are ready or -errno
+    EVLOOP_POLL
+};
+
+struct vt_evloop_event
+{
+    int slot;
+    void *user;
+    enum vt_evloop_type type;
+    int result;
+    //  The slot's buffer. Valid until the slot's next read is started
+    uint8_t *data;
+};
+
+struct vt_evloop_slot
+{
+    int fd;
+    void *user;
+    bool is_used;
+    //  Being removed. Reused once nothing is in flight
+    bool is_removed;
+    //  A read has been started and hasn't completed
+    bool is_reading;
+    //  Events of the poll that has been started, 0 if none
+    int poll_events;
+    //  epoll: the events registered, -1 if the fd isn't in the set
+    int registered;
+    //  epoll: registered needs bringing up to date before the next wait
+    bool is_dirty;
+};
+
+struct vt_evloop_uring
+{
+    int fd;
+    //  Submission queue
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    uint32_t sq_entries;
+    struct io_uring_sqe *sqes;
+    //  Queued since the last submit
+    uint32_t sq_pending;
+    //  Completion queue
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    size_t sq_map_length;
+    void *cq_map;
+    size_t cq_map_length;
+    size_t sqe_map_length;
+    //  Buffers are registered with the kernel, so reads don't map them each time
+    bool is_fixed;
+};
+
+/*
+Reads from, and waits on, many sockets from one thread. io_uring is used where
+the kernel has it, so reads are queued up and submitted together, with the
+wait, in a single system call. Otherwise epoll is used
+*/
+struct vt_evloop
+{
+    enum vt_evloop_backend backend;
+    struct vt_evloop_slot *slots;
+    int capacity;
+    int *free_slots;
+    int free_count;
+    //  capacity * EVLOOP_BUFFER_LEN, a buffer for each slot
+    uint8_t *buffers;
+    struct vt_evloop_uring uring;
+    int epoll_fd;
+    int *dirty_slots;
+    int dirty_count;
+};
+
+int vt_evloop_init(struct vt_evloop *loop, int capacity, bool allow_uring);
+int vt_evloop_add(struct vt_evloop *loop, int fd, void *user);
+int vt_evloop_read(struct vt_evloop *loop, int slot);
+int vt_evloop_poll(struct vt_evloop *loop, int slot, int events);
+void vt_evloop_remove(struct vt_evloop *loop, int slot);
+int vt_evloop_wait(struct vt_evloop *loop, struct vt_evloop_event *events, int max, int timeout_ms);
+const char *vt_evloop_backend_name(struct vt_evloop *loop);
+void vt_evloop_free(struct vt_evloop *loop);
+
+#endif
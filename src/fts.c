@@ -0,0 +1,608 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "fts.h"
+#include "bedstead.h"
+#include "log.h"
+
+#define TERM_TABLE_INITIAL  (4096)
+#define TIMESTR_MAX         (20)
+
+//  A term and its postings while building
+struct vt_term_list
+{
+    char term[FTS_TERM_MAX];
+    uint32_t *postings;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+struct vt_term_table
+{
+    struct vt_term_list *lists;
+    uint32_t capacity;
+    uint32_t count;
+};
+
+struct vt_text_buffer
+{
+    char *text;
+    uint32_t length;
+    uint32_t capacity;
+};
+
+static int vt_index_doc(struct vt_decoder_state *decoder, struct vt_term_table *table, 
+    struct vt_text_buffer *text, uint32_t doc_id, const uint8_t *data, uint32_t length);
+static int vt_add_posting(struct vt_term_table *table, const char *term, uint32_t doc_id);
+static int vt_grow_table(struct vt_term_table *table);
+static int vt_append_text(struct vt_text_buffer *buffer, const char *text, uint32_t length);
+static int vt_next_word(const char **input, char *word, int len);
+static uint32_t vt_hash(const char *term);
+static int vt_write_index(const char *path, struct vt_fts_doc *docs, uint32_t doc_count,
+    struct vt_term_table *table, struct vt_text_buffer *text);
+static bool vt_is_valid_index(const struct vt_fts_header *header, uint64_t size);
+static bool vt_has_posting(const uint32_t *postings, uint32_t count, uint32_t doc_id);
+static int vt_compare_by_time(const void *a, const void *b);
+static int vt_compare_lists(const void *a, const void *b);
+static int vt_compare_terms(const void *a, const void *b);
+
+/*
+Decode every frame in the archive headlessly and index its alphanumeric text
+*/
+int
+vt_fts_build(const char *archive_path)
+{
+    int rv = EXIT_FAILURE;
+    struct vt_archive archive;
+    struct vt_term_table table = {0};
+    struct vt_text_buffer text = {0};
+    struct vt_archive_index_entry **entries = NULL;
+    struct vt_fts_doc *docs = NULL;
+    struct vt_decoder_state *decoder = NULL;
+    char path[FILENAME_MAX];
+
+    int fd = open(archive_path, O_RDONLY);
+    if (fd == -1) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    if (vt_archive_map(&archive, fd) != EXIT_SUCCESS) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    uint32_t count = archive.index_count;
+    entries = calloc(count + 1, sizeof(struct vt_archive_index_entry *));
+    docs = calloc(count + 1, sizeof(struct vt_fts_doc));
+    decoder = calloc(1, sizeof(struct vt_decoder_state));
+
+    if (entries == NULL || docs == NULL || decoder == NULL || vt_grow_table(&table) != EXIT_SUCCESS) {
+        log_err();
+        goto cleanup;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        entries[i] = &archive.index[i];
+    }
+
+    qsort(entries, count, sizeof(struct vt_archive_index_entry *), vt_compare_by_time);
+    decoder->map_char = &bed_map_char;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t *data = NULL;
+        struct vt_archive_record record;
+
+        if (vt_archive_get_record(&archive, entries[i], &record, &data) != EXIT_SUCCESS) {
+            fprintf(stderr, "Archive is truncated\n");
+            goto cleanup;
+        }
+
+        docs[i].offset = entries[i]->offset;
+        docs[i].time = entries[i]->time;
+        memcpy(docs[i].service, record.service, ARCHIVE_SERVICE_MAX);
+        docs[i].service[ARCHIVE_SERVICE_MAX - 1] = 0;
+        memcpy(docs[i].page, entries[i]->page, PAGE_NUMBER_MAX);
+        docs[i].text_offset = text.length;
+
+        if (vt_index_doc(decoder, &table, &text, i, data, entries[i]->length) != EXIT_SUCCESS) {
+            goto cleanup;
+        }
+
+        docs[i].text_length = text.length - docs[i].text_offset;
+    }
+
+    snprintf(path, FILENAME_MAX, "%s%s", archive_path, FTS_EXTENSION);
+    rv = vt_write_index(path, docs, count, &table, &text);
+
+    if (rv == EXIT_SUCCESS) {
+        printf("Indexed %u frames, %u terms\n", count, table.count);
+    }
+
+cleanup:
+    for (uint32_t i = 0; i < table.capacity; ++i) {
+        free(table.lists[i].postings);
+    }
+
+    free(table.lists);
+    free(text.text);
+    free(entries);
+    free(docs);
+
+    if (decoder != NULL) {
+        vt_decoder_free(decoder);
+        free(decoder);
+    }
+
+    vt_archive_close(&archive);
+    close(fd);
+    return rv;
+}
+
+/*
+Print the frames containing all of the words in query, as a phrase, newest first
+*/
+int
+vt_fts_search(const char *archive_path, const char *query)
+{
+    char path[FILENAME_MAX];
+    snprintf(path, FILENAME_MAX, "%s%s", archive_path, FTS_EXTENSION);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct vt_fts_header)) {
+        fprintf(stderr, "Invalid index %s\n", path);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    int rv = EXIT_FAILURE;
+    struct vt_fts_header *header = (struct vt_fts_header *)map;
+
+    if (!vt_is_valid_index(header, st.st_size)) {
+        fprintf(stderr, "Invalid index %s\n", path);
+        goto cleanup;
+    }
+
+    struct vt_fts_doc *docs = (struct vt_fts_doc *)(map + header->docs_offset);
+    struct vt_fts_term *terms = (struct vt_fts_term *)(map + header->terms_offset);
+    uint32_t *postings = (uint32_t *)(map + header->postings_offset);
+    const char *doc_text = (const char *)(map + header->text_offset);
+    uint64_t posting_count = (header->text_offset - header->postings_offset) / sizeof(uint32_t);
+    uint64_t text_length = st.st_size - header->text_offset;
+
+    //  The phrase as it appears in normalised text, i.e. " word word "
+    struct vt_fts_term *lists[FTS_TERM_MAX * 4];
+    char phrase[FILENAME_MAX] = " ";
+    int phrase_length = 1;
+    int list_count = 0;
+    char word[FILENAME_MAX];
+    const char *input = query;
+    int word_length;
+
+    while ((word_length = vt_next_word(&input, word, FILENAME_MAX)) > 0) {
+        if (phrase_length + word_length + 2 >= FILENAME_MAX 
+            || list_count == (int)(sizeof(lists) / sizeof(lists[0]))) {
+            break;
+        }
+
+        memcpy(phrase + phrase_length, word, word_length);
+        phrase_length += word_length;
+        phrase[phrase_length++] = ' ';
+
+        //  Terms are indexed cut to FTS_TERM_MAX - 1 characters
+        struct vt_fts_term key;
+        memset(&key, 0, sizeof(key));
+        memcpy(key.term, word, strnlen(word, FTS_TERM_MAX - 1));
+        struct vt_fts_term *term = bsearch(&key, terms, header->term_count, 
+            sizeof(struct vt_fts_term), vt_compare_terms);
+
+        if (term == NULL) {
+            //  Every word must match
+            rv = EXIT_SUCCESS;
+            goto cleanup;
+        }
+
+        if (term->postings > posting_count || term->count > posting_count - term->postings) {
+            fprintf(stderr, "Invalid index %s\n", path);
+            goto cleanup;
+        }
+
+        lists[list_count++] = term;
+    }
+
+    if (list_count == 0) {
+        fprintf(stderr, "Nothing to search for\n");
+        goto cleanup;
+    }
+
+    //  Walk the shortest list, checking the others
+    qsort(lists, list_count, sizeof(struct vt_fts_term *), vt_compare_lists);
+
+    int found = 0;
+    const uint32_t *candidates = postings + lists[0]->postings;
+
+    for (uint32_t i = 0; i < lists[0]->count && found < FTS_RESULTS_MAX; ++i) {
+        uint32_t doc_id = candidates[i];
+        bool is_match = true;
+
+        if (doc_id >= header->doc_count) {
+            fprintf(stderr, "Invalid index %s\n", path);
+            goto cleanup;
+        }
+
+        for (int l = 1; l < list_count && is_match; ++l) {
+            is_match = vt_has_posting(postings + lists[l]->postings, lists[l]->count, doc_id);
+        }
+
+        struct vt_fts_doc *doc = &docs[doc_id];
+
+        if (doc->text_offset > text_length || doc->text_length > text_length - doc->text_offset) {
+            fprintf(stderr, "Invalid index %s\n", path);
+            goto cleanup;
+        }
+
+        if (!is_match || memmem(doc_text + doc->text_offset, doc->text_length, phrase, phrase_length) == NULL) {
+            continue;
+        }
+
+        char timestr[TIMESTR_MAX];
+        time_t when = doc->time;
+        strftime(timestr, TIMESTR_MAX, "%Y-%m-%d %H:%M:%S", localtime(&when));
+        printf("%s  %-20.*s %.*s\n", timestr, ARCHIVE_SERVICE_MAX, doc->service, PAGE_NUMBER_MAX, doc->page);
+        ++found;
+    }
+
+    rv = EXIT_SUCCESS;
+cleanup:
+    munmap(map, st.st_size);
+    return rv;
+}
+
+static int
+vt_index_doc(struct vt_decoder_state *decoder, struct vt_term_table *table, 
+    struct vt_text_buffer *text, uint32_t doc_id, const uint8_t *data, uint32_t length)
+{
+    char frame_text[FRAME_TEXT_MAX];
+    char word[FRAME_TEXT_MAX];
+    int word_length;
+
+    vt_decoder_init(decoder);
+    vt_decoder_decode(decoder, (uint8_t *)data, length);
+    vt_decoder_get_text(decoder, frame_text, FRAME_TEXT_MAX);
+
+    //  Normalised text starts and ends with a space so phrases only match whole words
+    if (vt_append_text(text, " ", 1) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    const char *input = frame_text;
+
+    while ((word_length = vt_next_word(&input, word, FRAME_TEXT_MAX)) > 0) {
+        if (vt_append_text(text, word, word_length) != EXIT_SUCCESS
+            || vt_append_text(text, " ", 1) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+
+        word[FTS_TERM_MAX - 1] = 0;
+
+        if (vt_add_posting(table, word, doc_id) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int
+vt_add_posting(struct vt_term_table *table, const char *term, uint32_t doc_id)
+{
+    if ((table->count + 1) * 10 > table->capacity * 7 && vt_grow_table(table) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    uint32_t mask = table->capacity - 1;
+    uint32_t idx = vt_hash(term) & mask;
+
+    while (table->lists[idx].term[0] != 0 && strncmp(table->lists[idx].term, term, FTS_TERM_MAX) != 0) {
+        idx = (idx + 1) & mask;
+    }
+
+    struct vt_term_list *list = &table->lists[idx];
+
+    if (list->term[0] == 0) {
+        memcpy(list->term, term, strnlen(term, FTS_TERM_MAX - 1));
+        ++table->count;
+    }
+
+    //  Docs are indexed in order so a repeat can only be the last posting
+    if (list->count > 0 && list->postings[list->count - 1] == doc_id) {
+        return EXIT_SUCCESS;
+    }
+
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity == 0 ? 4 : list->capacity * 2;
+        uint32_t *postings = realloc(list->postings, capacity * sizeof(uint32_t));
+
+        if (postings == NULL) {
+            log_err();
+            return EXIT_FAILURE;
+        }
+
+        list->postings = postings;
+        list->capacity = capacity;
+    }
+
+    list->postings[list->count++] = doc_id;
+    return EXIT_SUCCESS;
+}
+
+static int
+vt_grow_table(struct vt_term_table *table)
+{
+    uint32_t capacity = table->capacity == 0 ? TERM_TABLE_INITIAL : table->capacity * 2;
+    struct vt_term_list *lists = calloc(capacity, sizeof(struct vt_term_list));
+
+    if (lists == NULL) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    for (uint32_t i = 0; i < table->capacity; ++i) {
+        if (table->lists[i].term[0] == 0) {
+            continue;
+        }
+
+        uint32_t idx = vt_hash(table->lists[i].term) & (capacity - 1);
+
+        while (lists[idx].term[0] != 0) {
+            idx = (idx + 1) & (capacity - 1);
+        }
+
+        lists[idx] = table->lists[i];
+    }
+
+    free(table->lists);
+    table->lists = lists;
+    table->capacity = capacity;
+    return EXIT_SUCCESS;
+}
+
+static int
+vt_append_text(struct vt_text_buffer *buffer, const char *text, uint32_t length)
+{
+    if (buffer->length + length > buffer->capacity) {
+        uint32_t capacity = buffer->capacity == 0 ? 65536 : buffer->capacity * 2;
+
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+
+        char *grown = realloc(buffer->text, capacity);
+        if (grown == NULL) {
+            log_err();
+            return EXIT_FAILURE;
+        }
+
+        buffer->text = grown;
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->text + buffer->length, text, length);
+    buffer->length += length;
+    return EXIT_SUCCESS;
+}
+
+/*
+Words are runs of letters and digits, lower cased. Returns the word length or 0
+at the end of the input
+*/
+static int
+vt_next_word(const char **input, char *word, int len)
+{
+    const char *p = *input;
+    int out = 0;
+
+    while (*p != 0 && !isalnum((unsigned char)*p)) {
+        ++p;
+    }
+
+    while (*p != 0 && isalnum((unsigned char)*p)) {
+        if (out + 1 < len) {
+            word[out++] = tolower((unsigned char)*p);
+        }
+        ++p;
+    }
+
+    word[out] = 0;
+    *input = p;
+    return out;
+}
+
+//  FNV-1a
+static uint32_t
+vt_hash(const char *term)
+{
+    uint32_t hash = 2166136261u;
+
+    for (const char *p = term; *p != 0; ++p) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+
+    return hash;
+}
+
+static int
+vt_write_index(const char *path, struct vt_fts_doc *docs, uint32_t doc_count,
+    struct vt_term_table *table, struct vt_text_buffer *text)
+{
+    //  Compact the used slots and sort them for binary search
+    struct vt_term_list *lists = table->lists;
+    uint32_t term_count = 0;
+
+    for (uint32_t i = 0; i < table->capacity; ++i) {
+        if (lists[i].term[0] != 0) {
+            struct vt_term_list tmp = lists[term_count];
+            lists[term_count++] = lists[i];
+            lists[i] = tmp;
+        }
+    }
+
+    qsort(lists, term_count, sizeof(struct vt_term_list), vt_compare_terms);
+
+    struct vt_fts_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = FTS_MAGIC;
+    header.version = FTS_VERSION;
+    header.doc_count = doc_count;
+    header.term_count = term_count;
+    header.docs_offset = sizeof(header);
+    header.terms_offset = header.docs_offset + (uint64_t)doc_count * sizeof(struct vt_fts_doc);
+    header.postings_offset = header.terms_offset + (uint64_t)term_count * sizeof(struct vt_fts_term);
+    header.text_offset = header.postings_offset;
+
+    for (uint32_t i = 0; i < term_count; ++i) {
+        header.text_offset += (uint64_t)lists[i].count * sizeof(uint32_t);
+    }
+
+    //  Write to a temporary file so searches never see half an index
+    char tmp_path[FILENAME_MAX];
+    FILE *fout = NULL;
+
+    if (snprintf(tmp_path, FILENAME_MAX, "%s.tmp", path) >= FILENAME_MAX) {
+        errno = ENAMETOOLONG;
+    }
+    else {
+        fout = fopen(tmp_path, "wb");
+    }
+
+    if (fout == NULL) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    fwrite(&header, sizeof(header), 1, fout);
+    fwrite(docs, sizeof(struct vt_fts_doc), doc_count, fout);
+
+    uint32_t postings = 0;
+
+    for (uint32_t i = 0; i < term_count; ++i) {
+        struct vt_fts_term term;
+        memset(&term, 0, sizeof(term));
+        memcpy(term.term, lists[i].term, FTS_TERM_MAX);
+        term.postings = postings;
+        term.count = lists[i].count;
+        postings += lists[i].count;
+        fwrite(&term, sizeof(term), 1, fout);
+    }
+
+    for (uint32_t i = 0; i < term_count; ++i) {
+        fwrite(lists[i].postings, sizeof(uint32_t), lists[i].count, fout);
+    }
+
+    fwrite(text->text, 1, text->length, fout);
+
+    if (ferror(fout) || fclose(fout) != 0) {
+        log_err();
+        unlink(tmp_path);
+        return EXIT_FAILURE;
+    }
+
+    if (rename(tmp_path, path) == -1) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+The header's tables must lie within the file, and at offsets they can be read
+from in place
+*/
+static bool
+vt_is_valid_index(const struct vt_fts_header *header, uint64_t size)
+{
+    return header->magic == FTS_MAGIC && header->version == FTS_VERSION
+        && header->docs_offset % _Alignof(struct vt_fts_doc) == 0
+        && header->docs_offset <= size 
+        && header->doc_count <= (size - header->docs_offset) / sizeof(struct vt_fts_doc)
+        && header->terms_offset % _Alignof(struct vt_fts_term) == 0
+        && header->terms_offset <= size 
+        && header->term_count <= (size - header->terms_offset) / sizeof(struct vt_fts_term)
+        && header->postings_offset % _Alignof(uint32_t) == 0
+        && header->postings_offset <= header->text_offset
+        && header->text_offset <= size;
+}
+
+static bool
+vt_has_posting(const uint32_t *postings, uint32_t count, uint32_t doc_id)
+{
+    uint32_t lo = 0;
+    uint32_t hi = count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (postings[mid] < doc_id) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return lo < count && postings[lo] == doc_id;
+}
+
+//  Newest first
+static int
+vt_compare_by_time(const void *a, const void *b)
+{
+    const struct vt_archive_index_entry *ea = *(struct vt_archive_index_entry * const *)a;
+    const struct vt_archive_index_entry *eb = *(struct vt_archive_index_entry * const *)b;
+
+    if (ea->time != eb->time) {
+        return ea->time < eb->time ? 1 : -1;
+    }
+
+    return (ea->offset < eb->offset) - (ea->offset > eb->offset);
+}
+
+//  Shortest postings list first
+static int
+vt_compare_lists(const void *a, const void *b)
+{
+    const struct vt_fts_term *ta = *(struct vt_fts_term * const *)a;
+    const struct vt_fts_term *tb = *(struct vt_fts_term * const *)b;
+
+    return (ta->count > tb->count) - (ta->count < tb->count);
+}
+
+//  Both vt_term_list and vt_fts_term start with the term
+static int
+vt_compare_terms(const void *a, const void *b)
+{
+    return strncmp((const char *)a, (const char *)b, FTS_TERM_MAX);
+}
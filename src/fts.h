@@ -0,0 +1,56 @@
+#ifndef FTS_H
+#define FTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "archive.h"
+
+/*
+Full text index over the frames in an archive, written to <archive>.fts:
+    header | docs | terms | postings | text
+Docs are ordered newest first so that postings, being in doc order, are already
+ranked by recency. Terms are fixed width and sorted for binary search. Text holds
+each frame's normalised words so that phrases can be checked without decoding
+*/
+#define FTS_MAGIC           (0x46585456)    //  "VTXF"
+#define FTS_VERSION         (1)
+#define FTS_EXTENSION       ".fts"
+#define FTS_TERM_MAX        (24)
+#define FTS_RESULTS_MAX     (50)
+
+struct vt_fts_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t doc_count;
+    uint32_t term_count;
+    uint64_t docs_offset;
+    uint64_t terms_offset;
+    uint64_t postings_offset;
+    uint64_t text_offset;
+};
+
+struct vt_fts_doc
+{
+    //  Offset of the record in the archive
+    uint64_t offset;
+    int64_t time;
+    char service[ARCHIVE_SERVICE_MAX];
+    char page[PAGE_NUMBER_MAX];
+    //  Normalised text, relative to text_offset
+    uint32_t text_offset;
+    uint32_t text_length;
+};
+
+struct vt_fts_term
+{
+    char term[FTS_TERM_MAX];
+    //  Index of the first posting, relative to postings_offset
+    uint32_t postings;
+    uint32_t count;
+};
+
+int vt_fts_build(const char *archive_path);
+int vt_fts_search(const char *archive_path, const char *query);
+
+#endif
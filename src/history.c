@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "delta.h"
+#include "history.h"
+#include "log.h"
+
+static size_t vt_entry_size(struct vt_history_entry *entry);
+static const uint8_t *vt_expand(struct vt_history *history, struct vt_history_entry *entry);
+static void vt_expand_into(struct vt_history_entry *entry, uint8_t *frame);
+static void vt_evict(struct vt_history *history, struct vt_history_entry *entry);
+static void vt_unlink_recent(struct vt_history *history, struct vt_history_entry *entry);
+static void vt_link_recent(struct vt_history *history, struct vt_history_entry *entry);
+
+void
+vt_history_init(struct vt_history *history, size_t budget)
+{
+    memset(history, 0, sizeof(struct vt_history));
+    history->budget = budget;
+}
+
+/*
+Keep a copy of a frame. Frames too big for the budget are not kept
+*/
+int
+vt_history_add(struct vt_history *history, const uint8_t *frame, int length, 
+    const char *page, time_t time)
+{
+    struct vt_history_entry *entry = NULL;
+    struct vt_history_entry *base = NULL;
+
+    if (length <= 0 || sizeof(struct vt_history_entry) + length > history->budget) {
+        return EXIT_SUCCESS;
+    }
+
+    for (struct vt_history_entry *e = history->newest; e != NULL && page[0] != 0; e = e->older) {
+        if (strcmp(e->page, page) == 0) {
+            base = e->depth < HISTORY_DEPTH_MAX ? e : NULL;
+            break;
+        }
+    }
+
+    if ((entry = calloc(1, sizeof(struct vt_history_entry))) == NULL
+        || (entry->data = malloc(length)) == NULL) {
+        log_err();
+        goto abend;
+    }
+
+    int delta_length = -1;
+
+    if (base != NULL) {
+        const uint8_t *base_frame = vt_expand(history, base);
+
+        if (base_frame != NULL) {
+            //  Only worth keeping if it's smaller than the frame
+            delta_length = vt_delta_encode(base_frame, base->length, frame, length, entry->data, length - 1);
+        }
+    }
+
+    if (delta_length >= 0) {
+        entry->base = base;
+        entry->depth = base->depth + 1;
+        entry->stored_length = delta_length;
+
+        uint8_t *data = realloc(entry->data, delta_length > 0 ? delta_length : 1);
+        if (data != NULL) {
+            entry->data = data;
+        }
+    }
+    else {
+        memcpy(entry->data, frame, length);
+        entry->stored_length = length;
+    }
+
+    snprintf(entry->page, PAGE_NUMBER_MAX, "%s", page);
+    entry->time = time;
+    entry->length = length;
+
+    entry->older = history->newest;
+    if (history->newest != NULL) {
+        history->newest->newer = entry;
+    }
+    history->newest = entry;
+    if (history->oldest == NULL) {
+        history->oldest = entry;
+    }
+
+    vt_link_recent(history, entry);
+    history->used += vt_entry_size(entry);
+    ++history->count;
+
+    while (history->used > history->budget && history->least_recent != NULL) {
+        vt_evict(history, history->least_recent);
+    }
+
+    return EXIT_SUCCESS;
+abend:
+    if (entry != NULL) {
+        free(entry->data);
+    }
+    free(entry);
+    return EXIT_FAILURE;
+}
+
+/*
+The frame for entry, valid until the history is next changed. Counts as a use
+of the entry. Returns NULL if memory runs out
+*/
+const uint8_t *
+vt_history_get(struct vt_history *history, struct vt_history_entry *entry)
+{
+    vt_unlink_recent(history, entry);
+    vt_link_recent(history, entry);
+
+    return vt_expand(history, entry);
+}
+
+/*
+The most recent frame of page, or NULL if there's none
+*/
+struct vt_history_entry *
+vt_history_find(struct vt_history *history, const char *page)
+{
+    for (struct vt_history_entry *entry = history->newest; entry != NULL; entry = entry->older) {
+        if (strcmp(entry->page, page) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+void
+vt_history_free(struct vt_history *history)
+{
+    struct vt_history_entry *entry = history->newest;
+
+    while (entry != NULL) {
+        struct vt_history_entry *older = entry->older;
+        free(entry->data);
+        free(entry);
+        entry = older;
+    }
+
+    free(history->frame);
+    vt_history_init(history, history->budget);
+}
+
+static size_t
+vt_entry_size(struct vt_history_entry *entry)
+{
+    return sizeof(struct vt_history_entry) + entry->stored_length;
+}
+
+static const uint8_t *
+vt_expand(struct vt_history *history, struct vt_history_entry *entry)
+{
+    int size = 0;
+
+    for (struct vt_history_entry *e = entry; e != NULL; e = e->base) {
+        if (e->length > size) {
+            size = e->length;
+        }
+    }
+
+    if (size > history->frame_size) {
+        uint8_t *frame = realloc(history->frame, size);
+
+        if (frame == NULL) {
+            log_err();
+            return NULL;
+        }
+
+        history->frame = frame;
+        history->frame_size = size;
+    }
+
+    vt_expand_into(entry, history->frame);
+    return history->frame;
+}
+
+static void
+vt_expand_into(struct vt_history_entry *entry, uint8_t *frame)
+{
+    if (entry->base == NULL) {
+        memcpy(frame, entry->data, entry->length);
+        return;
+    }
+
+    vt_expand_into(entry->base, frame);
+    vt_delta_apply(frame, entry->base->length, entry->length, entry->data, entry->stored_length);
+}
+
+/*
+Frames stored as deltas against the evicted one are first stored in full
+*/
+static void
+vt_evict(struct vt_history *history, struct vt_history_entry *entry)
+{
+    for (struct vt_history_entry *e = entry->newer; e != NULL; e = e->newer) {
+        if (e->base != entry) {
+            continue;
+        }
+
+        const uint8_t *frame = vt_expand(history, e);
+        uint8_t *data = frame != NULL ? malloc(e->length) : NULL;
+
+        if (data == NULL) {
+            //  Can't rebuild it, so leave it empty
+            log_err();
+            history->used -= vt_entry_size(e);
+            free(e->data);
+            e->data = NULL;
+            e->base = NULL;
+            e->depth = 0;
+            e->stored_length = 0;
+            e->length = 0;
+            history->used += vt_entry_size(e);
+            continue;
+        }
+
+        memcpy(data, frame, e->length);
+        history->used -= vt_entry_size(e);
+        free(e->data);
+        e->data = data;
+        e->base = NULL;
+        e->depth = 0;
+        e->stored_length = e->length;
+        history->used += vt_entry_size(e);
+    }
+
+    vt_unlink_recent(history, entry);
+
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    }
+    else {
+        history->newest = entry->older;
+    }
+
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    }
+    else {
+        history->oldest = entry->newer;
+    }
+
+    history->used -= vt_entry_size(entry);
+    --history->count;
+    free(entry->data);
+    free(entry);
+}
+
+static void
+vt_unlink_recent(struct vt_history *history, struct vt_history_entry *entry)
+{
+    if (entry->more_recent != NULL) {
+        entry->more_recent->less_recent = entry->less_recent;
+    }
+    else {
+        history->most_recent = entry->less_recent;
+    }
+
+    if (entry->less_recent != NULL) {
+        entry->less_recent->more_recent = entry->more_recent;
+    }
+    else {
+        history->least_recent = entry->more_recent;
+    }
+
+    entry->more_recent = NULL;
+    entry->less_recent = NULL;
+}
+
+static void
+vt_link_recent(struct vt_history *history, struct vt_history_entry *entry)
+{
+    entry->less_recent = history->most_recent;
+
+    if (history->most_recent != NULL) {
+        history->most_recent->more_recent = entry;
+    }
+
+    history->most_recent = entry;
+
+    if (history->least_recent == NULL) {
+        history->least_recent = entry;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "decoder.h"
+
+#define HISTORY_BUDGET_KB   (256)
+//  Longest chain of deltas to undo when a frame is recalled
+#define HISTORY_DEPTH_MAX   (8)
+
+/*
+A frame seen earlier in the session. Stored either as it was received or, if
+smaller, as a delta (see delta.h) against the previous version of the same page
+*/
+struct vt_history_entry
+{
+    //  Least recently used order, for eviction
+    struct vt_history_entry *more_recent;
+    struct vt_history_entry *less_recent;
+    //  Capture order, for stepping through
+    struct vt_history_entry *newer;
+    struct vt_history_entry *older;
+    //  NULL if data holds the frame itself
+    struct vt_history_entry *base;
+    int depth;
+    char page[PAGE_NUMBER_MAX];
+    time_t time;
+    int length;
+    int stored_length;
+    uint8_t *data;
+};
+
+/*
+Frames are kept within budget bytes, including the entries themselves, by
+dropping the least recently captured or recalled
+*/
+struct vt_history
+{
+    size_t budget;
+    size_t used;
+    int count;
+    struct vt_history_entry *most_recent;
+    struct vt_history_entry *least_recent;
+    struct vt_history_entry *newest;
+    struct vt_history_entry *oldest;
+    //  Frames are rebuilt here by vt_history_get
+    uint8_t *frame;
+    int frame_size;
+};
+
+void vt_history_init(struct vt_history *history, size_t budget);
+int vt_history_add(struct vt_history *history, const uint8_t *frame, int length, 
+    const char *page, time_t time);
+const uint8_t *vt_history_get(struct vt_history *history, struct vt_history_entry *entry);
+struct vt_history_entry *vt_history_find(struct vt_history *history, const char *page);
+void vt_history_free(struct vt_history *history);
+
+#endif
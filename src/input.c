@@ -0,0 +1,136 @@
+#include <string.h>
+#include "input.h"
+
+static const uint8_t paste_start[PASTE_MARKER_MAX] = {27, '[', '2', '0', '0', '~'};
+static const uint8_t paste_end[PASTE_MARKER_MAX] = {27, '[', '2', '0', '1', '~'};
+
+static void vt_enqueue(struct vt_input_state *state, uint8_t b);
+static void vt_flush_marker(struct vt_input_state *state);
+
+void
+vt_input_init(struct vt_input_state *state, int rate)
+{
+    memset(state, 0, sizeof(struct vt_input_state));
+    state->rate = rate;
+}
+
+bool
+vt_input_is_full(struct vt_input_state *state)
+{
+    return state->queue_length + PASTE_MARKER_MAX >= INPUT_QUEUE_MAX;
+}
+
+/*
+Queue a key for the host. Bracketed paste markers are recognised and removed
+*/
+void
+vt_input_push(struct vt_input_state *state, uint8_t b)
+{
+    const uint8_t *marker = state->in_paste ? paste_end : paste_start;
+
+    if (b != marker[state->marker_length]) {
+        vt_flush_marker(state);
+
+        if (b != marker[0]) {
+            vt_enqueue(state, b);
+            return;
+        }
+    }
+
+    state->marker[state->marker_length++] = b;
+
+    if (state->marker_length == PASTE_MARKER_MAX) {
+        state->in_paste = !state->in_paste;
+        state->marker_length = 0;
+    }
+}
+
+/*
+TRUE within a paste or a possible paste marker. Keys must go to the host 
+rather than being treated as local commands
+*/
+bool
+vt_input_is_pasting(struct vt_input_state *state)
+{
+    return state->in_paste || state->marker_length > 0;
+}
+
+/*
+Called when no more keys are immediately available. A lone escape can't be held
+back forever waiting for the rest of a marker
+*/
+void
+vt_input_end_burst(struct vt_input_state *state)
+{
+    vt_flush_marker(state);
+}
+
+/*
+Returns the number of bytes at queue + queue_offset that may be sent now
+*/
+int
+vt_input_ready(struct vt_input_state *state, long now_ms)
+{
+    if (state->queue_length == 0 || state->rate == 0) {
+        return state->queue_length;
+    }
+
+    //  Allow a burst of at most one tick's worth so the host sees a steady rate
+    double burst = state->rate * INPUT_TICK_MS / 1000.0;
+    if (burst < 1) {
+        burst = 1;
+    }
+
+    state->tokens += (now_ms - state->refill_ms) * state->rate / 1000.0;
+    state->refill_ms = now_ms;
+
+    if (state->tokens > burst) {
+        state->tokens = burst;
+    }
+
+    int count = (int)state->tokens;
+    return count < state->queue_length ? count : state->queue_length;
+}
+
+void
+vt_input_consume(struct vt_input_state *state, int count)
+{
+    state->queue_offset += count;
+    state->queue_length -= count;
+    state->tokens -= count;
+
+    if (state->tokens < 0) {
+        state->tokens = 0;
+    }
+
+    //  Move what's left down so that the whole queue is free to refill
+    memmove(state->queue, state->queue + state->queue_offset, state->queue_length);
+    state->queue_offset = 0;
+}
+
+bool
+vt_input_is_pending(struct vt_input_state *state)
+{
+    return state->queue_length > 0;
+}
+
+static void
+vt_enqueue(struct vt_input_state *state, uint8_t b)
+{
+    int idx = state->queue_offset + state->queue_length;
+
+    if (idx < INPUT_QUEUE_MAX) {
+        state->queue[idx] = b;
+        ++state->queue_length;
+    }
+}
+
+static void
+vt_flush_marker(struct vt_input_state *state)
+{
+    for (int i = 0; i < state->marker_length; ++i) {
+        vt_enqueue(state, state->marker[i]);
+    }
+
+    state->marker_length = 0;
+}
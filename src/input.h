@@ -0,0 +1,38 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define INPUT_QUEUE_MAX     (4096)
+#define INPUT_TICK_MS       (50)
+#define PASTE_MARKER_MAX    (6)
+
+struct vt_input_state
+{
+    //  Bytes waiting to be sent to the host
+    uint8_t queue[INPUT_QUEUE_MAX];
+    int queue_offset;
+    int queue_length;
+    //  Bytes per second. 0 to send as fast as the socket will take them
+    int rate;
+    //  Send allowance when pacing (token bucket) and when it was last topped up
+    double tokens;
+    long refill_ms;
+    //  TRUE between bracketed paste start and end markers
+    bool in_paste;
+    //  Bytes that might be the start of a paste marker, held back until we know
+    uint8_t marker[PASTE_MARKER_MAX];
+    int marker_length;
+};
+
+void vt_input_init(struct vt_input_state *state, int rate);
+bool vt_input_is_full(struct vt_input_state *state);
+void vt_input_push(struct vt_input_state *state, uint8_t b);
+bool vt_input_is_pasting(struct vt_input_state *state);
+void vt_input_end_burst(struct vt_input_state *state);
+int vt_input_ready(struct vt_input_state *state, long now_ms);
+void vt_input_consume(struct vt_input_state *state, int count);
+bool vt_input_is_pending(struct vt_input_state *state);
+
+#endif
@@ -0,0 +1,419 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "keyframe.h"
+#include "net.h"
+#include "log.h"
+
+#define FF                  (12)
+//  Snapshots are padded so that records stay aligned
+#define RECORD_ALIGN        (8)
+
+static int vt_write_records(struct vt_keyframe_writer *writer, struct vt_decoder_state *decoder, 
+    int64_t time_ms, bool is_keyframe);
+static void vt_scan_records(struct vt_keyframe_index *index, bool is_counting);
+
+/*
+Start an index alongside a dump that's about to be written
+*/
+int
+vt_keyframe_open(struct vt_keyframe_writer *writer, const char *dump_path)
+{
+    char path[FILENAME_MAX];
+    snprintf(path, FILENAME_MAX, "%s%s", dump_path, KEYFRAME_EXTENSION);
+
+    memset(writer, 0, sizeof(struct vt_keyframe_writer));
+    writer->file = fopen(path, "wb");
+
+    if (writer->file == NULL) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    struct vt_keyframe_header header = {KEYFRAME_MAGIC, KEYFRAME_VERSION, time(NULL)};
+
+    if (fwrite(&header, sizeof(header), 1, writer->file) != 1) {
+        log_err();
+        vt_keyframe_close(writer);
+        return EXIT_FAILURE;
+    }
+
+    writer->start_ms = writer->keyframe_ms = vt_net_now_ms();
+    return EXIT_SUCCESS;
+}
+
+/*
+Call after count more bytes have been dumped and decoded
+*/
+void
+vt_keyframe_mark(struct vt_keyframe_writer *writer, struct vt_decoder_state *decoder, int count)
+{
+    if (writer->file == NULL) {
+        return;
+    }
+
+    long now = vt_net_now_ms();
+    writer->offset += count;
+
+    bool is_keyframe = writer->offset - writer->keyframe_offset >= KEYFRAME_BYTES
+        || now - writer->keyframe_ms >= KEYFRAME_MS;
+
+    if (is_keyframe) {
+        writer->keyframe_ms = now;
+    }
+
+    //  The session matters more than the index. Give up on it
+    if (vt_write_records(writer, decoder, now - writer->start_ms, is_keyframe) != EXIT_SUCCESS) {
+        fclose(writer->file);
+        writer->file = NULL;
+    }
+}
+
+void
+vt_keyframe_close(struct vt_keyframe_writer *writer)
+{
+    if (writer->file != NULL && fclose(writer->file) == EOF) {
+        log_err();
+    }
+
+    free(writer->buffer);
+    memset(writer, 0, sizeof(struct vt_keyframe_writer));
+}
+
+/*
+Index a dump that was captured without one, using decoder, which must be headless.
+There are no times, so marks are placed at the end of each frame
+*/
+int
+vt_keyframe_build(const char *dump_path, const uint8_t *dump, size_t length, 
+    struct vt_decoder_state *decoder)
+{
+    struct vt_keyframe_writer writer;
+    char path[FILENAME_MAX];
+    char tmp_path[FILENAME_MAX];
+    int rv = EXIT_FAILURE;
+
+    snprintf(path, FILENAME_MAX, "%s%s", dump_path, KEYFRAME_EXTENSION);
+
+    //  Renamed to path once complete, so must not be truncated to it
+    if (snprintf(tmp_path, FILENAME_MAX, "%s.tmp", path) >= FILENAME_MAX) {
+        errno = ENAMETOOLONG;
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    memset(&writer, 0, sizeof(writer));
+
+    if ((writer.file = fopen(tmp_path, "wb")) == NULL) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    vt_decoder_init(decoder);
+
+    struct vt_keyframe_header header = {KEYFRAME_MAGIC, KEYFRAME_VERSION, 0};
+
+    if (fwrite(&header, sizeof(header), 1, writer.file) != 1) {
+        log_err();
+        goto cleanup;
+    }
+
+    while (writer.offset < length) {
+        //  Up to, but not including, the next FF after this one
+        const uint8_t *ff = length - writer.offset > 1 
+            ? memchr(dump + writer.offset + 1, FF, length - writer.offset - 1) 
+            : NULL;
+        uint64_t end = ff == NULL ? length : (uint64_t)(ff - dump);
+
+        vt_decoder_decode(decoder, (uint8_t *)dump + writer.offset, end - writer.offset);
+        writer.offset = end;
+
+        if (vt_write_records(&writer, decoder, KEYFRAME_NO_TIME, 
+            writer.offset - writer.keyframe_offset >= KEYFRAME_BYTES) != EXIT_SUCCESS) {
+            goto cleanup;
+        }
+    }
+
+    if (fclose(writer.file) == EOF) {
+        writer.file = NULL;
+        log_err();
+        goto cleanup;
+    }
+
+    writer.file = NULL;
+
+    if (rename(tmp_path, path) == -1) {
+        log_err();
+        goto cleanup;
+    }
+
+    rv = EXIT_SUCCESS;
+cleanup:
+    if (writer.file != NULL) {
+        fclose(writer.file);
+        unlink(tmp_path);
+    }
+
+    vt_keyframe_close(&writer);
+    return rv;
+}
+
+/*
+Map the index for a dump. errno is ENOENT if there isn't one
+*/
+int
+vt_keyframe_load(struct vt_keyframe_index *index, const char *dump_path)
+{
+    char path[FILENAME_MAX];
+    snprintf(path, FILENAME_MAX, "%s%s", dump_path, KEYFRAME_EXTENSION);
+    memset(index, 0, sizeof(struct vt_keyframe_index));
+    errno = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        log_err();
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct vt_keyframe_header)) {
+        fprintf(stderr, "Invalid keyframe index %s\n", path);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    index->map_length = st.st_size;
+    index->map = mmap(NULL, index->map_length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (index->map == MAP_FAILED) {
+        log_err();
+        index->map = NULL;
+        return EXIT_FAILURE;
+    }
+
+    struct vt_keyframe_header *header = (struct vt_keyframe_header *)index->map;
+
+    if (header->magic != KEYFRAME_MAGIC || header->version != KEYFRAME_VERSION) {
+        fprintf(stderr, "Invalid keyframe index %s\n", path);
+        goto abend;
+    }
+
+    index->start_time = header->start_time;
+    vt_scan_records(index, true);
+
+    if (index->mark_count == 0) {
+        fprintf(stderr, "Nothing to replay\n");
+        goto abend;
+    }
+
+    index->marks = malloc(index->mark_count * sizeof(struct vt_keyframe_mark));
+    index->keyframes = malloc((index->keyframe_count + 1) * sizeof(struct vt_keyframe_record *));
+
+    if (index->marks == NULL || index->keyframes == NULL) {
+        log_err();
+        goto abend;
+    }
+
+    vt_scan_records(index, false);
+    index->has_times = index->marks[0].time_ms != KEYFRAME_NO_TIME;
+    return EXIT_SUCCESS;
+abend:
+    vt_keyframe_free(index);
+    return EXIT_FAILURE;
+}
+
+/*
+The last mark at or before time_ms
+*/
+int
+vt_keyframe_find(struct vt_keyframe_index *index, int64_t time_ms)
+{
+    int lo = 0;
+    int hi = index->mark_count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (index->marks[mid].time_ms <= time_ms) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return lo > 0 ? lo - 1 : 0;
+}
+
+/*
+Bring decoder to the state it was in at mark. scratch must be headless. It's 
+restored from the nearest keyframe and decodes the rest, so the cost doesn't 
+depend on how far into the dump the mark is. decoder is then redrawn once
+*/
+int
+vt_keyframe_seek(struct vt_keyframe_index *index, struct vt_decoder_state *decoder, 
+    struct vt_decoder_state *scratch, const uint8_t *dump, size_t length, int mark)
+{
+    uint64_t offset = index->marks[mark].offset;
+    uint64_t start = 0;
+
+    if (offset > length) {
+        fprintf(stderr, "Dump is shorter than its index\n");
+        return EXIT_FAILURE;
+    }
+
+    int lo = 0;
+    int hi = index->keyframe_count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (index->keyframes[mid]->offset <= offset) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    if (lo > 0) {
+        struct vt_keyframe_record *keyframe = index->keyframes[lo - 1];
+
+        if (vt_decoder_restore(scratch, (uint8_t *)(keyframe + 1), keyframe->length) != EXIT_SUCCESS) {
+            fprintf(stderr, "Invalid keyframe\n");
+            return EXIT_FAILURE;
+        }
+
+        start = keyframe->offset;
+    }
+    else {
+        vt_decoder_init(scratch);
+    }
+
+    vt_decoder_decode(scratch, (uint8_t *)dump + start, offset - start);
+
+    size_t size = vt_decoder_snapshot_size(scratch);
+    uint8_t *buffer = malloc(size);
+
+    if (buffer == NULL) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    vt_decoder_snapshot(scratch, buffer, size);
+    int rv = vt_decoder_restore(decoder, buffer, size);
+    free(buffer);
+    return rv;
+}
+
+void
+vt_keyframe_free(struct vt_keyframe_index *index)
+{
+    if (index->map != NULL) {
+        munmap(index->map, index->map_length);
+    }
+
+    free(index->marks);
+    free(index->keyframes);
+    memset(index, 0, sizeof(struct vt_keyframe_index));
+}
+
+static int
+vt_write_records(struct vt_keyframe_writer *writer, struct vt_decoder_state *decoder, 
+    int64_t time_ms, bool is_keyframe)
+{
+    struct vt_keyframe_record record = {KEYFRAME_MARK, 0, writer->offset, time_ms};
+
+    if (fwrite(&record, sizeof(record), 1, writer->file) != 1) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    if (!is_keyframe) {
+        return EXIT_SUCCESS;
+    }
+
+    size_t size = vt_decoder_snapshot_size(decoder);
+    size_t padded = (size + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+
+    if (padded > writer->buffer_size) {
+        uint8_t *buffer = realloc(writer->buffer, padded);
+
+        if (buffer == NULL) {
+            log_err();
+            return EXIT_FAILURE;
+        }
+
+        writer->buffer = buffer;
+        writer->buffer_size = padded;
+    }
+
+    vt_decoder_snapshot(decoder, writer->buffer, size);
+    memset(writer->buffer + size, 0, padded - size);
+    record.type = KEYFRAME_SNAPSHOT;
+    record.length = padded;
+
+    if (fwrite(&record, sizeof(record), 1, writer->file) != 1
+        || fwrite(writer->buffer, 1, record.length, writer->file) != record.length
+        || fflush(writer->file) == EOF) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    writer->keyframe_offset = writer->offset;
+    return EXIT_SUCCESS;
+}
+
+/*
+Count the records, or fill in marks and keyframes. A record cut short (e.g. the
+capture was killed) ends the index
+*/
+static void
+vt_scan_records(struct vt_keyframe_index *index, bool is_counting)
+{
+    size_t offset = sizeof(struct vt_keyframe_header);
+    int marks = 0;
+    int keyframes = 0;
+
+    while (offset + sizeof(struct vt_keyframe_record) <= index->map_length) {
+        struct vt_keyframe_record *record = (struct vt_keyframe_record *)(index->map + offset);
+        size_t next = offset + sizeof(struct vt_keyframe_record) + record->length;
+
+        if (next > index->map_length) {
+            break;
+        }
+
+        if (record->type == KEYFRAME_MARK) {
+            if (!is_counting) {
+                index->marks[marks].offset = record->offset;
+                index->marks[marks].time_ms = record->time_ms;
+            }
+            ++marks;
+        }
+        else if (record->type == KEYFRAME_SNAPSHOT) {
+            if (!is_counting) {
+                index->keyframes[keyframes] = record;
+            }
+            ++keyframes;
+        }
+        else {
+            break;
+        }
+
+        offset = next;
+    }
+
+    index->mark_count = marks;
+    index->keyframe_count = keyframes;
+}
@@ -0,0 +1,89 @@
+#ifndef KEYFRAME_H
+#define KEYFRAME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "decoder.h"
+
+/*
+Keyframe index for a --dump file, written to <dump>.kf:
+    header | record | record | ...
+A mark record says that the dump held offset bytes time_ms after the capture 
+started. A keyframe record is followed by a decoder snapshot taken at offset, so
+replay can start from there rather than from the beginning of the dump
+*/
+#define KEYFRAME_MAGIC          (0x4B585456)    //  "VTXK"
+#define KEYFRAME_VERSION        (1)
+#define KEYFRAME_EXTENSION      ".kf"
+//  A keyframe is written when either has passed since the last one
+#define KEYFRAME_BYTES          (16384)
+#define KEYFRAME_MS             (10000)
+//  For dumps indexed after the event, which have no times
+#define KEYFRAME_NO_TIME        (-1)
+
+enum vt_keyframe_type
+{
+    KEYFRAME_MARK       = 1,
+    KEYFRAME_SNAPSHOT   = 2
+};
+
+struct vt_keyframe_header
+{
+    uint32_t magic;
+    uint32_t version;
+    //  Wall clock time of the start of the capture
+    int64_t start_time;
+};
+
+struct vt_keyframe_record
+{
+    uint32_t type;
+    //  Snapshot bytes following the record
+    uint32_t length;
+    uint64_t offset;
+    int64_t time_ms;
+};
+
+struct vt_keyframe_writer
+{
+    FILE *file;
+    uint64_t offset;
+    uint64_t keyframe_offset;
+    long start_ms;
+    long keyframe_ms;
+    uint8_t *buffer;
+    size_t buffer_size;
+};
+
+struct vt_keyframe_mark
+{
+    uint64_t offset;
+    int64_t time_ms;
+};
+
+struct vt_keyframe_index
+{
+    uint8_t *map;
+    size_t map_length;
+    int64_t start_time;
+    bool has_times;
+    struct vt_keyframe_mark *marks;
+    int mark_count;
+    //  Point into the map, in offset order
+    struct vt_keyframe_record **keyframes;
+    int keyframe_count;
+};
+
+int vt_keyframe_open(struct vt_keyframe_writer *writer, const char *dump_path);
+void vt_keyframe_mark(struct vt_keyframe_writer *writer, struct vt_decoder_state *decoder, int count);
+void vt_keyframe_close(struct vt_keyframe_writer *writer);
+int vt_keyframe_build(const char *dump_path, const uint8_t *dump, size_t length, 
+    struct vt_decoder_state *decoder);
+int vt_keyframe_load(struct vt_keyframe_index *index, const char *dump_path);
+int vt_keyframe_find(struct vt_keyframe_index *index, int64_t time_ms);
+int vt_keyframe_seek(struct vt_keyframe_index *index, struct vt_decoder_state *decoder, 
+    struct vt_decoder_state *scratch, const uint8_t *dump, size_t length, int mark);
+void vt_keyframe_free(struct vt_keyframe_index *index);
+
+#endif
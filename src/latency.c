@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "latency.h"
+#include "log.h"
+
+#define TIMESTR_MAX         (20)
+
+static void vt_record(struct vt_latency_histogram *histogram, long ms);
+static int vt_bucket(long ms);
+static long vt_bucket_ms(int bucket);
+static void vt_write_histogram(FILE *fout, const char *name, struct vt_latency_histogram *histogram);
+
+void
+vt_latency_init(struct vt_latency_state *state, const char *service)
+{
+    memset(state, 0, sizeof(struct vt_latency_state));
+    snprintf(state->service, LATENCY_SERVICE_MAX, "%s", service);
+}
+
+/*
+A key was sent to the host. A frame still arriving in response to an earlier 
+key is taken to be complete
+*/
+void
+vt_latency_key(struct vt_latency_state *state, long now_ms)
+{
+    if (state->key_ms != 0 && state->first_byte_ms != 0) {
+        vt_record(&state->frame, state->last_byte_ms - state->key_ms);
+    }
+
+    state->key_ms = now_ms;
+    state->first_byte_ms = 0;
+    state->last_byte_ms = 0;
+}
+
+/*
+Data arrived. Returns TRUE if a response is being timed, in which case 
+vt_latency_idle should be called once the host has been quiet for LATENCY_IDLE_MS
+*/
+bool
+vt_latency_read(struct vt_latency_state *state, long now_ms)
+{
+    if (state->key_ms == 0) {
+        return false;
+    }
+
+    if (state->first_byte_ms == 0) {
+        state->first_byte_ms = now_ms;
+        vt_record(&state->first_byte, now_ms - state->key_ms);
+    }
+
+    state->last_byte_ms = now_ms;
+    return true;
+}
+
+/*
+Returns TRUE if this completed a frame
+*/
+bool
+vt_latency_idle(struct vt_latency_state *state, long now_ms)
+{
+    if (state->key_ms == 0 || state->first_byte_ms == 0 
+        || now_ms - state->last_byte_ms < LATENCY_IDLE_MS) {
+        return false;
+    }
+
+    vt_record(&state->frame, state->last_byte_ms - state->key_ms);
+    state->key_ms = 0;
+    return true;
+}
+
+/*
+The lower bound of the bucket holding the given percentile. -1 if there are no 
+samples
+*/
+long
+vt_latency_percentile(struct vt_latency_histogram *histogram, int percent)
+{
+    if (histogram->total == 0) {
+        return -1;
+    }
+
+    uint64_t target = ((uint64_t)histogram->total * percent + 99) / 100;
+    uint64_t count = 0;
+
+    for (int b = 0; b < LATENCY_BUCKETS; ++b) {
+        count += histogram->counts[b];
+
+        if (count >= target) {
+            return vt_bucket_ms(b);
+        }
+    }
+
+    return histogram->max_ms;
+}
+
+/*
+Append the results to path, so that runs against different services can be 
+compared
+*/
+int
+vt_latency_write(struct vt_latency_state *state, const char *path)
+{
+    FILE *fout = fopen(path, "a");
+
+    if (fout == NULL) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    char timestr[TIMESTR_MAX];
+    time_t now = time(NULL);
+    strftime(timestr, TIMESTR_MAX, "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+    fprintf(fout, "service=%s time=%s\n", state->service, timestr);
+    vt_write_histogram(fout, "first_byte", &state->first_byte);
+    vt_write_histogram(fout, "frame", &state->frame);
+
+    if (fclose(fout) == EOF) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void
+vt_record(struct vt_latency_histogram *histogram, long ms)
+{
+    ++histogram->counts[vt_bucket(ms)];
+    ++histogram->total;
+
+    if (ms > histogram->max_ms) {
+        histogram->max_ms = ms;
+    }
+}
+
+static int
+vt_bucket(long ms)
+{
+    if (ms < LATENCY_SUB_BUCKETS) {
+        return ms < 0 ? 0 : ms;
+    }
+
+    //  Position of the top bit, then the next 4 bits
+    int exponent = 63 - __builtin_clzl(ms);
+    int bucket = (exponent - 3) * LATENCY_SUB_BUCKETS + ((ms >> (exponent - 4)) & (LATENCY_SUB_BUCKETS - 1));
+
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+static long
+vt_bucket_ms(int bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    int exponent = bucket / LATENCY_SUB_BUCKETS + 3;
+    return (long)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << (exponent - 4);
+}
+
+/*
+A summary line, then the non-empty buckets as lower bound in ms:count
+*/
+static void
+vt_write_histogram(FILE *fout, const char *name, struct vt_latency_histogram *histogram)
+{
+    fprintf(fout, "%s n=%u p50=%ld p90=%ld p99=%ld max=%ld\n", name, histogram->total,
+        vt_latency_percentile(histogram, 50), vt_latency_percentile(histogram, 90),
+        vt_latency_percentile(histogram, 99), histogram->max_ms);
+    fprintf(fout, "%s_histogram", name);
+
+    for (int b = 0; b < LATENCY_BUCKETS; ++b) {
+        if (histogram->counts[b] > 0) {
+            fprintf(fout, " %ld:%u", vt_bucket_ms(b), histogram->counts[b]);
+        }
+    }
+
+    fprintf(fout, "\n");
+}
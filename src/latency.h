@@ -0,0 +1,43 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Buckets are exact below 16ms, then 16 per doubling, so percentiles are within
+about 6%
+*/
+#define LATENCY_BUCKETS     (256)
+#define LATENCY_SUB_BUCKETS (16)
+//  A frame is complete once the host has been quiet for this long
+#define LATENCY_IDLE_MS     (300)
+#define LATENCY_SERVICE_MAX (64)
+
+struct vt_latency_histogram
+{
+    uint32_t counts[LATENCY_BUCKETS];
+    uint32_t total;
+    long max_ms;
+};
+
+struct vt_latency_state
+{
+    char service[LATENCY_SERVICE_MAX];
+    //  From a key being sent to the first byte back, and to the end of the frame
+    struct vt_latency_histogram first_byte;
+    struct vt_latency_histogram frame;
+    //  When the last key was sent. 0 if no response is awaited
+    long key_ms;
+    long first_byte_ms;
+    long last_byte_ms;
+};
+
+void vt_latency_init(struct vt_latency_state *state, const char *service);
+void vt_latency_key(struct vt_latency_state *state, long now_ms);
+bool vt_latency_read(struct vt_latency_state *state, long now_ms);
+bool vt_latency_idle(struct vt_latency_state *state, long now_ms);
+long vt_latency_percentile(struct vt_latency_histogram *histogram, int percent);
+int vt_latency_write(struct vt_latency_state *state, const char *path);
+
+#endif
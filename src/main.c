@@ -1,15 +1,20 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
+#include <ctype.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <locale.h>
 #include <ncursesw/curses.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/timerfd.h>
@@ -19,6 +24,25 @@
 #include "bedstead.h"
 #include "decoder.h"
 #include "telesoft.h"
+#include "telnet.h"
+#include "input.h"
+#include "probe.h"
+#include "prefetch.h"
+#include "net.h"
+#include "vtout.h"
+#include "archive.h"
+#include "fts.h"
+#include "split.h"
+#include "t42.h"
+#include "keyframe.h"
+#include "latency.h"
+#include "stats.h"
+#include "history.h"
+#include "store.h"
+#include "reader.h"
+#include "route.h"
+#include "shm.h"
+#include "watch.h"
 #include "log.h"
 #include "rc.h"
 
@@ -33,9 +57,22 @@ const char *version = "0.0.0";
 #define KEY_DOWNLOAD        'g'
 #define KEY_BOLD            'b'
 #define KEY_SAVE_FRAME      'f'
+#define KEY_HISTORY_BACK    'p'
+#define KEY_HISTORY_FORWARD 'n'
 #define IO_BUFFER_LEN       (2048)
 #define POLL_PERIOD_MS      (-1)
 #define TIMESTR_MAX         (15)
+#define RECONNECT_DELAY_MAX (60)
+#define KEEPALIVE_PROBES    (3)
+#define BRACKETED_PASTE_ON  "\033[?2004h"
+#define BRACKETED_PASTE_OFF "\033[?2004l"
+//  Replay steps through dumps without times in updates rather than minutes
+#define REPLAY_UPDATES_PER_MINUTE   (100)
+#define REPLAY_ENTRY_MAX            (6)
+//  Predictions the host hasn't echoed in this time are taken back
+#define PREDICTION_TIMEOUT_MS       (3000)
+//  Quiet time after which the host's frame is taken to be complete
+#define INSTANT_SETTLE_MS           (500)
 
 struct vt_session_state
 {
@@ -43,33 +80,144 @@ struct vt_session_state
     struct vt_rc_entry *selected_rc;
     struct vt_decoder_state decoder_state;
     struct vt_tele_state tele_state;
+    struct vt_telnet_state telnet_state;
     bool show_menu;
     bool show_help;
     bool show_version;
+    bool probe;
+    bool preconnect;
+    //  Hosts resolved (and maybe connected) while the menu is shown
+    struct vt_prefetch_state prefetch_state;
+    enum vt_probe_format probe_format;
+    //  Pages to visit on a schedule, reporting changes
+    char *watch_path;
     FILE *load_file;
+    //  Frames are saved to, and --file loads from, this archive if set
+    char *archive_path;
+    //  Otherwise saved frames are links into this store if set
+    char *store_path;
+    //  Remove frames from store_path that no saves refer to, then exit
+    bool collect_garbage;
+    char *load_page;
+    //  With --file and an archive, show the frame as it was at this time.
+    //  ARCHIVE_LATEST without --at
+    time_t load_time;
+    //  With --archive, build the full text index or search it, then exit
+    bool build_index;
+    char *search_query;
+    //  With --archive, split this dump into frames then exit
+    char *split_path;
+    //  Teletext capture to show, or export to --archive
+    char *t42_path;
     // either from command line or shortcut to selected rc
     char *host;
     char *port;
     FILE *dump_file;
+    //  Keyframes for replaying dump_file
+    struct vt_keyframe_writer keyframe_writer;
+    //  A dump to replay
+    char *replay_path;
     int socket_fd;
+    //  Read the host on a thread of its own, taking what it reads from reader
+    bool io_thread;
+    struct vt_reader reader;
     int flash_timer_fd;
     int download_fd;
+    bool reconnect;
+    //  Set after reconnecting. Navigate back to last_page when the host responds
+    bool resume_pending;
+    char last_page[PAGE_NUMBER_MAX];
+    //  Seconds of idle time before keepalives are sent. 0 to disable
+    int keepalive_secs;
+    int keepalive_timer_fd;
+    time_t last_write;
+    //  Keys waiting to be sent, paced by input_timer_fd if there's a send rate
+    struct vt_input_state input_state;
+    int send_rate;
+    int input_timer_fd;
+    bool is_input_timer_armed;
+    bool is_paste_enabled;
+    //  Time from keys to responses, written to latency_path at exit
+    char *latency_path;
+    struct vt_latency_state latency_state;
+    int latency_timer_fd;
+    //  Counters, written as JSON to stats_path at exit and on SIGUSR1, and
+    //  served on stats_socket_path
+    struct vt_stats_state stats_state;
+    char *stats_path;
+    char *stats_socket_path;
+    //  The screen, published in shared memory as shm_name for other processes
+    char *shm_name;
+    struct vt_shm_state shm_state;
+    //  Frames seen this session, stepped through with CTRL-p and CTRL-n
+    struct vt_history history;
+    int history_kb;
+    //  The frame being shown from history, NULL when showing the host's. The
+    //  host's is kept in live_snapshot meanwhile
+    struct vt_history_entry *history_entry;
+    uint8_t *live_snapshot;
+    size_t live_snapshot_length;
+    //  Draw what's typed at a *page_ prompt before the host echoes it
+    bool predict;
+    bool is_predicting;
+    long prediction_ms;
+    //  Show the frame a route key led to last time as soon as it's pressed.
+    //  route_key, pressed on route_page, is learnt once the host shows a 
+    //  different page
+    bool instant;
+    struct vt_route_table routes;
+    bool is_page_entry;
+    int route_key;
+    char route_page[PAGE_NUMBER_MAX];
+    //  The page shown from history in place of the host's, and its cells, to
+    //  compare with the host's once it has sent it and gone quiet
+    char instant_page[PAGE_NUMBER_MAX];
+    struct vt_decoder_cell instant_cells[MAX_ROWS][MAX_COLS];
+    bool is_instant_answered;
+    long instant_ms;
+    //  Render with vtout rather than curses
+    bool direct;
+    struct vt_vtout_state vtout_state;
 };
 
 static void vt_cleanup(void);
 static void vt_terminate(int signal);
 static int vt_parse_options(int argc, char *argv[], struct vt_session_state *session);
+static int vt_parse_time(const char *text, time_t *when);
 static int vt_show_file(struct vt_session_state *state);
+static int vt_show_archived(struct vt_session_state *state);
+static int vt_show_t42(struct vt_session_state *state);
+static void vt_show_t42_page(struct vt_session_state *state, struct vt_t42_store *store, int page, int subpage);
+static int vt_show_replay(struct vt_session_state *state);
+static int vt_replay_jump(struct vt_keyframe_index *index, int mark, int minutes);
+static void vt_replay_status(struct vt_keyframe_index *index, int mark);
 static int vt_connect(struct vt_session_state *session);
+static int vt_reconnect(struct vt_session_state *session);
+static void vt_set_keepalive(struct vt_session_state *session);
+static bool vt_send(struct vt_session_state *session, void *buffer, int len);
+static void vt_status(char *format, ...);
+static void vt_send_input(struct vt_session_state *session);
+static void vt_init_screen(struct vt_session_state *session);
+static void vt_render(struct vt_session_state *session);
+static void vt_record_frame(struct vt_decoder_state *state, int length);
+static void vt_show_history(struct vt_session_state *session, bool is_older);
+static bool vt_show_entry(struct vt_session_state *session, struct vt_history_entry *entry);
+static void vt_leave_history(struct vt_session_state *session, bool is_rendered);
+static void vt_route(struct vt_session_state *session, int ch);
+static void vt_route_read(struct vt_session_state *session);
+static void vt_instant_check(struct vt_session_state *session);
+static void vt_predict(struct vt_session_state *session, int ch);
 static bool vt_is_valid_fd(int fd);
 static int vt_transform_input(int ch);
 static void vt_usage(void);
 static void vt_version(void);
 static void vt_trace(struct vt_session_state *session, char *format, ...);
 static void vt_save(struct vt_session_state *session);
+static void vt_save_archived(struct vt_session_state *session, time_t ticks);
 
 volatile sig_atomic_t terminate_received = false;
 volatile sig_atomic_t socket_closed = false;
+volatile sig_atomic_t stats_requested = false;
 struct vt_session_state session;
 
 int 
@@ -79,12 +227,21 @@ main(int argc, char *argv[])
     session.socket_fd = -1;
     session.flash_timer_fd = -1;
     session.download_fd = -1;
+    session.keepalive_timer_fd = -1;
+    session.input_timer_fd = -1;
+    session.latency_timer_fd = -1;
+    session.reader.data_fd = -1;
+    session.load_time = ARCHIVE_LATEST;
+    session.reader.wake_fd = -1;
+    session.history_kb = HISTORY_BUDGET_KB;
+    vt_stats_init(&session.stats_state, &session.decoder_state.counters, 
+        &session.tele_state.counters, &session.vtout_state);
     atexit(vt_cleanup);
 
     struct sigaction new_action;
     new_action.sa_handler = vt_terminate;
     sigemptyset(&new_action.sa_mask);
-    new_action.sa_flags = 0;
+    new_action.sa_flags = SA_RESTART;
     if (sigaction(SIGINT, &new_action, NULL) == -1) {
         log_err();
         goto abend;
@@ -105,6 +262,10 @@ main(int argc, char *argv[])
         log_err();
         goto abend;
     }
+    if (sigaction(SIGUSR1, &new_action, NULL) == -1) {
+        log_err();
+        goto abend;
+    }
 
     if (vt_rc_load(&session.rc_state) != EXIT_SUCCESS) {
         goto abend;
@@ -121,16 +282,67 @@ main(int argc, char *argv[])
         vt_version();
         exit(0);
     }
+    if (session.load_time != ARCHIVE_LATEST && session.load_file == NULL) {
+        vt_usage();
+        goto abend;
+    }
+    //  Before the viewers below, so their screens are published too
+    if (session.shm_name != NULL && vt_shm_create(&session.shm_state, session.shm_name) != EXIT_SUCCESS) {
+        goto abend;
+    }
     if (session.load_file != NULL) {
         exit(vt_show_file(&session));
     }
+    if (session.t42_path != NULL) {
+        exit(vt_show_t42(&session));
+    }
+    if (session.replay_path != NULL) {
+        exit(vt_show_replay(&session));
+    }
+
+    if (session.collect_garbage) {
+        if (session.store_path == NULL) {
+            vt_usage();
+            goto abend;
+        }
+        exit(vt_store_gc(session.store_path));
+    }
+
+    if (session.build_index || session.search_query != NULL || session.split_path != NULL) {
+        if (session.archive_path == NULL) {
+            vt_usage();
+            goto abend;
+        }
+        if (session.split_path != NULL) {
+            exit(vt_split_run(session.split_path, session.archive_path));
+        }
+        exit(session.build_index 
+            ? vt_fts_build(session.archive_path) 
+            : vt_fts_search(session.archive_path, session.search_query));
+    }
+
+    if (session.probe) {
+        exit(vt_probe_run(&session.rc_state, session.probe_format));
+    }
+
+    if (session.watch_path != NULL) {
+        exit(vt_watch_run(&session.rc_state, session.watch_path, &terminate_received));
+    }
 
     if (session.show_menu) {
+        if (vt_prefetch_start(&session.prefetch_state, &session.rc_state, session.preconnect) != EXIT_SUCCESS) {
+            goto abend;
+        }
+
         session.selected_rc = vt_rc_show_menu(&session.rc_state);
 
         if (session.selected_rc != NULL) {
             session.host = session.selected_rc->host;
             session.port = session.selected_rc->port;
+
+            if (session.send_rate == 0) {
+                session.send_rate = session.selected_rc->send_rate;
+            }
         }
         else {
             fprintf(stderr, "No configuration found\n");
@@ -143,10 +355,29 @@ main(int argc, char *argv[])
         goto abend;
     }
 
-    if (vt_connect(&session) != EXIT_SUCCESS) {
+    int connect_rv = vt_connect(&session);
+    //  Close any connections we warmed but didn't use
+    vt_prefetch_stop(&session.prefetch_state);
+
+    if (connect_rv != EXIT_SUCCESS) {
+        fprintf(stderr, "Failed to establish connection with host %s:%s\n", session.host, session.port);
         goto abend;
     }
 
+    if (session.keepalive_secs > 0) {
+        session.keepalive_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (session.keepalive_timer_fd == -1) {
+            log_err();
+            goto abend;
+        }
+
+        struct itimerspec keepalive_time = {{session.keepalive_secs, 0}, {session.keepalive_secs, 0}};
+        if (timerfd_settime(session.keepalive_timer_fd, 0, &keepalive_time, NULL) == -1) {
+            log_err();
+            goto abend;
+        }
+    }
+
     session.flash_timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK);
     if (session.flash_timer_fd == -1) {
         log_err();
@@ -159,50 +390,177 @@ main(int argc, char *argv[])
         goto abend;
     }
 
-    setlocale(LC_ALL, "");
-    initscr();
-    if (session.decoder_state.map_char == NULL) {
-        session.decoder_state.map_char = &bed_map_char;
+    vt_input_init(&session.input_state, session.send_rate);
+    session.input_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (session.input_timer_fd == -1) {
+        log_err();
+        goto abend;
+    }
+
+    if (session.latency_path != NULL) {
+        char service[LATENCY_SERVICE_MAX];
+
+        if (session.selected_rc != NULL) {
+            snprintf(service, LATENCY_SERVICE_MAX, "%s", session.selected_rc->name);
+        }
+        else {
+            snprintf(service, LATENCY_SERVICE_MAX, "%s:%s", session.host, session.port);
+        }
+
+        vt_latency_init(&session.latency_state, service);
+        session.latency_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (session.latency_timer_fd == -1) {
+            log_err();
+            goto abend;
+        }
+    }
+
+    if (session.stats_socket_path != NULL 
+        && vt_stats_listen(&session.stats_state, session.stats_socket_path) != EXIT_SUCCESS) {
+        goto abend;
     }
-    vt_decoder_init(&session.decoder_state);
+
+    vt_init_screen(&session);
     vt_tele_reset(&session.tele_state);
-    session.decoder_state.win = stdscr;
-    cbreak();
-    nodelay(session.decoder_state.win, true);
-    noecho();
-    keypad(session.decoder_state.win, true);
+    vt_history_init(&session.history, (size_t)session.history_kb * 1024);
+    vt_route_init(&session.routes);
+    session.decoder_state.frame_end = vt_record_frame;
+    //  Pasted text is then bracketed by markers and we can tell it apart from typing
+    printf(BRACKETED_PASTE_ON);
+    fflush(stdout);
+    session.is_paste_enabled = true;
+
+    if (session.io_thread && vt_reader_start(&session.reader, session.socket_fd) != EXIT_SUCCESS) {
+        goto abend;
+    }
 
-    const char more = '_';
+    uint8_t more = '_';
     bool can_download = false;
     bool is_downloading = false;
     uint8_t buffer[IO_BUFFER_LEN];
-    struct pollfd poll_data[3] = {
-        {.fd = session.socket_fd, .events = POLLIN},
+    struct pollfd poll_data[7] = {
+        {.fd = session.io_thread ? session.reader.data_fd : session.socket_fd, .events = POLLIN},
         {.fd = STDIN_FILENO, .events = POLLIN},
-        {.fd = session.flash_timer_fd, .events = POLLIN}
+        {.fd = session.flash_timer_fd, .events = POLLIN},
+        {.fd = session.keepalive_timer_fd, .events = POLLIN},
+        {.fd = session.input_timer_fd, .events = POLLIN},
+        {.fd = session.latency_timer_fd, .events = POLLIN},
+        {.fd = session.stats_state.listen_fd, .events = POLLIN}
     };
 
-    while (!(terminate_received || socket_closed)) {
-        int prv = poll(poll_data, 3, POLL_PERIOD_MS);
+    while (!terminate_received) {
+        if (socket_closed) {
+            if (!session.reconnect) {
+                break;
+            }
+
+            if (is_downloading) {
+                close(session.download_fd);
+                session.download_fd = -1;
+                is_downloading = false;
+            }
+
+            can_download = false;
+            vt_tele_reset(&session.tele_state);
+
+            if (session.io_thread) {
+                vt_reader_stop(&session.reader);
+            }
+
+            if (vt_reconnect(&session) != EXIT_SUCCESS) {
+                break;
+            }
+
+            if (session.io_thread && vt_reader_start(&session.reader, session.socket_fd) != EXIT_SUCCESS) {
+                goto abend;
+            }
+
+            poll_data[0].fd = session.io_thread ? session.reader.data_fd : session.socket_fd;
+        }
+
+        //  Leave keys in curses while the queue is full, or poll would return at once
+        poll_data[1].events = vt_input_is_full(&session.input_state) ? 0 : POLLIN;
+
+        int prv = poll(poll_data, 7, POLL_PERIOD_MS);
 
         if (prv == -1 && errno != EINTR) {
             log_err();
             goto abend;
         }
 
+        if (stats_requested) {
+            stats_requested = false;
+
+            if (session.stats_path != NULL) {
+                vt_stats_write(&session.stats_state, session.stats_path);
+            }
+        }
+
         if (prv < 1) {
             continue;
         }
 
         if (poll_data[0].revents & POLLIN) {
-            int nread = read(session.socket_fd, buffer, IO_BUFFER_LEN);
+            int nread;
+
+            if (session.io_thread) {
+                nread = vt_reader_read(&session.reader, buffer, IO_BUFFER_LEN);
+                session.stats_state.read_calls += atomic_exchange(&session.reader.read_calls, 0);
+            }
+            else {
+                nread = read(session.socket_fd, buffer, IO_BUFFER_LEN);
+                ++session.stats_state.read_calls;
+            }
+
+            if (nread == 0 || (nread == -1 && errno != EINTR && errno != EAGAIN)) {
+                socket_closed = true;
+                continue;
+            }
+
+            if (nread > 0) {
+                session.stats_state.bytes_read += nread;
+                nread = vt_telnet_filter(&session.telnet_state, buffer, nread, session.socket_fd);
+
+                if (nread == -1) {
+                    socket_closed = true;
+                }
+            }
+
+            if (nread > 0 && session.resume_pending) {
+                session.resume_pending = false;
+
+                if (session.last_page[0] != 0) {
+                    uint8_t nav[PAGE_NUMBER_MAX + 2] = {'*'};
+                    int nav_len = 1;
+
+                    for (char *p = session.last_page; isdigit(*p); ++p) {
+                        nav[nav_len++] = *p;
+                    }
+
+                    nav[nav_len++] = '_';
+                    vt_trace(&session, "resume at page %s\n", session.last_page);
+                    vt_send(&session, nav, nav_len);
+                }
+            }
 
             if (nread > 0) {
+                if (session.latency_path != NULL 
+                    && vt_latency_read(&session.latency_state, vt_net_now_ms())) {
+                    //  Restart the idle countdown
+                    struct itimerspec idle = {{0, 0}, {0, LATENCY_IDLE_MS * 1000000L}};
+                    timerfd_settime(session.latency_timer_fd, 0, &idle, NULL);
+                }
+
                 if (session.dump_file != NULL) {
                     fwrite(buffer, sizeof(uint8_t), nread, session.dump_file);
                 }
 
+                vt_leave_history(&session, false);
                 vt_decoder_decode(&session.decoder_state, buffer, nread);
+                vt_keyframe_mark(&session.keyframe_writer, &session.decoder_state, nread);
+                vt_render(&session);
+                vt_decoder_get_page_number(&session.decoder_state, session.last_page, PAGE_NUMBER_MAX);
+                vt_route_read(&session);
 
                 if (!is_downloading) {
                     can_download = vt_tele_decode_header(&session.tele_state, buffer, nread);
@@ -223,59 +581,135 @@ main(int argc, char *argv[])
                             session.download_fd = -1;
                         }
 
-                        if (write(session.socket_fd, &more, 1) < 1) {
-                            socket_closed = true;
-                        }
+                        vt_send(&session, &more, 1);
                     }
                 }
             }
         }
 
         if (poll_data[1].revents & POLLIN) {
-            int ch = vt_transform_input(getch());
+            int ch = ERR;
 
-            switch (ch) {
-            case EOF:
-                break;
-            case vt_is_ctrl(KEY_REVEAL):
-                vt_decoder_toggle_reveal(&session.decoder_state);
-                break;
-            case vt_is_ctrl(KEY_DOWNLOAD):
-                if (can_download) {
-                    is_downloading = true;
-                    session.download_fd 
-                        = open(session.tele_state.filename, O_CREAT|O_WRONLY|O_TRUNC, S_IRWXU);
+            //  Take everything the terminal has so that pastes and macros go out in one write
+            while (!vt_input_is_full(&session.input_state) && (ch = getch()) != ERR) {
+                ch = vt_transform_input(ch);
 
-                    if (session.download_fd == -1) {
-                        log_err();
-                        goto abend;
-                    }
+                if (ch > 0xFF) {
+                    //  Curses function keys mean nothing to the host
+                    continue;
+                }
 
-                    if (write(session.socket_fd, &more, 1) < 1) {
-                        socket_closed = true;
-                    }
+                if (ch != vt_is_ctrl(KEY_HISTORY_BACK) && ch != vt_is_ctrl(KEY_HISTORY_FORWARD)) {
+                    vt_leave_history(&session, true);
                 }
-                break;
-            case vt_is_ctrl(KEY_SAVE_FRAME):
-                vt_save(&session);
-                break;
-            case vt_is_ctrl(KEY_BOLD):
-                session.decoder_state.bold_mode = !session.decoder_state.bold_mode;
-                break;
-            default:
-                if (write(session.socket_fd, &ch, 1) < 1) {
-                    socket_closed = true;
+
+                if (vt_input_is_pasting(&session.input_state)) {
+                    vt_input_push(&session.input_state, ch);
+                    continue;
+                }
+
+                switch (ch) {
+                case vt_is_ctrl(KEY_REVEAL):
+                    vt_decoder_toggle_reveal(&session.decoder_state);
+                    vt_render(&session);
+                    break;
+                case vt_is_ctrl(KEY_DOWNLOAD):
+                    if (can_download) {
+                        is_downloading = true;
+                        session.download_fd 
+                            = open(session.tele_state.filename, O_CREAT|O_WRONLY|O_TRUNC, S_IRWXU);
+
+                        if (session.download_fd == -1) {
+                            log_err();
+                            goto abend;
+                        }
+
+                        vt_send(&session, &more, 1);
+                    }
+                    break;
+                case vt_is_ctrl(KEY_SAVE_FRAME):
+                    vt_save(&session);
+                    break;
+                case vt_is_ctrl(KEY_BOLD):
+                    session.decoder_state.bold_mode = !session.decoder_state.bold_mode;
+                    break;
+                case vt_is_ctrl(KEY_HISTORY_BACK):
+                    vt_show_history(&session, true);
+                    break;
+                case vt_is_ctrl(KEY_HISTORY_FORWARD):
+                    vt_show_history(&session, false);
+                    break;
+                default:
+                    vt_predict(&session, ch);
+                    vt_route(&session, ch);
+                    vt_input_push(&session.input_state, ch);
+                    break;
                 }
-                break;
             }
+
+            vt_input_end_burst(&session.input_state);
+            vt_send_input(&session);
         }
 
         if (poll_data[2].revents & POLLIN) {
             uint64_t elapsed = 0;
             if (read(session.flash_timer_fd, &elapsed, sizeof(uint64_t)) > 0) {
+                if (session.decoder_state.prediction_count > 0
+                    && vt_net_now_ms() - session.prediction_ms >= PREDICTION_TIMEOUT_MS) {
+                    vt_decoder_cancel_predictions(&session.decoder_state);
+                }
+
+                if (session.instant_page[0] != 0 && session.is_instant_answered
+                    && vt_net_now_ms() - session.instant_ms >= INSTANT_SETTLE_MS) {
+                    vt_instant_check(&session);
+                }
+
                 vt_decoder_toggle_flash(&session.decoder_state);
+                vt_render(&session);
+            }
+        }
+
+        if (poll_data[3].revents & POLLIN) {
+            uint64_t elapsed = 0;
+            if (read(session.keepalive_timer_fd, &elapsed, sizeof(uint64_t)) > 0
+                && time(NULL) - session.last_write >= session.keepalive_secs) {
+                //  Telnet servers ignore NOP; plain viewdata hosts ignore NUL
+                uint8_t nop[2] = {TELNET_IAC, TELNET_NOP};
+                uint8_t nul = 0;
+
+                if (session.telnet_state.is_active) {
+                    vt_send(&session, nop, 2);
+                }
+                else {
+                    vt_send(&session, &nul, 1);
+                }
+            }
+        }
+
+        if (poll_data[4].revents & POLLIN) {
+            uint64_t elapsed = 0;
+            if (read(session.input_timer_fd, &elapsed, sizeof(uint64_t)) > 0) {
+                vt_send_input(&session);
+            }
+        }
+
+        if (poll_data[5].revents & POLLIN) {
+            uint64_t elapsed = 0;
+            if (read(session.latency_timer_fd, &elapsed, sizeof(uint64_t)) > 0
+                && vt_latency_idle(&session.latency_state, vt_net_now_ms())) {
+                struct vt_latency_state *latency = &session.latency_state;
+                vt_status("First byte p50 %ldms p99 %ldms  Frame p50 %ldms p99 %ldms  (%u)",
+                    vt_latency_percentile(&latency->first_byte, 50), 
+                    vt_latency_percentile(&latency->first_byte, 99),
+                    vt_latency_percentile(&latency->frame, 50), 
+                    vt_latency_percentile(&latency->frame, 99),
+                    latency->frame.total);
             }
         }
+
+        if (poll_data[6].revents & POLLIN) {
+            vt_stats_serve(&session.stats_state);
+        }
     }
 
     if (socket_closed) {
@@ -290,8 +724,22 @@ abend:
 static void 
 vt_cleanup(void)
 {
+    if (session.direct && session.vtout_state.is_valid) {
+        vt_vtout_finish(&session.vtout_state);
+    }
+
     endwin();
 
+    if (session.is_paste_enabled) {
+        printf(BRACKETED_PASTE_OFF);
+        fflush(stdout);
+    }
+
+    //  Before the socket goes
+    if (session.io_thread) {
+        vt_reader_stop(&session.reader);
+    }
+
     if (session.socket_fd > -1) {
         uint8_t default_buffer[4] = {'*', '9', '0', '_'};
         uint8_t *buffer = default_buffer;
@@ -326,12 +774,44 @@ vt_cleanup(void)
         }
     }
 
+    if (session.keepalive_timer_fd > -1) {
+        if (close(session.keepalive_timer_fd) == -1) {
+            log_err();
+        }
+    }
+
+    if (session.input_timer_fd > -1) {
+        if (close(session.input_timer_fd) == -1) {
+            log_err();
+        }
+    }
+
+    if (session.latency_timer_fd > -1) {
+        vt_latency_idle(&session.latency_state, vt_net_now_ms());
+        vt_latency_write(&session.latency_state, session.latency_path);
+
+        if (close(session.latency_timer_fd) == -1) {
+            log_err();
+        }
+    }
+
+    if (session.stats_path != NULL) {
+        vt_stats_write(&session.stats_state, session.stats_path);
+    }
+
+    vt_stats_close(&session.stats_state);
+    vt_shm_close(&session.shm_state);
+    vt_history_free(&session.history);
+    free(session.live_snapshot);
+
     if (session.dump_file != NULL) {
         if (fclose(session.dump_file) == -1) {
             log_err();
         }
     }
 
+    vt_keyframe_close(&session.keyframe_writer);
+
     if (session.download_fd > -1) {
         if (close(session.download_fd) == -1) {
             log_err();
@@ -355,16 +835,24 @@ vt_cleanup(void)
     if (session.load_file != NULL) {
         fclose(session.load_file);
     }
+
+    vt_decoder_free(&session.decoder_state);
+    free(session.archive_path);
+    free(session.load_page);
 }
 
 static void
 vt_terminate(int signal)
 {
-    terminate_received = true;
-
     if (signal == SIGPIPE) {
         socket_closed = true;
     }
+    else if (signal == SIGUSR1) {
+        stats_requested = true;
+    }
+    else {
+        terminate_received = true;
+    }
 }
 
 static int
@@ -384,6 +872,31 @@ vt_parse_options(int argc, char *argv[], struct vt_session_state *session)
         {"file", required_argument, 0, 0},
         {"help", no_argument, 0, 0},
         {"version", no_argument, 0, 0},
+        {"reconnect", no_argument, 0, 0},
+        {"keepalive", required_argument, 0, 0},
+        {"rate", required_argument, 0, 0},
+        {"probe", optional_argument, 0, 0},
+        {"preconnect", no_argument, 0, 0},
+        {"direct", no_argument, 0, 0},
+        {"archive", required_argument, 0, 0},
+        {"page", required_argument, 0, 0},
+        {"index", no_argument, 0, 0},
+        {"search", required_argument, 0, 0},
+        {"split", required_argument, 0, 0},
+        {"t42", required_argument, 0, 0},
+        {"replay", required_argument, 0, 0},
+        {"latency", required_argument, 0, 0},
+        {"stats", required_argument, 0, 0},
+        {"stats-socket", required_argument, 0, 0},
+        {"history", required_argument, 0, 0},
+        {"store", required_argument, 0, 0},
+        {"gc", no_argument, 0, 0},
+        {"io-thread", no_argument, 0, 0},
+        {"predict", no_argument, 0, 0},
+        {"instant", no_argument, 0, 0},
+        {"watch", required_argument, 0, 0},
+        {"at", required_argument, 0, 0},
+        {"shm", required_argument, 0, 0},
         {0, 0, 0, 0}
     };
 
@@ -408,6 +921,10 @@ vt_parse_options(int argc, char *argv[], struct vt_session_state *session)
                     goto abend;
                 }
                 setbuf(session->dump_file, NULL);
+
+                if (vt_keyframe_open(&session->keyframe_writer, optarg) != EXIT_SUCCESS) {
+                    goto abend;
+                }
                 break;
             case 3:
                 session->show_menu = true;
@@ -446,6 +963,107 @@ vt_parse_options(int argc, char *argv[], struct vt_session_state *session)
             case 10:
                 session->show_version = true;
                 break;
+            case 11:
+                session->reconnect = true;
+                break;
+            case 12:
+                session->keepalive_secs = atoi(optarg);
+                if (session->keepalive_secs < 1) {
+                    vt_usage();
+                    goto abend;
+                }
+                break;
+            case 13:
+                session->send_rate = atoi(optarg);
+                if (session->send_rate < 1) {
+                    vt_usage();
+                    goto abend;
+                }
+                break;
+            case 14:
+                session->probe = true;
+                if (optarg == NULL || strcmp(optarg, "table") == 0) {
+                    session->probe_format = PROBE_TABLE;
+                }
+                else if (strcmp(optarg, "csv") == 0) {
+                    session->probe_format = PROBE_CSV;
+                }
+                else {
+                    vt_usage();
+                    goto abend;
+                }
+                break;
+            case 15:
+                session->show_menu = true;
+                session->preconnect = true;
+                break;
+            case 16:
+                session->direct = true;
+                break;
+            case 17:
+                session->archive_path = vt_rc_duplicate_token(optarg);
+                break;
+            case 18:
+                session->load_page = vt_rc_duplicate_token(optarg);
+                break;
+            case 19:
+                session->build_index = true;
+                break;
+            case 20:
+                session->search_query = optarg;
+                break;
+            case 21:
+                session->split_path = optarg;
+                break;
+            case 22:
+                session->t42_path = optarg;
+                break;
+            case 23:
+                session->replay_path = optarg;
+                break;
+            case 24:
+                session->latency_path = optarg;
+                break;
+            case 25:
+                session->stats_path = optarg;
+                break;
+            case 26:
+                session->stats_socket_path = optarg;
+                break;
+            case 27:
+                session->history_kb = atoi(optarg);
+                if (session->history_kb < 0) {
+                    vt_usage();
+                    goto abend;
+                }
+                break;
+            case 28:
+                session->store_path = optarg;
+                break;
+            case 29:
+                session->collect_garbage = true;
+                break;
+            case 30:
+                session->io_thread = true;
+                break;
+            case 31:
+                session->predict = true;
+                break;
+            case 32:
+                session->instant = true;
+                break;
+            case 33:
+                session->watch_path = optarg;
+                break;
+            case 34:
+                if (vt_parse_time(optarg, &session->load_time) != EXIT_SUCCESS) {
+                    fprintf(stderr, "Invalid time %s\n", optarg);
+                    goto abend;
+                }
+                break;
+            case 35:
+                session->shm_name = optarg;
+                break;
             }
             break;
         case '?':
@@ -459,9 +1077,42 @@ abend:
     return EXIT_FAILURE;
 }
 
+/*
+A local date and time, e.g. 2021-12-28 18:30. Seconds, or the time altogether,
+may be left out
+*/
+static int
+vt_parse_time(const char *text, time_t *when)
+{
+    const char *formats[] = {"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", 
+        "%Y-%m-%dT%H:%M", "%Y-%m-%d"};
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *end = strptime(text, formats[i], &tm);
+
+        if (end != NULL && *end == 0) {
+            //  Whatever daylight saving was in force then
+            tm.tm_isdst = -1;
+            *when = mktime(&tm);
+            return *when == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+    }
+
+    return EXIT_FAILURE;
+}
+
 static int
 vt_show_file(struct vt_session_state *state)
 {
+    bool is_archive = vt_archive_is_archive(fileno(state->load_file));
+
+    if (state->load_time != ARCHIVE_LATEST && !is_archive) {
+        fprintf(stderr, "--at only applies to a frame archive\n");
+        return EXIT_FAILURE;
+    }
+
     state->flash_timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK);
     if (state->flash_timer_fd == -1) {
         log_err();
@@ -474,24 +1125,24 @@ vt_show_file(struct vt_session_state *state)
         goto abend;
     }
 
-    setlocale(LC_ALL, "");
-    initscr();
-    if (state->decoder_state.map_char == NULL) {
-        state->decoder_state.map_char = &bed_map_char;
-    }
-    vt_decoder_init(&state->decoder_state);
-    state->decoder_state.win = stdscr;
-    cbreak();
-    nodelay(state->decoder_state.win, true);
-    noecho();
-    keypad(state->decoder_state.win, true);
+    vt_init_screen(state);
 
     uint8_t buffer[IO_BUFFER_LEN];
     ssize_t nread = 0;
-    while ((nread = fread(buffer, sizeof(uint8_t), IO_BUFFER_LEN, state->load_file)) > 0) {
-        vt_decoder_decode(&state->decoder_state, buffer, nread);
+
+    if (is_archive) {
+        if (vt_show_archived(state) != EXIT_SUCCESS) {
+            goto abend;
+        }
+    }
+    else {
+        while ((nread = fread(buffer, sizeof(uint8_t), IO_BUFFER_LEN, state->load_file)) > 0) {
+            vt_decoder_decode(&state->decoder_state, buffer, nread);
+        }
     }
 
+    vt_render(state);
+
     struct pollfd poll_data[2] = {
         {.fd = STDIN_FILENO, .events = POLLIN},
         {.fd = state->flash_timer_fd, .events = POLLIN}
@@ -515,6 +1166,7 @@ vt_show_file(struct vt_session_state *state)
             switch (ch) {
             case vt_is_ctrl(KEY_REVEAL):
                 vt_decoder_toggle_reveal(&state->decoder_state);
+                vt_render(state);
                 break;
             default:
                 break;
@@ -525,6 +1177,7 @@ vt_show_file(struct vt_session_state *state)
             uint64_t elapsed = 0;
             if (read(state->flash_timer_fd, &elapsed, sizeof(uint64_t)) > 0) {
                 vt_decoder_toggle_flash(&state->decoder_state);
+                vt_render(state);
             }
         }
     }
@@ -534,40 +1187,437 @@ abend:
     return 1;
 }
 
-static int 
-vt_connect(struct vt_session_state *session)
+/*
+Decode the frame for --page, or the most recent frame, from an archive
+*/
+static int
+vt_show_archived(struct vt_session_state *state)
 {
-    struct addrinfo hints;
-    memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = 0;
-    hints.ai_protocol = 0;
+    struct vt_archive archive;
 
-    struct addrinfo *result;
-    int rv = getaddrinfo(session->host, session->port, &hints, &result);
+    if (vt_archive_map(&archive, fileno(state->load_file)) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
 
-    if (rv != 0) {
-        goto abend;
+    struct vt_archive_index_entry *entry = state->load_page != NULL 
+        ? vt_archive_find_at(&archive, state->load_page, state->load_time) 
+        : vt_archive_latest(&archive, state->load_time);
+    struct vt_archive_record record;
+    const uint8_t *data = NULL;
+
+    if (entry == NULL || vt_archive_get_record(&archive, entry, &record, &data) != EXIT_SUCCESS) {
+        vt_archive_close(&archive);
+        endwin();
+        fprintf(stderr, "Frame not found in archive\n");
+        return EXIT_FAILURE;
     }
 
-    session->socket_fd = -1;
+    vt_decoder_decode(&state->decoder_state, (uint8_t *)data, entry->length);
+    vt_archive_close(&archive);
+    return EXIT_SUCCESS;
+}
 
-    for (struct addrinfo *rp = result; rp != NULL; rp = rp->ai_next) {
-        session->socket_fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+/*
+Load a teletext capture and page through it. Digits select a page, up and down
+move to the next and previous page and left and right show the subpages. With 
+--archive, every subpage is saved to the archive instead
+*/
+static int
+vt_show_t42(struct vt_session_state *state)
+{
+    int rv = EXIT_FAILURE;
+    struct vt_t42_store *store = malloc(sizeof(struct vt_t42_store));
 
-        if (session->socket_fd == -1) {
-            continue;
-        }
+    if (store == NULL) {
+        log_err();
+        return EXIT_FAILURE;
+    }
 
-        if (connect(session->socket_fd, rp->ai_addr, rp->ai_addrlen) != -1) {
-            break;
+    vt_t42_init(store);
+
+    if (vt_t42_load(store, state->t42_path) != EXIT_SUCCESS) {
+        goto cleanup;
+    }
+
+    if (state->archive_path != NULL) {
+        struct stat st;
+        const char *service = strrchr(state->t42_path, '/');
+        service = service == NULL ? state->t42_path : service + 1;
+
+        if (stat(state->t42_path, &st) == -1) {
+            log_err();
+            goto cleanup;
         }
 
-        close(session->socket_fd);
+        rv = vt_t42_export(store, state->archive_path, service, st.st_mtime);
+        printf("Saved %d pages from %lu packets, %lu errors\n", store->page_count, 
+            (unsigned long)store->packet_count, (unsigned long)store->error_count);
+        goto cleanup;
+    }
+
+    int page = state->load_page != NULL ? (int)strtol(state->load_page, NULL, 16) : T42_PAGE_MIN;
+    page = vt_t42_next_page(store, page - 1, 1);
+
+    if (page == -1) {
+        fprintf(stderr, "No pages found\n");
+        goto cleanup;
+    }
+
+    state->flash_timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK);
+    if (state->flash_timer_fd == -1) {
+        log_err();
+        goto cleanup;
+    }
+
+    struct itimerspec flash_time = {{1, 0}, {1, 0}};
+    if (timerfd_settime(state->flash_timer_fd, TFD_TIMER_ABSTIME, &flash_time, NULL) == -1) {
+        log_err();
+        goto cleanup;
+    }
+
+    vt_init_screen(state);
+
+    int subpage = 0;
+    char entry[T42_PAGE_TEXT_MAX];
+    int entry_length = 0;
+
+    vt_show_t42_page(state, store, page, subpage);
+
+    struct pollfd poll_data[2] = {
+        {.fd = STDIN_FILENO, .events = POLLIN},
+        {.fd = state->flash_timer_fd, .events = POLLIN}
+    };
+
+    while (!terminate_received) {
+        int prv = poll(poll_data, 2, POLL_PERIOD_MS);
+
+        if (prv == -1 && errno != EINTR) {
+            log_err();
+            goto cleanup;
+        }
+
+        if (prv < 1) {
+            continue;
+        }
+
+        if (poll_data[0].revents & POLLIN) {
+            int ch = getch();
+            int subpage_count = vt_t42_find(store, page)->subpage_count;
+            int next_page = page;
+
+            switch (ch) {
+            case vt_is_ctrl(KEY_REVEAL):
+                vt_decoder_toggle_reveal(&state->decoder_state);
+                vt_render(state);
+                break;
+            case KEY_UP:
+                next_page = vt_t42_next_page(store, page, 1);
+                break;
+            case KEY_DOWN:
+                next_page = vt_t42_next_page(store, page, -1);
+                break;
+            case KEY_RIGHT:
+                vt_show_t42_page(state, store, page, subpage = (subpage + 1) % subpage_count);
+                break;
+            case KEY_LEFT:
+                vt_show_t42_page(state, store, page, subpage = (subpage + subpage_count - 1) % subpage_count);
+                break;
+            default:
+                if (!isdigit(ch) || (entry_length == 0 && (ch == '0' || ch == '9'))) {
+                    break;
+                }
+
+                entry[entry_length++] = ch;
+                entry[entry_length] = 0;
+                vt_status("P%s", entry);
+
+                if (entry_length < T42_PAGE_TEXT_MAX - 1) {
+                    break;
+                }
+
+                entry_length = 0;
+                next_page = (int)strtol(entry, NULL, 16);
+
+                if (vt_t42_find(store, next_page) == NULL) {
+                    vt_status("P%s not found", entry);
+                    next_page = page;
+                }
+                break;
+            }
+
+            if (next_page != page) {
+                page = next_page;
+                subpage = 0;
+                vt_show_t42_page(state, store, page, subpage);
+            }
+        }
+
+        if (poll_data[1].revents & POLLIN) {
+            uint64_t elapsed = 0;
+            if (read(state->flash_timer_fd, &elapsed, sizeof(uint64_t)) > 0) {
+                vt_decoder_toggle_flash(&state->decoder_state);
+                vt_render(state);
+            }
+        }
+    }
+
+    rv = EXIT_SUCCESS;
+cleanup:
+    vt_t42_free(store);
+    free(store);
+    return rv;
+}
+
+static void
+vt_show_t42_page(struct vt_session_state *state, struct vt_t42_store *store, int page, int subpage)
+{
+    struct vt_t42_page *p = vt_t42_find(store, page);
+    uint8_t frame[T42_FRAME_MAX];
+    int length = vt_t42_get_frame(&p->subpages[subpage], frame);
+
+    vt_decoder_decode(&state->decoder_state, frame, length);
+    vt_render(state);
+    vt_status("P%X  %d/%d", page, subpage + 1, p->subpage_count);
+}
+
+/*
+Step through a dump using its keyframe index, building the index first if there
+isn't one. Left and right step through updates, up and down move by a minute,
+page up and down by ten. Minutes followed by enter go to that minute
+*/
+static int
+vt_show_replay(struct vt_session_state *state)
+{
+    int rv = EXIT_FAILURE;
+    struct vt_keyframe_index index;
+    struct vt_decoder_state *scratch = calloc(1, sizeof(struct vt_decoder_state));
+    uint8_t *dump = MAP_FAILED;
+    struct stat st;
+
+    memset(&index, 0, sizeof(index));
+
+    int fd = open(state->replay_path, O_RDONLY);
+    if (fd == -1 || scratch == NULL || fstat(fd, &st) == -1) {
+        log_err();
+        goto cleanup;
+    }
+
+    if (st.st_size == 0) {
+        fprintf(stderr, "Nothing to replay\n");
+        goto cleanup;
+    }
+
+    dump = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (dump == MAP_FAILED) {
+        log_err();
+        goto cleanup;
+    }
+
+    //  Keyframes hold glyphs, so they must be made with the same options
+    scratch->map_char = state->decoder_state.map_char != NULL ? state->decoder_state.map_char : &bed_map_char;
+    scratch->mono_mode = state->decoder_state.mono_mode;
+    scratch->bold_mode = state->decoder_state.bold_mode;
+    vt_decoder_init(scratch);
+
+    if (vt_keyframe_load(&index, state->replay_path) != EXIT_SUCCESS) {
+        if (errno != ENOENT 
+            || vt_keyframe_build(state->replay_path, dump, st.st_size, scratch) != EXIT_SUCCESS
+            || vt_keyframe_load(&index, state->replay_path) != EXIT_SUCCESS) {
+            goto cleanup;
+        }
+    }
+
+    state->flash_timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK);
+    if (state->flash_timer_fd == -1) {
+        log_err();
+        goto cleanup;
+    }
+
+    struct itimerspec flash_time = {{1, 0}, {1, 0}};
+    if (timerfd_settime(state->flash_timer_fd, TFD_TIMER_ABSTIME, &flash_time, NULL) == -1) {
+        log_err();
+        goto cleanup;
+    }
+
+    vt_init_screen(state);
+
+    int mark = 0;
+    char entry[REPLAY_ENTRY_MAX];
+    int entry_length = 0;
+    bool needs_seek = true;
+
+    struct pollfd poll_data[2] = {
+        {.fd = STDIN_FILENO, .events = POLLIN},
+        {.fd = state->flash_timer_fd, .events = POLLIN}
+    };
+
+    while (!terminate_received) {
+        if (needs_seek) {
+            needs_seek = false;
+
+            if (vt_keyframe_seek(&index, &state->decoder_state, scratch, dump, st.st_size, mark) != EXIT_SUCCESS) {
+                goto cleanup;
+            }
+
+            vt_render(state);
+            vt_replay_status(&index, mark);
+        }
+
+        int prv = poll(poll_data, 2, POLL_PERIOD_MS);
+
+        if (prv == -1 && errno != EINTR) {
+            log_err();
+            goto cleanup;
+        }
+
+        if (prv < 1) {
+            continue;
+        }
+
+        if (poll_data[0].revents & POLLIN) {
+            int ch = getch();
+            int next_mark = mark;
+
+            switch (ch) {
+            case vt_is_ctrl(KEY_REVEAL):
+                vt_decoder_toggle_reveal(&state->decoder_state);
+                vt_render(state);
+                break;
+            case KEY_RIGHT:
+                next_mark = mark + 1;
+                break;
+            case KEY_LEFT:
+                next_mark = mark - 1;
+                break;
+            case KEY_UP:
+                next_mark = vt_replay_jump(&index, mark, 1);
+                break;
+            case KEY_DOWN:
+                next_mark = vt_replay_jump(&index, mark, -1);
+                break;
+            case KEY_NPAGE:
+                next_mark = vt_replay_jump(&index, mark, 10);
+                break;
+            case KEY_PPAGE:
+                next_mark = vt_replay_jump(&index, mark, -10);
+                break;
+            case KEY_HOME:
+                next_mark = 0;
+                break;
+            case KEY_END:
+                next_mark = index.mark_count - 1;
+                break;
+            case '\n':
+            case '\r':
+            case KEY_ENTER:
+                if (entry_length > 0) {
+                    entry_length = 0;
+                    next_mark = vt_replay_jump(&index, 0, atoi(entry));
+                }
+                break;
+            default:
+                if (isdigit(ch) && entry_length < REPLAY_ENTRY_MAX - 1) {
+                    entry[entry_length++] = ch;
+                    entry[entry_length] = 0;
+                    vt_status("Go to minute %s", entry);
+                }
+                break;
+            }
+
+            if (next_mark < 0) {
+                next_mark = 0;
+            }
+            if (next_mark >= index.mark_count) {
+                next_mark = index.mark_count - 1;
+            }
+            if (next_mark != mark) {
+                mark = next_mark;
+                needs_seek = true;
+            }
+        }
+
+        if (poll_data[1].revents & POLLIN) {
+            uint64_t elapsed = 0;
+            if (read(state->flash_timer_fd, &elapsed, sizeof(uint64_t)) > 0) {
+                vt_decoder_toggle_flash(&state->decoder_state);
+                vt_render(state);
+            }
+        }
     }
 
-    freeaddrinfo(result);
+    rv = EXIT_SUCCESS;
+cleanup:
+    vt_keyframe_free(&index);
+
+    if (dump != MAP_FAILED) {
+        munmap(dump, st.st_size);
+    }
+
+    if (fd > -1) {
+        close(fd);
+    }
+
+    if (scratch != NULL) {
+        vt_decoder_free(scratch);
+        free(scratch);
+    }
+
+    return rv;
+}
+
+/*
+The mark the given number of minutes from mark
+*/
+static int
+vt_replay_jump(struct vt_keyframe_index *index, int mark, int minutes)
+{
+    if (!index->has_times) {
+        return mark + minutes * REPLAY_UPDATES_PER_MINUTE;
+    }
+
+    int next_mark = vt_keyframe_find(index, index->marks[mark].time_ms + minutes * 60000L);
+
+    //  Don't get stuck when nothing arrived for a minute or more
+    if (minutes > 0 && next_mark <= mark) {
+        next_mark = mark + 1;
+    }
+
+    return next_mark;
+}
+
+static void
+vt_replay_status(struct vt_keyframe_index *index, int mark)
+{
+    if (!index->has_times) {
+        vt_status("Update %d/%d", mark + 1, index->mark_count);
+        return;
+    }
+
+    char timestr[TIMESTR_MAX];
+    long secs = index->marks[mark].time_ms / 1000;
+    time_t when = index->start_time + secs;
+
+    strftime(timestr, TIMESTR_MAX, "%H:%M:%S", localtime(&when));
+    vt_status("%s  +%02ld:%02ld:%02ld  %d/%d", timestr, secs / 3600, (secs / 60) % 60, secs % 60, 
+        mark + 1, index->mark_count);
+}
+
+static int 
+vt_connect(struct vt_session_state *session)
+{
+    //  Use whatever was prepared while the menu was shown
+    session->socket_fd = vt_prefetch_take_socket(&session->prefetch_state, session->selected_rc);
+
+    if (session->socket_fd == -1) {
+        struct addrinfo *result = vt_prefetch_take_addr(&session->prefetch_state, session->selected_rc);
+
+        if (result == NULL && vt_net_resolve(session->host, session->port, &result) != 0) {
+            goto abend;
+        }
+
+        session->socket_fd = vt_net_connect_any(result, vt_net_now_ms() + NET_CONNECT_TIMEOUT_MS);
+        freeaddrinfo(result);
+    }
 
     if (session->socket_fd == -1) {
         goto abend;
@@ -578,18 +1628,19 @@ vt_connect(struct vt_session_state *session)
         goto abend;
     }
 
-    uint8_t preamble[MAX_AMBLE_LEN + 1] = {0};
-    preamble[0] = 22;
-    int preamble_len = 1;
-
-    if (session->selected_rc != NULL && session->selected_rc->preamble_length > 0) {
-        preamble_len += session->selected_rc->preamble_length;
+    //  Keystrokes are sent one at a time; don't let Nagle hold them back
+    int nodelay = 1;
+    if (setsockopt(session->socket_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) == -1) {
+        log_err();
+    }
 
-        for (int i = 0; i < session->selected_rc->preamble_length; ++i) {
-            preamble[i + 1] = session->selected_rc->preamble[i];
-        }
+    if (session->keepalive_secs > 0) {
+        vt_set_keepalive(session);
     }
 
+    uint8_t preamble[PREAMBLE_MAX] = {0};
+    int preamble_len = vt_rc_get_preamble(session->selected_rc, preamble);
+
     int sz = write(session->socket_fd, preamble, preamble_len);
 
     if (sz != preamble_len) {
@@ -602,19 +1653,475 @@ vt_connect(struct vt_session_state *session)
         goto abend;
     }
 
+    vt_telnet_reset(&session->telnet_state);
+    vt_telnet_note_sent(&session->telnet_state, preamble, preamble_len);
+
     vt_trace(session, "preamble: ");
     for (int i = 0; i < preamble_len; ++i) {
         vt_trace(session, "%d '%c' ", preamble[i], preamble[i]);
     }
     vt_trace(session, "\n");
+    session->last_write = time(NULL);
 
     return EXIT_SUCCESS;
 
 abend:
-    fprintf(stderr, "Failed to establish connection with host %s:%s\n", session->host, session->port);
     return EXIT_FAILURE;
 }
 
+/*
+Called when the host has gone away. Retry with exponential backoff until connected
+or the user quits. The preamble is replayed by vt_connect and once the host responds
+we navigate back to the last page seen
+*/
+static int
+vt_reconnect(struct vt_session_state *session)
+{
+    int delay = 1;
+
+    if (session->socket_fd > -1) {
+        close(session->socket_fd);
+        session->socket_fd = -1;
+    }
+
+    while (!terminate_received) {
+        vt_status("Connection lost. Reconnecting to %s:%s in %ds", session->host, session->port, delay);
+        vt_trace(session, "reconnect in %ds\n", delay);
+
+        struct timespec ts = {delay, 0};
+        if (nanosleep(&ts, NULL) == -1 && errno != EINTR) {
+            log_err();
+            return EXIT_FAILURE;
+        }
+
+        if (terminate_received) {
+            break;
+        }
+
+        if (vt_connect(session) == EXIT_SUCCESS) {
+            socket_closed = false;
+            session->resume_pending = true;
+            vt_status("");
+            return EXIT_SUCCESS;
+        }
+
+        if (session->socket_fd > -1) {
+            close(session->socket_fd);
+            session->socket_fd = -1;
+        }
+
+        delay = delay * 2 > RECONNECT_DELAY_MAX ? RECONNECT_DELAY_MAX : delay * 2;
+    }
+
+    return EXIT_FAILURE;
+}
+
+static void
+vt_set_keepalive(struct vt_session_state *session)
+{
+    int on = 1;
+    int idle = session->keepalive_secs;
+    int probes = KEEPALIVE_PROBES;
+
+    if (setsockopt(session->socket_fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) == -1
+        || setsockopt(session->socket_fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) == -1
+        || setsockopt(session->socket_fd, IPPROTO_TCP, TCP_KEEPINTVL, &idle, sizeof(idle)) == -1
+        || setsockopt(session->socket_fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes)) == -1) {
+        log_err();
+    }
+}
+
+static bool
+vt_send(struct vt_session_state *session, void *buffer, int len)
+{
+    uint8_t *next = buffer;
+
+    //  A write may be cut short by a signal or a full socket buffer
+    while (len > 0) {
+        ssize_t written = write(session->socket_fd, next, len);
+
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            socket_closed = true;
+            return false;
+        }
+
+        next += written;
+        len -= written;
+    }
+
+    session->last_write = time(NULL);
+    return true;
+}
+
+/*
+Send as much queued input as the send rate allows. While input is held back, 
+input_timer_fd ticks so that we come back for the rest
+*/
+static void
+vt_send_input(struct vt_session_state *session)
+{
+    struct vt_input_state *input = &session->input_state;
+    int count = vt_input_ready(input, vt_net_now_ms());
+
+    if (count > 0) {
+        vt_send(session, input->queue + input->queue_offset, count);
+        vt_input_consume(input, count);
+
+        if (session->latency_path != NULL) {
+            vt_latency_key(&session->latency_state, vt_net_now_ms());
+        }
+    }
+
+    bool is_pending = vt_input_is_pending(input);
+
+    if (is_pending != session->is_input_timer_armed) {
+        struct itimerspec tick = {{0, 0}, {0, 0}};
+
+        if (is_pending) {
+            tick.it_interval.tv_nsec = INPUT_TICK_MS * 1000000L;
+            tick.it_value.tv_nsec = INPUT_TICK_MS * 1000000L;
+        }
+
+        if (timerfd_settime(session->input_timer_fd, 0, &tick, NULL) == -1) {
+            log_err();
+        }
+
+        session->is_input_timer_armed = is_pending;
+    }
+}
+
+/*
+Curses is always used for keyboard input. With --direct the decoder doesn't 
+draw and vt_render writes its cells to the terminal instead
+*/
+static void
+vt_init_screen(struct vt_session_state *session)
+{
+    setlocale(LC_ALL, "");
+    initscr();
+    cbreak();
+    nodelay(stdscr, true);
+    noecho();
+    keypad(stdscr, true);
+
+    if (session->decoder_state.map_char == NULL) {
+        session->decoder_state.map_char = &bed_map_char;
+    }
+
+    if (session->direct) {
+        //  getch() refreshes stdscr when it's been touched. Do it now so that it
+        //  never clears what we've drawn
+        refresh();
+        session->decoder_state.win = NULL;
+        vt_vtout_init(&session->vtout_state, STDOUT_FILENO);
+    }
+    else {
+        session->decoder_state.win = stdscr;
+    }
+
+    vt_decoder_init(&session->decoder_state);
+    vt_render(session);
+}
+
+static void
+vt_render(struct vt_session_state *session)
+{
+    if (session->direct) {
+        vt_vtout_flush(&session->vtout_state, &session->decoder_state);
+    }
+
+    vt_shm_publish(&session->shm_state, &session->decoder_state);
+}
+
+/*
+Keep each frame from the host as the next one replaces it
+*/
+static void
+vt_record_frame(struct vt_decoder_state *state, int length)
+{
+    char page[PAGE_NUMBER_MAX] = {0};
+
+    vt_decoder_get_page_number(state, page, PAGE_NUMBER_MAX);
+    vt_history_add(&session.history, state->frame_buffer, length, page, time(NULL));
+}
+
+/*
+Show the frame before (or after) the one showing. Stepping forward past the
+newest returns to the host's frame
+*/
+static void
+vt_show_history(struct vt_session_state *session, bool is_older)
+{
+    struct vt_history_entry *entry = session->history_entry;
+
+    if (entry == NULL) {
+        entry = is_older ? session->history.newest : NULL;
+    }
+    else {
+        entry = is_older ? entry->older : entry->newer;
+    }
+
+    if (entry == NULL) {
+        if (is_older) {
+            beep();
+        }
+        else {
+            vt_leave_history(session, true);
+        }
+        return;
+    }
+
+    if (!vt_show_entry(session, entry)) {
+        return;
+    }
+
+    char timestr[TIMESTR_MAX];
+    strftime(timestr, TIMESTR_MAX, "%H:%M:%S", localtime(&entry->time));
+    vt_status("History: page %s at %s. CTRL-p older, CTRL-n newer", 
+        entry->page[0] != 0 ? entry->page : "?", timestr);
+}
+
+/*
+Draw the frame in entry in place of the host's, which is kept to go back to.
+Returns false if it can't be
+*/
+static bool
+vt_show_entry(struct vt_session_state *session, struct vt_history_entry *entry)
+{
+    struct vt_decoder_state *decoder = &session->decoder_state;
+
+    const uint8_t *frame = vt_history_get(&session->history, entry);
+    if (frame == NULL) {
+        return false;
+    }
+
+    if (session->history_entry == NULL) {
+        session->live_snapshot_length = vt_decoder_snapshot_size(decoder);
+        session->live_snapshot = malloc(session->live_snapshot_length);
+
+        if (session->live_snapshot == NULL 
+            || vt_decoder_snapshot(decoder, session->live_snapshot, session->live_snapshot_length) == 0) {
+            log_err();
+            free(session->live_snapshot);
+            session->live_snapshot = NULL;
+            return false;
+        }
+    }
+
+    //  Not a frame from the host, so not one to keep
+    uint8_t ff = 12;
+    decoder->frame_end = NULL;
+    vt_decoder_decode(decoder, &ff, 1);
+    vt_decoder_decode(decoder, (uint8_t *)frame, entry->length);
+    decoder->frame_end = vt_record_frame;
+    session->history_entry = entry;
+    vt_render(session);
+
+    return true;
+}
+
+/*
+Back to the host's frame, if a frame from history is showing. Not rendered, 
+with vtout, unless is_rendered, for when more from the host is about to be
+*/
+static void
+vt_leave_history(struct vt_session_state *session, bool is_rendered)
+{
+    if (session->history_entry == NULL) {
+        return;
+    }
+
+    if (vt_decoder_restore(&session->decoder_state, session->live_snapshot, 
+        session->live_snapshot_length) != EXIT_SUCCESS) {
+        log_err();
+    }
+
+    free(session->live_snapshot);
+    session->live_snapshot = NULL;
+    session->history_entry = NULL;
+
+    if (is_rendered) {
+        vt_render(session);
+    }
+
+    vt_status("%s", "");
+}
+
+/*
+Keys typed at a *page_ prompt are drawn straight away, underlined, and left to
+the decoder to match against the host's echo. Anything else typed there takes
+the predictions back, as the host may not echo it
+*/
+static void
+vt_predict(struct vt_session_state *session, int ch)
+{
+    struct vt_decoder_state *decoder = &session->decoder_state;
+
+    if (!session->predict || (ch != '*' && !session->is_predicting)) {
+        return;
+    }
+
+    if (ch == '_') {
+        //  The host decides what happens next
+        session->is_predicting = false;
+        return;
+    }
+
+    if (ch != '*' && !isalnum(ch)) {
+        session->is_predicting = false;
+        vt_decoder_cancel_predictions(decoder);
+        vt_render(session);
+        return;
+    }
+
+    session->is_predicting = vt_decoder_predict(decoder, ch);
+
+    if (session->is_predicting) {
+        session->prediction_ms = vt_net_now_ms();
+        vt_render(session);
+    }
+}
+
+/*
+A route key, typed anywhere but at a *page_ prompt. If it has been pressed on
+this page before and the page it led to is in history, that is shown until the
+host sends it. Keys typed before the host has answered the last are taken to be
+on the page the last is expected to lead to
+*/
+static void
+vt_route(struct vt_session_state *session, int ch)
+{
+    struct vt_decoder_state *decoder = &session->decoder_state;
+    char page[PAGE_NUMBER_MAX] = {0};
+
+    if (!session->instant) {
+        return;
+    }
+
+    if (ch == '*') {
+        session->is_page_entry = true;
+        session->route_key = 0;
+        return;
+    }
+
+    if (session->is_page_entry) {
+        session->is_page_entry = ch != '_';
+        return;
+    }
+
+    session->route_key = 0;
+
+    if (!isalnum(ch)) {
+        return;
+    }
+
+    if (session->instant_page[0] != 0 && !session->is_instant_answered) {
+        snprintf(page, PAGE_NUMBER_MAX, "%s", session->instant_page);
+    }
+    else {
+        vt_decoder_get_page_number(decoder, page, PAGE_NUMBER_MAX);
+    }
+
+    if (page[0] == 0) {
+        return;
+    }
+
+    snprintf(session->route_page, PAGE_NUMBER_MAX, "%s", page);
+    session->route_key = ch;
+
+    const char *to = vt_route_find(&session->routes, page, ch);
+    struct vt_history_entry *entry = to != NULL ? vt_history_find(&session->history, to) : NULL;
+
+    if (entry == NULL || !vt_show_entry(session, entry)) {
+        session->instant_page[0] = 0;
+        return;
+    }
+
+    vt_trace(session, "instant %s from %s key %c\n", entry->page, page, ch);
+    snprintf(session->instant_page, PAGE_NUMBER_MAX, "%s", entry->page);
+    memcpy(session->instant_cells, decoder->cells, sizeof(session->instant_cells));
+    session->is_instant_answered = false;
+    vt_status("Page %s as last seen, until the host sends it", entry->page);
+}
+
+/*
+Called once the host's bytes have been decoded. Learns where the last route
+key led, once the host shows a page other than the one it was pressed on
+*/
+static void
+vt_route_read(struct vt_session_state *session)
+{
+    if (!session->instant) {
+        return;
+    }
+
+    if (session->route_key != 0 && session->last_page[0] != 0
+        && strcmp(session->last_page, session->route_page) != 0) {
+        vt_route_learn(&session->routes, session->route_page, session->route_key, session->last_page);
+        session->route_key = 0;
+    }
+
+    if (session->instant_page[0] != 0) {
+        session->is_instant_answered = true;
+        session->instant_ms = vt_net_now_ms();
+    }
+}
+
+/*
+The host has sent the page shown from history and gone quiet. Flash the screen
+if it has changed since. The header row is left out, as it often has the time
+*/
+static void
+vt_instant_check(struct vt_session_state *session)
+{
+    struct vt_decoder_state *decoder = &session->decoder_state;
+    char page[PAGE_NUMBER_MAX] = {0};
+
+    if (session->history_entry != NULL) {
+        //  Looking back through history. There's nothing to compare
+        session->instant_page[0] = 0;
+        return;
+    }
+
+    vt_decoder_get_page_number(decoder, page, PAGE_NUMBER_MAX);
+
+    if (strcmp(page, session->instant_page) != 0
+        || memcmp(decoder->cells[1], session->instant_cells[1], 
+            sizeof(session->instant_cells) - sizeof(session->instant_cells[0])) != 0) {
+        vt_trace(session, "instant %s changed\n", session->instant_page);
+        flash();
+        vt_status("Page %s has changed since it was last seen", page[0] != 0 ? page : "?");
+    }
+    else {
+        vt_status("%s", "");
+    }
+
+    session->instant_page[0] = 0;
+}
+
+/*
+Write a message below the frame, if the terminal has room for it
+*/
+static void
+vt_status(char *format, ...)
+{
+    if (LINES <= MAX_ROWS) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    move(MAX_ROWS, 0);
+    clrtoeol();
+    vw_printw(stdscr, format, args);
+    va_end(args);
+    refresh();
+}
+
 static bool 
 vt_is_valid_fd(int fd)
 {
@@ -640,16 +2147,41 @@ vt_usage(void)
 {
     printf("Version: %s\n", version);
     printf("Usage: vidtex [options]\nOptions:\n");
+    printf("%-16s\tSave frames to this archive\n", "--archive file");
+    printf("%-16s\tWith --file and an archive, show the frame as it was then\n", "--at time");
     printf("%-16s\tOutput bold brighter colours\n", "--bold");
+    printf("%-16s\tDraw directly with VT100 sequences, not curses\n", "--direct");
     printf("%-16s\tDump all bytes read from host to file\n", "--dump filename");
     printf("%-16s\tLoad and display a saved frame\n", "--file filename");
     printf("%-16s\tOutput char codes for Mode7 font\n", "--galax");
+    printf("%-16s\tRemove frames no save refers to from --store\n", "--gc");
     printf("%-16s\tShow this help\n", "--help");
+    printf("%-16s\tKeep this many KB of earlier frames for CTRL-p\n", "--history kb");
     printf("%-16s\tViewdata service host\n", "--host name");
+    printf("%-16s\tBuild the full text index for --archive\n", "--index");
+    printf("%-16s\tShow the page a key led to before from history at once\n", "--instant");
+    printf("%-16s\tRead the host on a separate thread\n", "--io-thread");
+    printf("%-16s\tSend keepalives after this many idle seconds\n", "--keepalive secs");
+    printf("%-16s\tTime responses to keys and append them to file\n", "--latency file");
     printf("%-16s\tCreate menu from vidtexrc\n", "--menu");
     printf("%-16s\tMonochrome display\n", "--mono");
+    printf("%-16s\tWith --file or --t42, the page to show\n", "--page number");
     printf("%-16s\tViewdata service host port\n", "--port number");
+    printf("%-16s\tWith --menu, connect to every host while the menu is shown\n", "--preconnect");
+    printf("%-16s\tShow page numbers as they're typed, before the host echoes them\n", "--predict");
+    printf("%-16s\tTime connections to every vidtexrc host, fastest first\n", "--probe[=csv]");
+    printf("%-16s\tMaximum bytes per second sent to the host\n", "--rate cps");
+    printf("%-16s\tReconnect automatically if the connection drops\n", "--reconnect");
+    printf("%-16s\tStep through a --dump file\n", "--replay filename");
+    printf("%-16s\tList frames in --archive containing text\n", "--search text");
+    printf("%-16s\tPublish the screen in shared memory, for libvtscreen\n", "--shm name");
+    printf("%-16s\tSplit a --dump file into frames in --archive\n", "--split filename");
+    printf("%-16s\tWrite session counters as JSON at exit and on SIGUSR1\n", "--stats file");
+    printf("%-16s\tServe session counters as JSON on a Unix socket\n", "--stats-socket path");
+    printf("%-16s\tSave each distinct frame once, in this directory\n", "--store dir");
+    printf("%-16s\tShow teletext pages from a t42 capture\n", "--t42 filename");
     printf("%-16s\tWrite trace to file\n", "--trace filename");
+    printf("%-16s\tVisit the pages listed in file on a schedule, reporting changes\n", "--watch file");
     printf("%-16s\tPrint the version number\n", "--version");
 }
 
@@ -681,6 +2213,12 @@ void vt_save(struct vt_session_state *session)
     bool have_hostname = session->selected_rc != NULL && session->selected_rc->name != NULL;
 
     time(&ticks);
+
+    if (session->archive_path != NULL) {
+        vt_save_archived(session, ticks);
+        return;
+    }
+
     localt = localtime(&ticks);
     strftime(timestr, TIMESTR_MAX, "%Y%m%d%H%M%S", localt);
 
@@ -690,11 +2228,49 @@ void vt_save(struct vt_session_state *session)
         have_hostname ? "_" : "",
         timestr);
 
+    if (session->store_path != NULL) {
+        if (vt_store_save(session->store_path, session->decoder_state.frame_buffer, 
+            session->decoder_state.frame_buffer_offset, filename) != EXIT_SUCCESS) {
+            vt_status("Frame not saved to %s", filename);
+        }
+
+        return;
+    }
+
     if ((fout = fopen(filename, "w")) == NULL) {
         log_err();
+        vt_status("Frame not saved to %s", filename);
         return;
     }
 
     vt_decoder_save(&session->decoder_state, fout);
     fclose(fout);
 }
+
+static void
+vt_save_archived(struct vt_session_state *session, time_t ticks)
+{
+    struct vt_archive archive;
+    char page[PAGE_NUMBER_MAX] = {0};
+    const char *service = session->selected_rc != NULL && session->selected_rc->name != NULL
+        ? session->selected_rc->name : session->host;
+
+    if (session->decoder_state.frame_buffer_offset == 0) {
+        return;
+    }
+
+    vt_decoder_get_page_number(&session->decoder_state, page, PAGE_NUMBER_MAX);
+
+    if (vt_archive_open(&archive, session->archive_path) != EXIT_SUCCESS) {
+        vt_status("Frame not saved to %s", session->archive_path);
+        return;
+    }
+
+    int rv = vt_archive_append(&archive, service, page, ticks, 
+        session->decoder_state.frame_buffer, session->decoder_state.frame_buffer_offset);
+
+    //  The index is written on close, so the frame isn't there until that succeeds
+    if (vt_archive_close(&archive) != EXIT_SUCCESS || rv != EXIT_SUCCESS) {
+        vt_status("Frame not saved to %s", session->archive_path);
+    }
+}
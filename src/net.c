@@ -0,0 +1,102 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "net.h"
+
+long
+vt_net_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/*
+Returns 0 or a getaddrinfo error code (see gai_strerror)
+*/
+int
+vt_net_resolve(const char *host, const char *port, struct addrinfo **result)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = 0;
+    hints.ai_protocol = 0;
+
+    return getaddrinfo(host, port, &hints, result);
+}
+
+/*
+Connect, giving up at deadline_ms (see vt_net_now_ms). Returns a blocking socket
+or -1 with errno set
+*/
+int
+vt_net_connect(struct addrinfo *addr, long deadline_ms)
+{
+    int fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol);
+    int err = 0;
+
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (connect(fd, addr->ai_addr, addr->ai_addrlen) == -1 && errno != EINPROGRESS) {
+        goto abend;
+    }
+
+    struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+    int prv;
+
+    do {
+        long timeout = deadline_ms - vt_net_now_ms();
+        prv = timeout > 0 ? poll(&pfd, 1, timeout) : 0;
+    } while (prv == -1 && errno == EINTR);
+
+    if (prv == 0) {
+        errno = ETIMEDOUT;
+        goto abend;
+    }
+
+    socklen_t len = sizeof(err);
+
+    if (prv == -1 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+        goto abend;
+    }
+
+    if (err != 0) {
+        errno = err;
+        goto abend;
+    }
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+        goto abend;
+    }
+
+    return fd;
+abend:
+    err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+/*
+Try each address in turn
+*/
+int
+vt_net_connect_any(struct addrinfo *result, long deadline_ms)
+{
+    int fd = -1;
+
+    for (struct addrinfo *rp = result; rp != NULL && fd == -1; rp = rp->ai_next) {
+        fd = vt_net_connect(rp, deadline_ms);
+    }
+
+    return fd;
+}
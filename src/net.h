@@ -0,0 +1,13 @@
+#ifndef NET_H
+#define NET_H
+
+#include <netdb.h>
+
+#define NET_CONNECT_TIMEOUT_MS  (30000)
+
+long vt_net_now_ms(void);
+int vt_net_resolve(const char *host, const char *port, struct addrinfo **result);
+int vt_net_connect(struct addrinfo *addr, long deadline_ms);
+int vt_net_connect_any(struct addrinfo *result, long deadline_ms);
+
+#endif
@@ -0,0 +1,234 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "prefetch.h"
+#include "net.h"
+#include "log.h"
+
+static void *vt_prefetch_entry(void *arg);
+static struct vt_prefetch_entry *vt_wait_for(struct vt_prefetch_state *state, struct vt_rc_entry *rc);
+static bool vt_is_stale(int fd);
+static void vt_free_entry(struct vt_prefetch_entry *entry);
+
+/*
+Resolve, and optionally connect to, every host in the menu in the background while
+the user is reading it. Results nobody takes are discarded by vt_prefetch_stop
+*/
+int
+vt_prefetch_start(struct vt_prefetch_state *state, struct vt_rc_state *rc_state, bool preconnect)
+{
+    memset(state, 0, sizeof(struct vt_prefetch_state));
+
+    if (rc_state->rc_data_count < 1) {
+        return EXIT_SUCCESS;
+    }
+
+    state->entries = calloc(rc_state->rc_data_count, sizeof(struct vt_prefetch_entry *));
+    if (state->entries == NULL) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    pthread_mutex_init(&state->lock, NULL);
+    pthread_cond_init(&state->done, NULL);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (int i = 0; i < rc_state->rc_data_count; ++i) {
+        struct vt_prefetch_entry *entry = calloc(1, sizeof(struct vt_prefetch_entry));
+        if (entry == NULL) {
+            log_err();
+            break;
+        }
+
+        entry->rc = rc_state->rc_data[i];
+        entry->preconnect = preconnect;
+        entry->socket_fd = -1;
+        entry->lock = &state->lock;
+        entry->done = &state->done;
+
+        pthread_t thread;
+        if ((errno = pthread_create(&thread, &attr, vt_prefetch_entry, entry)) != 0) {
+            log_err();
+            free(entry);
+            break;
+        }
+
+        state->entries[state->count++] = entry;
+    }
+
+    pthread_attr_destroy(&attr);
+    return EXIT_SUCCESS;
+}
+
+/*
+Returns a connected socket for rc, or -1 if there isn't one or the host has
+since closed it
+*/
+int
+vt_prefetch_take_socket(struct vt_prefetch_state *state, struct vt_rc_entry *rc)
+{
+    struct vt_prefetch_entry *entry = vt_wait_for(state, rc);
+    int fd = -1;
+
+    if (entry != NULL) {
+        fd = entry->socket_fd;
+        entry->socket_fd = -1;
+        pthread_mutex_unlock(&state->lock);
+    }
+
+    if (fd > -1 && vt_is_stale(fd)) {
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+/*
+Returns the resolved addresses for rc, or NULL. The caller must freeaddrinfo them
+*/
+struct addrinfo *
+vt_prefetch_take_addr(struct vt_prefetch_state *state, struct vt_rc_entry *rc)
+{
+    struct vt_prefetch_entry *entry = vt_wait_for(state, rc);
+    struct addrinfo *addr = NULL;
+
+    if (entry != NULL) {
+        addr = entry->addr;
+        entry->addr = NULL;
+        pthread_mutex_unlock(&state->lock);
+    }
+
+    return addr;
+}
+
+void
+vt_prefetch_stop(struct vt_prefetch_state *state)
+{
+    if (state->count == 0) {
+        free(state->entries);
+        state->entries = NULL;
+        return;
+    }
+
+    pthread_mutex_lock(&state->lock);
+
+    for (int i = 0; i < state->count; ++i) {
+        struct vt_prefetch_entry *entry = state->entries[i];
+
+        if (entry->is_done) {
+            vt_free_entry(entry);
+        }
+        else {
+            entry->is_abandoned = true;
+        }
+    }
+
+    pthread_mutex_unlock(&state->lock);
+
+    //  Workers still running reference the lock, so it isn't destroyed
+    free(state->entries);
+    state->entries = NULL;
+    state->count = 0;
+}
+
+static void *
+vt_prefetch_entry(void *arg)
+{
+    struct vt_prefetch_entry *entry = arg;
+    struct addrinfo *addr = NULL;
+    int fd = -1;
+
+    if (vt_net_resolve(entry->rc->host, entry->rc->port, &addr) != 0) {
+        addr = NULL;
+    }
+    else if (entry->preconnect) {
+        fd = vt_net_connect_any(addr, vt_net_now_ms() + NET_CONNECT_TIMEOUT_MS);
+    }
+
+    pthread_mutex_lock(entry->lock);
+    entry->addr = addr;
+    entry->socket_fd = fd;
+
+    if (entry->is_abandoned) {
+        pthread_mutex_unlock(entry->lock);
+        vt_free_entry(entry);
+        return NULL;
+    }
+
+    entry->is_done = true;
+    pthread_cond_broadcast(entry->done);
+    pthread_mutex_unlock(entry->lock);
+    return NULL;
+}
+
+/*
+Returns with the lock held if the entry is found
+*/
+static struct vt_prefetch_entry *
+vt_wait_for(struct vt_prefetch_state *state, struct vt_rc_entry *rc)
+{
+    if (state->count == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&state->lock);
+
+    for (int i = 0; i < state->count; ++i) {
+        struct vt_prefetch_entry *entry = state->entries[i];
+
+        if (entry->rc == rc) {
+            while (!entry->is_done) {
+                pthread_cond_wait(&state->done, &state->lock);
+            }
+
+            return entry;
+        }
+    }
+
+    pthread_mutex_unlock(&state->lock);
+    return NULL;
+}
+
+/*
+Idle connections may have been dropped while the menu was shown. Any data the 
+host sent unprompted is left for the caller
+*/
+static bool
+vt_is_stale(int fd)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+    if (poll(&pfd, 1, 0) < 1) {
+        return false;
+    }
+
+    if (pfd.revents & (POLLERR | POLLNVAL)) {
+        return true;
+    }
+
+    uint8_t b;
+    ssize_t n = recv(fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    return n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+static void
+vt_free_entry(struct vt_prefetch_entry *entry)
+{
+    if (entry->addr != NULL) {
+        freeaddrinfo(entry->addr);
+    }
+
+    if (entry->socket_fd > -1) {
+        close(entry->socket_fd);
+    }
+
+    free(entry);
+}
@@ -0,0 +1,37 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <netdb.h>
+#include "rc.h"
+
+struct vt_prefetch_entry
+{
+    struct vt_rc_entry *rc;
+    bool preconnect;
+    //  Results. Owned by the worker until is_done is set
+    struct addrinfo *addr;
+    int socket_fd;
+    bool is_done;
+    //  Set when nobody wants the results. The worker frees the entry when it finishes
+    bool is_abandoned;
+    pthread_mutex_t *lock;
+    pthread_cond_t *done;
+};
+
+struct vt_prefetch_state
+{
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    struct vt_prefetch_entry **entries;
+    int count;
+};
+
+int vt_prefetch_start(struct vt_prefetch_state *state, struct vt_rc_state *rc_state, bool preconnect);
+int vt_prefetch_take_socket(struct vt_prefetch_state *state, struct vt_rc_entry *rc);
+struct addrinfo *vt_prefetch_take_addr(struct vt_prefetch_state *state, struct vt_rc_entry *rc);
+void vt_prefetch_stop(struct vt_prefetch_state *state);
+
+#endif
@@ -0,0 +1,446 @@
+#include <errno.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "probe.h"
+#include "bedstead.h"
+#include "evloop.h"
+#include "net.h"
+#include "log.h"
+
+static void *vt_probe_resolve(void *arg);
+static void vt_probe_connect(struct vt_evloop *loop, struct vt_probe_session *session);
+static void vt_probe_connected(struct vt_evloop *loop, struct vt_probe_session *session, int revents);
+static void vt_probe_data(struct vt_evloop *loop, struct vt_probe_session *session,
+    uint8_t *buffer, int nread);
+static void vt_probe_finish(struct vt_evloop *loop, struct vt_probe_session *session, const char *error);
+static long vt_probe_next_timeout(struct vt_evloop *loop, struct vt_probe_session *sessions, int count, 
+    long now);
+static void vt_probe_error(struct vt_probe_result *result, const char *error);
+static int vt_compare_results(const void *a, const void *b);
+static void vt_print_ms(long ms, int width);
+
+/*
+Probe every configured service at once and print the results, fastest first
+*/
+int
+vt_probe_run(struct vt_rc_state *rc_state, enum vt_probe_format format)
+{
+    int count = rc_state->rc_data_count;
+    int rv = EXIT_FAILURE;
+    struct vt_evloop loop;
+    bool is_loop_open = false;
+
+    if (count < 1) {
+        fprintf(stderr, "No configuration found\n");
+        return EXIT_FAILURE;
+    }
+
+    struct vt_probe_result *results = calloc(count, sizeof(struct vt_probe_result));
+    struct vt_probe_session *sessions = calloc(count, sizeof(struct vt_probe_session));
+    pthread_t *threads = calloc(count, sizeof(pthread_t));
+    //  pthread_t is opaque, so there's no value meaning not started
+    bool *is_started = calloc(count, sizeof(bool));
+    struct vt_evloop_event *events = malloc(EVLOOP_QUEUE_DEPTH * sizeof(struct vt_evloop_event));
+
+    if (results == NULL || sessions == NULL || threads == NULL || is_started == NULL || events == NULL) {
+        log_err();
+        goto cleanup;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        results[i].entry = rc_state->rc_data[i];
+        results[i].dns_ms = results[i].connect_ms = results[i].first_byte_ms = -1;
+        results[i].frame_ms = results[i].total_ms = -1;
+        sessions[i].result = &results[i];
+        sessions[i].stage = PROBE_DONE;
+        sessions[i].fd = -1;
+        sessions[i].slot = -1;
+
+        if ((errno = pthread_create(&threads[i], NULL, vt_probe_resolve, &sessions[i])) != 0) {
+            log_err();
+            vt_probe_error(&results[i], "thread");
+        }
+        else {
+            is_started[i] = true;
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (is_started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    if (vt_evloop_init(&loop, count, true) != EXIT_SUCCESS) {
+        goto cleanup;
+    }
+
+    is_loop_open = true;
+
+    for (int i = 0; i < count; ++i) {
+        if (sessions[i].addr != NULL) {
+            vt_probe_connect(&loop, &sessions[i]);
+        }
+    }
+
+    while (true) {
+        long now = vt_net_now_ms();
+        long timeout = vt_probe_next_timeout(&loop, sessions, count, now);
+
+        if (timeout == -1) {
+            break;
+        }
+
+        int nevents = vt_evloop_wait(&loop, events, EVLOOP_QUEUE_DEPTH, timeout);
+
+        if (nevents == -1) {
+            goto cleanup;
+        }
+
+        for (int i = 0; i < nevents; ++i) {
+            struct vt_probe_session *session = events[i].user;
+
+            //  Finished by an earlier event
+            if (session->slot != events[i].slot) {
+                continue;
+            }
+
+            if (events[i].type == EVLOOP_POLL) {
+                vt_probe_connected(&loop, session, events[i].result);
+            }
+            else {
+                vt_probe_data(&loop, session, events[i].data, events[i].result);
+            }
+        }
+    }
+
+    qsort(results, count, sizeof(struct vt_probe_result), vt_compare_results);
+
+    if (format == PROBE_CSV) {
+        printf("name,host,port,dns_ms,connect_ms,first_byte_ms,frame_ms,total_ms,bytes,page,error\n");
+
+        for (int i = 0; i < count; ++i) {
+            struct vt_probe_result *r = &results[i];
+            printf("%s,%s,%s,%ld,%ld,%ld,%ld,%ld,%ld,%s,%s\n",
+                r->entry->name, r->entry->host, r->entry->port,
+                r->dns_ms, r->connect_ms, r->first_byte_ms, r->frame_ms, r->total_ms,
+                r->bytes, r->page, r->error);
+        }
+    }
+    else {
+        printf("%-20s %8s %8s %8s %8s %8s %7s %-6s %s\n",
+            "Name", "DNS", "Connect", "1st byte", "Frame", "Total", "Bytes", "Page", "Status");
+
+        for (int i = 0; i < count; ++i) {
+            struct vt_probe_result *r = &results[i];
+            printf("%-20s", r->entry->name);
+            vt_print_ms(r->dns_ms, 8);
+            vt_print_ms(r->connect_ms, 8);
+            vt_print_ms(r->first_byte_ms, 8);
+            vt_print_ms(r->frame_ms, 8);
+            vt_print_ms(r->total_ms, 8);
+            printf(" %7ld %-6s %s\n", r->bytes, r->page[0] != 0 ? r->page : "-",
+                r->error[0] != 0 ? r->error : "ok");
+        }
+    }
+
+    rv = EXIT_SUCCESS;
+cleanup:
+    for (int i = 0; sessions != NULL && i < count; ++i) {
+        if (sessions[i].stage != PROBE_DONE) {
+            vt_probe_finish(&loop, &sessions[i], NULL);
+        }
+
+        if (sessions[i].addr != NULL) {
+            freeaddrinfo(sessions[i].addr);
+        }
+    }
+
+    if (is_loop_open) {
+        vt_evloop_free(&loop);
+    }
+
+    free(results);
+    free(sessions);
+    free(threads);
+    free(is_started);
+    free(events);
+    return rv;
+}
+
+/*
+getaddrinfo blocks, so each host is looked up on a thread of its own
+*/
+static void *
+vt_probe_resolve(void *arg)
+{
+    struct vt_probe_session *session = arg;
+    struct vt_probe_result *result = session->result;
+    long start = vt_net_now_ms();
+    int rv = vt_net_resolve(result->entry->host, result->entry->port, &session->addr);
+
+    if (rv != 0) {
+        session->addr = NULL;
+        vt_probe_error(result, gai_strerror(rv));
+        return NULL;
+    }
+
+    result->dns_ms = vt_net_now_ms() - start;
+    return NULL;
+}
+
+/*
+Start connecting to the session's next address. Completes in vt_probe_connected.
+The time allowed is what the lookup left of PROBE_TIMEOUT_MS
+*/
+static void
+vt_probe_connect(struct vt_evloop *loop, struct vt_probe_session *session)
+{
+    if (session->stage == PROBE_DONE) {
+        session->next_addr = session->addr;
+        session->connect_start = vt_net_now_ms();
+        session->deadline = session->connect_start + PROBE_TIMEOUT_MS - session->result->dns_ms;
+        session->stage = PROBE_CONNECTING;
+    }
+
+    for (; session->next_addr != NULL; session->next_addr = session->next_addr->ai_next) {
+        struct addrinfo *addr = session->next_addr;
+
+        session->fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol);
+
+        if (session->fd == -1) {
+            continue;
+        }
+
+        if (connect(session->fd, addr->ai_addr, addr->ai_addrlen) == -1 && errno != EINPROGRESS) {
+            close(session->fd);
+            session->fd = -1;
+            continue;
+        }
+
+        session->slot = vt_evloop_add(loop, session->fd, session);
+
+        if (session->slot == -1 || vt_evloop_poll(loop, session->slot, POLLOUT) != EXIT_SUCCESS) {
+            vt_probe_finish(loop, session, strerror(errno));
+        }
+
+        return;
+    }
+
+    vt_probe_finish(loop, session, errno != 0 ? strerror(errno) : "connect");
+}
+
+static void
+vt_probe_connected(struct vt_evloop *loop, struct vt_probe_session *session, int revents)
+{
+    struct vt_probe_result *result = session->result;
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if (revents < 0) {
+        err = -revents;
+    }
+    else if (getsockopt(session->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+        err = errno;
+    }
+
+    if (err != 0) {
+        //  On to the next address
+        vt_evloop_remove(loop, session->slot);
+        close(session->fd);
+        session->fd = session->slot = -1;
+        session->next_addr = session->next_addr->ai_next;
+        errno = err;
+        vt_probe_connect(loop, session);
+        return;
+    }
+
+    session->connected = vt_net_now_ms();
+    result->connect_ms = session->connected - session->connect_start;
+
+    uint8_t preamble[PREAMBLE_MAX];
+    int preamble_len = vt_rc_get_preamble(result->entry, preamble);
+    vt_telnet_reset(&session->telnet_state);
+    vt_telnet_note_sent(&session->telnet_state, preamble, preamble_len);
+
+    int nodelay = 1;
+    setsockopt(session->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    if (write(session->fd, preamble, preamble_len) != preamble_len) {
+        vt_probe_finish(loop, session, "preamble");
+        return;
+    }
+
+    session->decoder = calloc(1, sizeof(struct vt_decoder_state));
+
+    if (session->decoder == NULL) {
+        log_err();
+        vt_probe_finish(loop, session, "memory");
+        return;
+    }
+
+    session->decoder->map_char = &bed_map_char;
+    vt_decoder_init(session->decoder);
+    session->stage = PROBE_READING;
+
+    if (vt_evloop_read(loop, session->slot) != EXIT_SUCCESS) {
+        vt_probe_finish(loop, session, "read");
+    }
+}
+
+static void
+vt_probe_data(struct vt_evloop *loop, struct vt_probe_session *session, uint8_t *buffer, int nread)
+{
+    struct vt_probe_result *result = session->result;
+
+    //  Filtered in place, then decoded from the loop's buffer
+    if (nread > 0) {
+        nread = vt_telnet_filter(&session->telnet_state, buffer, nread, session->fd);
+    }
+    else {
+        nread = -1;
+    }
+
+    if (nread == -1) {
+        vt_probe_finish(loop, session, session->last_read == 0 ? "closed by host" : NULL);
+        return;
+    }
+
+    //  Otherwise it was all telnet negotiation
+    if (nread > 0) {
+        session->last_read = vt_net_now_ms();
+        result->bytes += nread;
+
+        if (result->first_byte_ms == -1) {
+            result->first_byte_ms = session->last_read - session->connected;
+        }
+
+        vt_decoder_decode(session->decoder, buffer, nread);
+    }
+
+    if (vt_evloop_read(loop, session->slot) != EXIT_SUCCESS) {
+        vt_probe_finish(loop, session, NULL);
+    }
+}
+
+/*
+Record the result and log off. error is NULL if the session ended normally
+*/
+static void
+vt_probe_finish(struct vt_evloop *loop, struct vt_probe_session *session, const char *error)
+{
+    struct vt_probe_result *result = session->result;
+
+    if (error != NULL) {
+        vt_probe_error(result, error);
+    }
+
+    if (session->last_read > 0) {
+        result->frame_ms = session->last_read - session->connected;
+        //  The lookup and the rest were timed separately
+        result->total_ms = result->dns_ms + session->last_read - session->connect_start;
+    }
+
+    if (session->decoder != NULL) {
+        vt_decoder_get_page_number(session->decoder, result->page, PAGE_NUMBER_MAX);
+        vt_decoder_free(session->decoder);
+        free(session->decoder);
+        session->decoder = NULL;
+    }
+
+    if (session->slot != -1) {
+        vt_evloop_remove(loop, session->slot);
+        session->slot = -1;
+    }
+
+    if (session->fd != -1) {
+        if (session->stage == PROBE_READING && result->entry->postamble_length > 0) {
+            //  Log off politely. Failure doesn't matter
+            if (write(session->fd, result->entry->postamble, result->entry->postamble_length) == -1) {
+                errno = 0;
+            }
+        }
+
+        close(session->fd);
+        session->fd = -1;
+    }
+
+    session->stage = PROBE_DONE;
+}
+
+/*
+Finish the sessions that have run out of time. Returns how long until the next
+one does, or -1 if there are none left
+*/
+static long
+vt_probe_next_timeout(struct vt_evloop *loop, struct vt_probe_session *sessions, int count, long now)
+{
+    long timeout = -1;
+
+    for (int i = 0; i < count; ++i) {
+        struct vt_probe_session *session = &sessions[i];
+
+        if (session->stage == PROBE_DONE) {
+            continue;
+        }
+
+        long due = session->deadline;
+
+        if (session->stage == PROBE_READING && session->last_read > 0
+            && session->last_read + PROBE_IDLE_MS < due) {
+            due = session->last_read + PROBE_IDLE_MS;
+        }
+
+        if (due <= now) {
+            const char *error = session->stage == PROBE_CONNECTING ? "connect timeout"
+                : session->last_read == 0 ? "no data" : NULL;
+            vt_probe_finish(loop, session, error);
+            continue;
+        }
+
+        if (timeout == -1 || due - now < timeout) {
+            timeout = due - now;
+        }
+    }
+
+    return timeout;
+}
+
+static void
+vt_probe_error(struct vt_probe_result *result, const char *error)
+{
+    snprintf(result->error, PROBE_ERROR_MAX, "%s", error);
+}
+
+/*
+Fastest complete frame first. Failures go to the end
+*/
+static int
+vt_compare_results(const void *a, const void *b)
+{
+    const struct vt_probe_result *ra = a;
+    const struct vt_probe_result *rb = b;
+    long ta = ra->total_ms == -1 ? LONG_MAX : ra->total_ms;
+    long tb = rb->total_ms == -1 ? LONG_MAX : rb->total_ms;
+
+    return (ta > tb) - (ta < tb);
+}
+
+static void
+vt_print_ms(long ms, int width)
+{
+    if (ms < 0) {
+        printf(" %*s", width, "-");
+    }
+    else {
+        printf(" %*ld", width, ms);
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netdb.h>
+#include "decoder.h"
+#include "telnet.h"
+#include "rc.h"
+
+#define PROBE_TIMEOUT_MS    (10000)
+//  The first frame is complete when the host has been quiet for this long
+#define PROBE_IDLE_MS       (500)
+#define PROBE_ERROR_MAX     (64)
+
+enum vt_probe_format
+{
+    PROBE_TABLE,
+    PROBE_CSV
+};
+
+struct vt_probe_result
+{
+    struct vt_rc_entry *entry;
+    //  Duration of each stage in milliseconds. -1 if the stage wasn't reached.
+    //  first_byte_ms and frame_ms are measured from when the preamble was sent
+    long dns_ms;
+    long connect_ms;
+    long first_byte_ms;
+    long frame_ms;
+    long total_ms;
+    long bytes;
+    //  From the header row of the first frame, if it has one
+    char page[PAGE_NUMBER_MAX];
+    char error[PROBE_ERROR_MAX];
+};
+
+enum vt_probe_stage
+{
+    PROBE_CONNECTING,
+    PROBE_READING,
+    PROBE_DONE
+};
+
+/*
+A connection being probed. Host names are looked up on threads of their own;
+everything after that happens for every host at once on one event loop
+*/
+struct vt_probe_session
+{
+    struct vt_probe_result *result;
+    enum vt_probe_stage stage;
+    struct addrinfo *addr;
+    //  The address being tried
+    struct addrinfo *next_addr;
+    int fd;
+    //  In the event loop. -1 if not in it
+    int slot;
+    long connect_start;
+    long connected;
+    long deadline;
+    long last_read;
+    struct vt_telnet_state telnet_state;
+    //  Headless. Bytes are decoded straight from the event loop's buffer
+    struct vt_decoder_state *decoder;
+};
+
+int vt_probe_run(struct vt_rc_state *rc_state, enum vt_probe_format format);
+
+#endif
@@ -91,6 +91,23 @@ vt_rc_duplicate_token(char *token)
     return copy;
 }
 
+/*
+The bytes sent on connection. entry may be NULL if the host was given on the command line
+*/
+int
+vt_rc_get_preamble(struct vt_rc_entry *entry, uint8_t buffer[PREAMBLE_MAX])
+{
+    buffer[0] = 22;
+    int len = 1;
+
+    if (entry != NULL) {
+        for (int i = 0; i < entry->preamble_length; ++i) {
+            buffer[len++] = entry->preamble[i];
+        }
+    }
+
+    return len;
+}
 
 struct vt_rc_entry *
 vt_rc_show_menu(struct vt_rc_state *state)
@@ -153,7 +170,7 @@ vt_get_rc(const char *dir, struct vt_rc_entry ***rc_data, int *rc_data_count)
             continue;
         }
 
-        struct vt_rc_entry *entry = malloc(sizeof(struct vt_rc_entry));
+        struct vt_rc_entry *entry = calloc(1, sizeof(struct vt_rc_entry));
         if (entry == NULL) {
             log_err();
             goto abend;
@@ -191,6 +208,9 @@ vt_get_rc(const char *dir, struct vt_rc_entry ***rc_data, int *rc_data_count)
             case 5: // optional
                 entry->postamble_length = vt_scan_array(token, entry->postamble);
                 break;
+            case 6: // optional
+                entry->send_rate = atoi(token);
+                break;
             };
              
             token = strtok(NULL, "\t\n,|");
@@ -3,6 +3,7 @@
 
 #define RCFILE              "vidtexrc"
 #define MAX_AMBLE_LEN       (10)
+#define PREAMBLE_MAX        (MAX_AMBLE_LEN + 1)
 
 struct vt_rc_entry
 {
@@ -13,6 +14,8 @@ struct vt_rc_entry
     int preamble_length;
     uint8_t postamble[MAX_AMBLE_LEN];
     int postamble_length;
+    //  Maximum bytes per second to send. 0 if unlimited
+    int send_rate;
 };
 
 struct vt_rc_state
@@ -30,5 +33,6 @@ int vt_rc_load(struct vt_rc_state *state);
 void vt_rc_free(struct vt_rc_state *state);
 struct vt_rc_entry *vt_rc_show_menu(struct vt_rc_state *state);
 char *vt_rc_duplicate_token(char *token);
+int vt_rc_get_preamble(struct vt_rc_entry *entry, uint8_t buffer[PREAMBLE_MAX]);
 
 #endif
@@ -0,0 +1,186 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "reader.h"
+#include "log.h"
+
+static void *vt_reader_entry(void *arg);
+static void vt_signal(int fd);
+
+int
+vt_reader_start(struct vt_reader *reader, int socket_fd)
+{
+    memset(reader, 0, sizeof(struct vt_reader));
+    reader->socket_fd = socket_fd;
+    reader->wake_fd = -1;
+    atomic_init(&reader->is_full, false);
+    atomic_init(&reader->is_closed, false);
+    atomic_init(&reader->is_stopping, false);
+    atomic_init(&reader->read_calls, 0);
+
+    if (vt_ring_init(&reader->ring, READER_RING_SIZE) != EXIT_SUCCESS) {
+        reader->data_fd = -1;
+        return EXIT_FAILURE;
+    }
+
+    reader->data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    reader->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (reader->data_fd == -1 || reader->wake_fd == -1) {
+        log_err();
+        goto abend;
+    }
+
+    if ((errno = pthread_create(&reader->thread, NULL, vt_reader_entry, reader)) != 0) {
+        log_err();
+        goto abend;
+    }
+
+    reader->is_running = true;
+    return EXIT_SUCCESS;
+abend:
+    vt_reader_stop(reader);
+    return EXIT_FAILURE;
+}
+
+/*
+Consumer side, like read(2) on the socket: the number of bytes taken, 0 once 
+the socket has closed and the ring is empty, or -1 with errno EAGAIN if there's 
+nothing yet
+*/
+int
+vt_reader_read(struct vt_reader *reader, uint8_t *buffer, int len)
+{
+    uint64_t count;
+
+    if (read(reader->data_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        log_err();
+    }
+
+    //  Checked before the ring, as anything written before it was set must be taken first
+    bool is_closed = atomic_load(&reader->is_closed);
+    int nread = vt_ring_read(&reader->ring, buffer, len);
+
+    //  We take at most len a time. Make sure poll comes back for the rest, or
+    //  for the end of the stream
+    if (vt_ring_used(&reader->ring) > 0 || (is_closed && nread > 0)) {
+        vt_signal(reader->data_fd);
+    }
+
+    if (nread > 0 && atomic_exchange(&reader->is_full, false)) {
+        vt_signal(reader->wake_fd);
+    }
+
+    if (nread == 0 && !is_closed) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return nread;
+}
+
+/*
+Wait for the thread and release everything. The socket is left open
+*/
+void
+vt_reader_stop(struct vt_reader *reader)
+{
+    if (reader->is_running) {
+        atomic_store(&reader->is_stopping, true);
+        vt_signal(reader->wake_fd);
+        pthread_join(reader->thread, NULL);
+        reader->is_running = false;
+    }
+
+    if (reader->data_fd > -1) {
+        close(reader->data_fd);
+        reader->data_fd = -1;
+    }
+
+    if (reader->wake_fd > -1) {
+        close(reader->wake_fd);
+        reader->wake_fd = -1;
+    }
+
+    vt_ring_free(&reader->ring);
+}
+
+static void *
+vt_reader_entry(void *arg)
+{
+    struct vt_reader *reader = arg;
+    uint8_t buffer[READER_READ_MAX];
+    struct pollfd poll_data[2] = {
+        {.fd = reader->socket_fd, .events = POLLIN},
+        {.fd = reader->wake_fd, .events = POLLIN}
+    };
+
+    while (!atomic_load(&reader->is_stopping)) {
+        size_t space = vt_ring_space(&reader->ring);
+
+        if (space == 0) {
+            //  Leave the host to TCP flow control until the consumer catches up
+            atomic_store(&reader->is_full, true);
+
+            //  It may have taken the lot before seeing is_full
+            if (vt_ring_space(&reader->ring) == 0) {
+                poll_data[0].fd = -1;
+            }
+        }
+        else {
+            poll_data[0].fd = reader->socket_fd;
+        }
+
+        if (poll(poll_data, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            log_err();
+            break;
+        }
+
+        if (poll_data[1].revents & POLLIN) {
+            uint64_t count;
+            if (read(reader->wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+                log_err();
+            }
+        }
+
+        if (poll_data[0].fd == -1 || !(poll_data[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+
+        ssize_t nread = read(reader->socket_fd, buffer, space < sizeof(buffer) ? space : sizeof(buffer));
+        ++reader->read_calls;
+
+        if (nread == -1 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+
+        if (nread <= 0) {
+            break;
+        }
+
+        //  There's always room: only this thread makes the ring fuller
+        vt_ring_write(&reader->ring, buffer, nread);
+        vt_signal(reader->data_fd);
+    }
+
+    atomic_store(&reader->is_closed, true);
+    vt_signal(reader->data_fd);
+    return NULL;
+}
+
+static void
+vt_signal(int fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        log_err();
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef READER_H
+#define READER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "ring.h"
+
+//  About a minute of a fast host. The host is held off by TCP once it's full
+#define READER_RING_SIZE    (1 << 20)
+#define READER_READ_MAX     (16384)
+
+/*
+Reads a socket on its own thread into a ring, so that the host is read as soon
+as it sends whatever the consumer is doing. data_fd, an eventfd, becomes
+readable when there is data to take or the socket has closed
+*/
+struct vt_reader
+{
+    pthread_t thread;
+    bool is_running;
+    int socket_fd;
+    int data_fd;
+    //  Wakes the thread when the ring has room again, or to stop it
+    int wake_fd;
+    struct vt_ring ring;
+    //  Set by the thread once it's stopped waiting for room in the ring
+    atomic_bool is_full;
+    //  Set by the thread once the socket has closed. Everything before is in the ring
+    atomic_bool is_closed;
+    atomic_bool is_stopping;
+    //  Reads since the consumer last took the count
+    _Atomic uint64_t read_calls;
+};
+
+int vt_reader_start(struct vt_reader *reader, int socket_fd);
+int vt_reader_read(struct vt_reader *reader, uint8_t *buffer, int len);
+void vt_reader_stop(struct vt_reader *reader);
+
+#endif
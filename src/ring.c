@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ring.h"
+#include "log.h"
+
+int
+vt_ring_init(struct vt_ring *ring, size_t size)
+{
+    memset(ring, 0, sizeof(struct vt_ring));
+
+    if (size == 0 || (size & (size - 1)) != 0) {
+        fprintf(stderr, "Ring size must be a power of 2\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((ring->buffer = malloc(size)) == NULL) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    ring->size = size;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return EXIT_SUCCESS;
+}
+
+/*
+Producer only. Copies as much of data as fits and returns how much that was
+*/
+size_t
+vt_ring_write(struct vt_ring *ring, const uint8_t *data, size_t len)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t space = ring->size - (tail - head);
+
+    if (len > space) {
+        len = space;
+    }
+
+    size_t offset = tail & (ring->size - 1);
+    size_t first = ring->size - offset < len ? ring->size - offset : len;
+
+    memcpy(ring->buffer + offset, data, first);
+    memcpy(ring->buffer, data + first, len - first);
+    //  The bytes are visible to the consumer before the new tail is
+    atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+    return len;
+}
+
+/*
+Consumer only. Copies up to len bytes out and returns how many
+*/
+size_t
+vt_ring_read(struct vt_ring *ring, uint8_t *data, size_t len)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t used = tail - head;
+
+    if (len > used) {
+        len = used;
+    }
+
+    size_t offset = head & (ring->size - 1);
+    size_t first = ring->size - offset < len ? ring->size - offset : len;
+
+    memcpy(data, ring->buffer + offset, first);
+    memcpy(data + first, ring->buffer, len - first);
+    //  Done with the bytes before the producer may reuse them
+    atomic_store_explicit(&ring->head, head + len, memory_order_release);
+    return len;
+}
+
+size_t
+vt_ring_used(struct vt_ring *ring)
+{
+    return atomic_load_explicit(&ring->tail, memory_order_acquire) 
+        - atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+size_t
+vt_ring_space(struct vt_ring *ring)
+{
+    return ring->size - vt_ring_used(ring);
+}
+
+void
+vt_ring_free(struct vt_ring *ring)
+{
+    free(ring->buffer);
+    memset(ring, 0, sizeof(struct vt_ring));
+}
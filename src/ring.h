@@ -0,0 +1,33 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//  Keeps head and tail on separate cache lines so the two threads don't share one
+#define RING_ALIGN          (64)
+
+/*
+A lock-free byte ring for one producer thread and one consumer thread. Each
+index is only ever written by one side and only grows; the bytes used are
+tail - head. size is a power of 2
+*/
+struct vt_ring
+{
+    uint8_t *buffer;
+    size_t size;
+    //  Next byte to read. Written by the consumer
+    _Alignas(RING_ALIGN) atomic_size_t head;
+    //  Next byte to write. Written by the producer
+    _Alignas(RING_ALIGN) atomic_size_t tail;
+};
+
+int vt_ring_init(struct vt_ring *ring, size_t size);
+size_t vt_ring_write(struct vt_ring *ring, const uint8_t *data, size_t len);
+size_t vt_ring_read(struct vt_ring *ring, uint8_t *data, size_t len);
+size_t vt_ring_used(struct vt_ring *ring);
+size_t vt_ring_space(struct vt_ring *ring);
+void vt_ring_free(struct vt_ring *ring);
+
+#endif
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+#include "route.h"
+
+static struct vt_route *vt_route_lookup(struct vt_route_table *table, const char *from, uint8_t key);
+
+void
+vt_route_init(struct vt_route_table *table)
+{
+    memset(table, 0, sizeof(struct vt_route_table));
+}
+
+/*
+Remember that key on page from leads to page to. A route that has changed is 
+updated in place
+*/
+void
+vt_route_learn(struct vt_route_table *table, const char *from, uint8_t key, const char *to)
+{
+    if (from[0] == 0 || to[0] == 0) {
+        return;
+    }
+
+    struct vt_route *route = vt_route_lookup(table, from, key);
+
+    if (route == NULL) {
+        if (table->count < ROUTE_MAX) {
+            route = &table->routes[table->count++];
+        }
+        else {
+            route = &table->routes[table->next];
+            table->next = (table->next + 1) % ROUTE_MAX;
+        }
+
+        snprintf(route->from, PAGE_NUMBER_MAX, "%s", from);
+        route->key = key;
+    }
+
+    snprintf(route->to, PAGE_NUMBER_MAX, "%s", to);
+}
+
+/*
+The page key on page from led to last time, or NULL if it hasn't been pressed
+there
+*/
+const char *
+vt_route_find(struct vt_route_table *table, const char *from, uint8_t key)
+{
+    struct vt_route *route = vt_route_lookup(table, from, key);
+
+    return route != NULL ? route->to : NULL;
+}
+
+static struct vt_route *
+vt_route_lookup(struct vt_route_table *table, const char *from, uint8_t key)
+{
+    for (int i = 0; i < table->count; ++i) {
+        struct vt_route *route = &table->routes[i];
+
+        if (route->key == key && strcmp(route->from, from) == 0) {
+            return route;
+        }
+    }
+
+    return NULL;
+}
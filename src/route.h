@@ -0,0 +1,32 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include <stdint.h>
+#include "decoder.h"
+
+//  Routes remembered. The oldest learnt is forgotten to make room
+#define ROUTE_MAX   (1024)
+
+/*
+Pressing key on page from led to page to
+*/
+struct vt_route
+{
+    char from[PAGE_NUMBER_MAX];
+    char to[PAGE_NUMBER_MAX];
+    uint8_t key;
+};
+
+struct vt_route_table
+{
+    struct vt_route routes[ROUTE_MAX];
+    int count;
+    //  Where the next new route goes once the table is full
+    int next;
+};
+
+void vt_route_init(struct vt_route_table *table);
+void vt_route_learn(struct vt_route_table *table, const char *from, uint8_t key, const char *to);
+const char *vt_route_find(struct vt_route_table *table, const char *from, uint8_t key);
+
+#endif
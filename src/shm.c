@@ -0,0 +1,121 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "shm.h"
+#include "log.h"
+
+//  The cells are copied as they are, so must be laid out the same
+_Static_assert(sizeof(struct vt_decoder_cell) == sizeof(struct vt_screen_cell), "cell layout");
+_Static_assert(offsetof(struct vt_decoder_cell, attr) == offsetof(struct vt_screen_cell, color_pair),
+    "cell layout");
+_Static_assert(MAX_ROWS == VT_SCREEN_ROWS && MAX_COLS == VT_SCREEN_COLS, "screen size");
+_Static_assert(PAGE_NUMBER_MAX == VT_SCREEN_PAGE_MAX, "page number size");
+_Static_assert((int)CELL_BOLD == (int)VT_SCREEN_BOLD && (int)CELL_FLASH == (int)VT_SCREEN_FLASH 
+    && (int)CELL_CONCEALED == (int)VT_SCREEN_CONCEALED && (int)CELL_MOSAIC == (int)VT_SCREEN_MOSAIC 
+    && (int)CELL_TENTATIVE == (int)VT_SCREEN_TENTATIVE, "cell bits");
+
+/*
+name is a shared memory object name, e.g. "/vidtex". One left behind by an
+earlier session is replaced
+*/
+int
+vt_shm_create(struct vt_shm_state *state, const char *name)
+{
+    int fd;
+
+    if (strlen(name) >= SHM_NAME_MAX) {
+        errno = ENAMETOOLONG;
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    shm_unlink(name);
+
+    //  Only for the user's own processes: the screen can show what's typed into
+    //  a host's login frames
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    snprintf(state->name, SHM_NAME_MAX, "%s", name);
+
+    if (ftruncate(fd, sizeof(struct vt_screen)) == -1) {
+        log_err();
+        goto abend;
+    }
+
+    void *map = mmap(NULL, sizeof(struct vt_screen), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        log_err();
+        goto abend;
+    }
+
+    //  The mapping stays valid once the descriptor is closed
+    close(fd);
+    state->screen = map;
+    //  ftruncate has zeroed it, so the sequence starts at 0 and the page is empty
+    state->screen->size = sizeof(struct vt_screen);
+    state->screen->version = VT_SCREEN_VERSION;
+    //  Last, so readers can't see the magic before the rest of the header
+    atomic_thread_fence(memory_order_release);
+    state->screen->magic = VT_SCREEN_MAGIC;
+
+    return EXIT_SUCCESS;
+abend:
+    close(fd);
+    vt_shm_close(state);
+    return EXIT_FAILURE;
+}
+
+/*
+Called whenever the screen is drawn. A copy of under 4KB, with no system calls
+and no locks a reader could hold up
+*/
+void
+vt_shm_publish(struct vt_shm_state *state, struct vt_decoder_state *decoder)
+{
+    struct vt_screen *screen = state->screen;
+
+    if (screen == NULL) {
+        return;
+    }
+
+    uint32_t sequence = atomic_load_explicit(&screen->sequence, memory_order_relaxed);
+
+    //  Odd while writing. The fence keeps the writes below from being seen
+    //  before it
+    atomic_store_explicit(&screen->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    memcpy(screen->state.cells, decoder->cells, sizeof(screen->state.cells));
+    screen->state.row = decoder->row;
+    screen->state.col = decoder->col;
+    screen->state.is_cursor_on = decoder->flags.is_cursor_on;
+
+    if (!vt_decoder_get_page_number(decoder, screen->state.page, VT_SCREEN_PAGE_MAX)) {
+        screen->state.page[0] = 0;
+    }
+
+    atomic_store_explicit(&screen->sequence, sequence + 2, memory_order_release);
+}
+
+void
+vt_shm_close(struct vt_shm_state *state)
+{
+    if (state->screen != NULL) {
+        munmap(state->screen, sizeof(struct vt_screen));
+        state->screen = NULL;
+    }
+
+    if (state->name[0] != 0) {
+        shm_unlink(state->name);
+        state->name[0] = 0;
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "decoder.h"
+#include "vtscreen.h"
+
+#define SHM_NAME_MAX        (256)
+
+/*
+The screen, published for other processes to read with libvtscreen. See
+vtscreen.h
+*/
+struct vt_shm_state
+{
+    //  NULL if not publishing
+    struct vt_screen *screen;
+    char name[SHM_NAME_MAX];
+};
+
+int vt_shm_create(struct vt_shm_state *state, const char *name);
+void vt_shm_publish(struct vt_shm_state *state, struct vt_decoder_state *decoder);
+void vt_shm_close(struct vt_shm_state *state);
+
+#endif
@@ -0,0 +1,239 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "split.h"
+#include "archive.h"
+#include "bedstead.h"
+#include "log.h"
+
+#define FF                  (12)
+#define FRAMES_INITIAL      (256)
+
+static void *vt_split_chunk(void *arg);
+static int vt_add_frame(struct vt_split_chunk *chunk, uint64_t offset, uint64_t end, 
+    struct vt_decoder_state *decoder);
+static uint64_t vt_next_frame(const uint8_t *map, uint64_t offset, uint64_t length);
+
+/*
+Split a --dump file into frames at each FF and append them to an archive, tagged
+with the page number from the header row. Chunks of the dump are decoded in 
+parallel, then appended in order
+*/
+int
+vt_split_run(const char *dump_path, const char *archive_path)
+{
+    int rv = EXIT_FAILURE;
+    struct vt_split_chunk chunks[SPLIT_THREADS_MAX];
+    int chunk_count = 0;
+    struct vt_archive archive;
+    bool is_archive_open = false;
+
+    memset(chunks, 0, sizeof(chunks));
+
+    int fd = open(dump_path, O_RDONLY);
+    if (fd == -1) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        log_err();
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t length = st.st_size;
+    uint8_t *map = NULL;
+
+    if (length == 0) {
+        fprintf(stderr, "%s is empty\n", dump_path);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    madvise(map, length, MADV_SEQUENTIAL);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t threads = length / SPLIT_CHUNK_MIN + 1;
+
+    if (cpus > 0 && threads > (uint64_t)cpus) {
+        threads = cpus;
+    }
+    if (threads > SPLIT_THREADS_MAX) {
+        threads = SPLIT_THREADS_MAX;
+    }
+
+    //  Each chunk starts at an FF, except the first which starts where the dump does
+    uint64_t start = 0;
+
+    for (uint64_t i = 1; i <= threads && start < length; ++i) {
+        uint64_t end = i == threads ? length : vt_next_frame(map, length * i / threads, length);
+
+        if (end <= start) {
+            continue;
+        }
+
+        struct vt_split_chunk *chunk = &chunks[chunk_count++];
+        chunk->map = map;
+        chunk->start = start;
+        chunk->end = end;
+        start = end;
+    }
+
+    for (int i = 0; i < chunk_count; ++i) {
+        if ((errno = pthread_create(&chunks[i].thread, NULL, vt_split_chunk, &chunks[i])) != 0) {
+            log_err();
+            //  Do it ourselves
+            vt_split_chunk(&chunks[i]);
+        }
+        else {
+            chunks[i].is_thread_started = true;
+        }
+    }
+
+    for (int i = 0; i < chunk_count; ++i) {
+        if (chunks[i].is_thread_started) {
+            pthread_join(chunks[i].thread, NULL);
+        }
+        if (chunks[i].is_failed) {
+            goto cleanup;
+        }
+    }
+
+    if (vt_archive_open(&archive, archive_path) != EXIT_SUCCESS) {
+        goto cleanup;
+    }
+
+    is_archive_open = true;
+
+    //  The dump has no timestamps so every frame gets the time of the capture
+    const char *service = strrchr(dump_path, '/');
+    service = service == NULL ? dump_path : service + 1;
+    uint32_t total = 0;
+
+    for (int i = 0; i < chunk_count; ++i) {
+        for (uint32_t f = 0; f < chunks[i].frame_count; ++f) {
+            struct vt_split_frame *frame = &chunks[i].frames[f];
+
+            if (vt_archive_append(&archive, service, frame->page, st.st_mtime, 
+                map + frame->offset, frame->length) != EXIT_SUCCESS) {
+                goto cleanup;
+            }
+        }
+
+        total += chunks[i].frame_count;
+    }
+
+    printf("Split %u frames using %d threads, %u already in the archive, %u stored as changes\n", 
+        total, chunk_count, archive.shared_count, archive.delta_count);
+    rv = EXIT_SUCCESS;
+
+cleanup:
+    if (is_archive_open && vt_archive_close(&archive) != EXIT_SUCCESS) {
+        rv = EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < chunk_count; ++i) {
+        free(chunks[i].frames);
+    }
+
+    munmap(map, length);
+    return rv;
+}
+
+static void *
+vt_split_chunk(void *arg)
+{
+    struct vt_split_chunk *chunk = arg;
+    struct vt_decoder_state *decoder = calloc(1, sizeof(struct vt_decoder_state));
+
+    if (decoder == NULL) {
+        log_err();
+        chunk->is_failed = true;
+        return NULL;
+    }
+
+    decoder->map_char = &bed_map_char;
+    vt_decoder_init(decoder);
+
+    uint64_t offset = chunk->start;
+
+    if (chunk->map[offset] == FF) {
+        ++offset;
+    }
+
+    while (offset < chunk->end) {
+        uint64_t end = vt_next_frame(chunk->map, offset, chunk->end);
+
+        if (end > offset && vt_add_frame(chunk, offset, end, decoder) != EXIT_SUCCESS) {
+            chunk->is_failed = true;
+            break;
+        }
+
+        //  Skip the FF
+        offset = end + 1;
+    }
+
+    vt_decoder_free(decoder);
+    free(decoder);
+    return NULL;
+}
+
+static int
+vt_add_frame(struct vt_split_chunk *chunk, uint64_t offset, uint64_t end, 
+    struct vt_decoder_state *decoder)
+{
+    if (chunk->frame_count == chunk->frame_capacity) {
+        uint32_t capacity = chunk->frame_capacity == 0 ? FRAMES_INITIAL : chunk->frame_capacity * 2;
+        struct vt_split_frame *frames = realloc(chunk->frames, capacity * sizeof(struct vt_split_frame));
+
+        if (frames == NULL) {
+            log_err();
+            return EXIT_FAILURE;
+        }
+
+        chunk->frames = frames;
+        chunk->frame_capacity = capacity;
+    }
+
+    struct vt_split_frame *frame = &chunk->frames[chunk->frame_count++];
+    uint8_t ff = FF;
+
+    frame->offset = offset;
+    frame->length = end - offset;
+
+    //  Clear down as the live decoder would have
+    vt_decoder_decode(decoder, &ff, 1);
+    vt_decoder_decode(decoder, (uint8_t *)chunk->map + offset, frame->length);
+
+    if (!vt_decoder_get_page_number(decoder, frame->page, PAGE_NUMBER_MAX)) {
+        frame->page[0] = 0;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+Offset of the first FF at or after offset, or length if there isn't one
+*/
+static uint64_t
+vt_next_frame(const uint8_t *map, uint64_t offset, uint64_t length)
+{
+    const uint8_t *ff = memchr(map + offset, FF, length - offset);
+
+    return ff == NULL ? length : (uint64_t)(ff - map);
+}
@@ -0,0 +1,41 @@
+#ifndef SPLIT_H
+#define SPLIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "decoder.h"
+
+//  Chunks smaller than this aren't worth a thread of their own
+#define SPLIT_CHUNK_MIN     (1 << 20)
+#define SPLIT_THREADS_MAX   (64)
+
+struct vt_split_frame
+{
+    //  Offset and length in the dump, excluding the FF
+    uint64_t offset;
+    uint32_t length;
+    char page[PAGE_NUMBER_MAX];
+};
+
+/*
+A range of the dump, from an FF (or the start of the file) to the first FF at or 
+after end. The decoder resets at FF so each chunk can be decoded independently
+*/
+struct vt_split_chunk
+{
+    pthread_t thread;
+    //  pthread_t is opaque, so there's no value meaning not started
+    bool is_thread_started;
+    const uint8_t *map;
+    uint64_t start;
+    uint64_t end;
+    struct vt_split_frame *frames;
+    uint32_t frame_count;
+    uint32_t frame_capacity;
+    bool is_failed;
+};
+
+int vt_split_run(const char *dump_path, const char *archive_path);
+
+#endif
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "net.h"
+#include "stats.h"
+#include "log.h"
+
+#define STATS_BACKLOG       (4)
+
+void
+vt_stats_init(struct vt_stats_state *state, struct vt_decoder_counters *decoder, 
+    struct vt_tele_counters *tele, struct vt_vtout_state *vtout)
+{
+    memset(state, 0, sizeof(struct vt_stats_state));
+    state->start_ms = vt_net_now_ms();
+    state->decoder = decoder;
+    state->tele = tele;
+    state->vtout = vtout;
+    state->listen_fd = -1;
+}
+
+/*
+Returns the length of the JSON object written to json, or -1 if it doesn't fit
+*/
+int
+vt_stats_format(struct vt_stats_state *state, char *json, int len)
+{
+    //  Refreshes are curses refreshes plus, with --direct, writes to the terminal
+    int n = snprintf(json, len, 
+        "{\"elapsed_ms\":%ld,"
+        "\"bytes_read\":%" PRIu64 ",\"read_calls\":%" PRIu64 ","
+        "\"bytes_decoded\":%" PRIu64 ",\"cells_written\":%" PRIu64 ","
+        "\"refreshes\":%" PRIu64 ",\"flash_toggles\":%" PRIu64 ","
+        "\"telesoftware_frames\":%" PRIu64 ",\"checksum_failures\":%" PRIu64 ","
+        "\"parity_errors\":%" PRIu64 "}\n",
+        vt_net_now_ms() - state->start_ms,
+        state->bytes_read, state->read_calls,
+        state->decoder->bytes_decoded, state->decoder->cells_written,
+        state->decoder->refreshes + state->vtout->flushes, state->decoder->flash_toggles,
+        state->tele->frames, state->tele->checksum_failures,
+        state->tele->parity_errors);
+
+    return n < 0 || n >= len ? -1 : n;
+}
+
+/*
+Replace the file at path, so a reader never sees it half written
+*/
+int
+vt_stats_write(struct vt_stats_state *state, const char *path)
+{
+    char json[STATS_JSON_MAX];
+    char tmp_path[FILENAME_MAX];
+    FILE *fout = NULL;
+    int len = vt_stats_format(state, json, STATS_JSON_MAX);
+
+    if (len == -1) {
+        return EXIT_FAILURE;
+    }
+
+    snprintf(tmp_path, FILENAME_MAX, "%s.tmp", path);
+
+    if ((fout = fopen(tmp_path, "w")) == NULL) {
+        log_err();
+        goto abend;
+    }
+
+    if (fwrite(json, 1, len, fout) != (size_t) len) {
+        log_err();
+        goto abend;
+    }
+
+    if (fclose(fout) == EOF) {
+        fout = NULL;
+        log_err();
+        goto abend;
+    }
+
+    fout = NULL;
+
+    if (rename(tmp_path, path) == -1) {
+        log_err();
+        goto abend;
+    }
+
+    return EXIT_SUCCESS;
+abend:
+    if (fout != NULL) {
+        fclose(fout);
+    }
+    unlink(tmp_path);
+    return EXIT_FAILURE;
+}
+
+/*
+Listen on a Unix socket at path. Each client that connects is sent the current
+stats as JSON and the connection closed, e.g. socat - UNIX-CONNECT:path
+*/
+int
+vt_stats_listen(struct vt_stats_state *state, const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    strcpy(addr.sun_path, path);
+    //  A socket left behind by an earlier session would stop us binding, but 
+    //  anything else at path isn't ours to remove
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            errno = EEXIST;
+            log_err();
+            return EXIT_FAILURE;
+        }
+
+        unlink(path);
+    }
+
+    state->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (state->listen_fd == -1) {
+        log_err();
+        goto abend;
+    }
+
+    if (bind(state->listen_fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == -1) {
+        log_err();
+        goto abend;
+    }
+
+    snprintf(state->socket_path, STATS_SOCKET_MAX, "%s", path);
+
+    if (listen(state->listen_fd, STATS_BACKLOG) == -1) {
+        log_err();
+        goto abend;
+    }
+
+    return EXIT_SUCCESS;
+abend:
+    vt_stats_close(state);
+    return EXIT_FAILURE;
+}
+
+/*
+Answer every client waiting on the endpoint. The reply is small enough to fit
+in the socket buffer, so the write never blocks the main loop
+*/
+void
+vt_stats_serve(struct vt_stats_state *state)
+{
+    char json[STATS_JSON_MAX];
+    int client_fd;
+
+    while ((client_fd = accept4(state->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        int len = vt_stats_format(state, json, STATS_JSON_MAX);
+
+        if (len > 0 && write(client_fd, json, len) == -1) {
+            log_err();
+        }
+
+        close(client_fd);
+    }
+}
+
+void
+vt_stats_close(struct vt_stats_state *state)
+{
+    if (state->listen_fd > -1) {
+        if (close(state->listen_fd) == -1) {
+            log_err();
+        }
+
+        state->listen_fd = -1;
+    }
+
+    if (state->socket_path[0] != 0) {
+        unlink(state->socket_path);
+        state->socket_path[0] = 0;
+    }
+}
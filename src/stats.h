@@ -0,0 +1,38 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include "decoder.h"
+#include "telesoft.h"
+#include "vtout.h"
+
+//  Comfortably more than vt_stats_format needs
+#define STATS_JSON_MAX      (1024)
+#define STATS_SOCKET_MAX    (108)
+
+/*
+Counters for the session. The decoder, Telesoftware decoder and vtout keep their
+own as they go; these are the ones only the main loop sees
+*/
+struct vt_stats_state
+{
+    long start_ms;
+    uint64_t bytes_read;
+    uint64_t read_calls;
+    struct vt_decoder_counters *decoder;
+    struct vt_tele_counters *tele;
+    struct vt_vtout_state *vtout;
+    //  The stats endpoint. -1 if there isn't one
+    int listen_fd;
+    char socket_path[STATS_SOCKET_MAX];
+};
+
+void vt_stats_init(struct vt_stats_state *state, struct vt_decoder_counters *decoder, 
+    struct vt_tele_counters *tele, struct vt_vtout_state *vtout);
+int vt_stats_format(struct vt_stats_state *state, char *json, int len);
+int vt_stats_write(struct vt_stats_state *state, const char *path);
+int vt_stats_listen(struct vt_stats_state *state, const char *path);
+void vt_stats_serve(struct vt_stats_state *state);
+void vt_stats_close(struct vt_stats_state *state);
+
+#endif
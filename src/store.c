@@ -0,0 +1,266 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "store.h"
+#include "log.h"
+
+#define FNV_OFFSET_BASIS    (0xCBF29CE484222325ULL)
+#define FNV_PRIME           (0x100000001B3ULL)
+//  Frames are spread over subdirectories named by the first 2 digits of the hash
+#define STORE_FANOUT_DIGITS (2)
+#define STORE_TMP_SUFFIX    ".tmp"
+//  A save links a new frame into the store, then to the save path. vt_store_gc
+//  leaves files this recent alone in case a save is between the two
+#define STORE_GC_GRACE_SECS (600)
+
+static bool vt_is_hex(const char *name, int digits);
+static bool vt_is_same_file(const char *path, const uint8_t *data, size_t length);
+static int vt_write_file(const char *path, const uint8_t *data, size_t length, mode_t mode);
+static int vt_write_frame(const char *path, const uint8_t *data, size_t length);
+
+/*
+64 bit FNV-1a
+*/
+uint64_t
+vt_store_hash(const uint8_t *data, size_t length)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/*
+Save a frame to path as a link to its copy in the store, adding it to the store
+if it isn't there. If the store holds different bytes with the same hash, or
+path can't be linked to the store (e.g. it's on another file system, or one
+without hard links), the frame is written to path on its own
+*/
+int
+vt_store_save(const char *dir, const uint8_t *data, size_t length, const char *path)
+{
+    char hash[STORE_HASH_DIGITS + 1];
+    char blob_path[FILENAME_MAX];
+    char tmp_path[FILENAME_MAX];
+
+    snprintf(hash, STORE_HASH_DIGITS + 1, "%016llx", (unsigned long long)vt_store_hash(data, length));
+    snprintf(blob_path, FILENAME_MAX, "%s/%.*s", dir, STORE_FANOUT_DIGITS, hash);
+
+    if ((mkdir(dir, S_IRWXU) == -1 && errno != EEXIST) 
+        || (mkdir(blob_path, S_IRWXU) == -1 && errno != EEXIST)) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    //  The longest name made here
+    if (snprintf(tmp_path, FILENAME_MAX, "%s/%.*s/%s" STORE_TMP_SUFFIX ".%d", dir, STORE_FANOUT_DIGITS, 
+        hash, hash + STORE_FANOUT_DIGITS, (int)getpid()) >= FILENAME_MAX) {
+        errno = ENAMETOOLONG;
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    snprintf(blob_path, FILENAME_MAX, "%s/%.*s/%s", dir, STORE_FANOUT_DIGITS, hash, hash + STORE_FANOUT_DIGITS);
+
+    if (access(blob_path, F_OK) == -1) {
+
+        //  Read only, as every save of the frame shares it
+        if (vt_write_file(tmp_path, data, length, S_IRUSR | S_IRGRP | S_IROTH) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+
+        //  Unlike rename, fails if another process stored it first
+        bool is_stored = link(tmp_path, blob_path) == 0 || errno == EEXIST;
+        unlink(tmp_path);
+
+        if (!is_stored) {
+            return vt_write_frame(path, data, length);
+        }
+    }
+
+    if (!vt_is_same_file(blob_path, data, length)) {
+        return vt_write_frame(path, data, length);
+    }
+
+    int rv = link(blob_path, path);
+
+    if (rv == -1 && errno == EEXIST && unlink(path) == 0) {
+        rv = link(blob_path, path);
+    }
+
+    if (rv == -1) {
+        return vt_write_frame(path, data, length);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+Remove frames no save refers to, and files left by interrupted saves. Only
+names the store could have made are looked at, and files written in the last
+STORE_GC_GRACE_SECS are kept as a save may be using them
+*/
+int
+vt_store_gc(const char *dir)
+{
+    char path[FILENAME_MAX];
+    char blob_path[FILENAME_MAX];
+    DIR *store = opendir(dir);
+    long removed = 0;
+    long kept = 0;
+    long references = 0;
+    long long freed = 0;
+    time_t grace_start = time(NULL) - STORE_GC_GRACE_SECS;
+
+    if (store == NULL) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    struct dirent *fanout;
+
+    while ((fanout = readdir(store)) != NULL) {
+        if (!vt_is_hex(fanout->d_name, STORE_FANOUT_DIGITS) || fanout->d_name[STORE_FANOUT_DIGITS] != 0) {
+            continue;
+        }
+
+        DIR *blobs = NULL;
+
+        if (snprintf(path, FILENAME_MAX, "%s/%s", dir, fanout->d_name) < FILENAME_MAX) {
+            blobs = opendir(path);
+        }
+
+        if (blobs == NULL) {
+            continue;
+        }
+
+        struct dirent *blob;
+
+        while ((blob = readdir(blobs)) != NULL) {
+            struct stat st;
+
+            //  vt_is_hex stops at the terminator of shorter names
+            if (!vt_is_hex(blob->d_name, STORE_HASH_DIGITS - STORE_FANOUT_DIGITS)
+                || snprintf(blob_path, FILENAME_MAX, "%s/%s", path, blob->d_name) >= FILENAME_MAX) {
+                continue;
+            }
+
+            const char *suffix = blob->d_name + STORE_HASH_DIGITS - STORE_FANOUT_DIGITS;
+            bool is_tmp = strncmp(suffix, STORE_TMP_SUFFIX, strlen(STORE_TMP_SUFFIX)) == 0;
+
+            if ((*suffix != 0 && !is_tmp)
+                || lstat(blob_path, &st) == -1 || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+
+            if (is_tmp && st.st_mtime > grace_start) {
+                continue;
+            }
+
+            if (!is_tmp && (st.st_nlink > 1 || st.st_mtime > grace_start)) {
+                ++kept;
+                references += st.st_nlink - 1;
+                continue;
+            }
+
+            if (unlink(blob_path) == -1) {
+                log_err();
+                continue;
+            }
+
+            ++removed;
+            freed += st.st_size;
+        }
+
+        closedir(blobs);
+    }
+
+    closedir(store);
+    printf("Removed %ld unreferenced frames (%lld bytes). Kept %ld frames with %ld references\n", 
+        removed, freed, kept, references);
+    return EXIT_SUCCESS;
+}
+
+static bool
+vt_is_hex(const char *name, int digits)
+{
+    for (int i = 0; i < digits; ++i) {
+        if (!isxdigit((unsigned char)name[i]) || isupper((unsigned char)name[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool
+vt_is_same_file(const char *path, const uint8_t *data, size_t length)
+{
+    struct stat st;
+    bool is_same = false;
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size == length) {
+        uint8_t *buffer = malloc(length > 0 ? length : 1);
+
+        is_same = buffer != NULL 
+            && read(fd, buffer, length) == (ssize_t)length 
+            && memcmp(buffer, data, length) == 0;
+        free(buffer);
+    }
+
+    close(fd);
+    return is_same;
+}
+
+static int
+vt_write_file(const char *path, const uint8_t *data, size_t length, mode_t mode)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+
+    if (fd == -1) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    if (write(fd, data, length) != (ssize_t)length) {
+        log_err();
+        close(fd);
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+
+    if (close(fd) == -1) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+Save a frame to path on its own, rather than as a link into the store
+*/
+static int
+vt_write_frame(const char *path, const uint8_t *data, size_t length)
+{
+    //  Don't write through an existing link to a stored frame
+    unlink(path);
+    return vt_write_file(path, data, length, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+}
@@ -0,0 +1,18 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+A directory of frames named by the hash of their bytes, so each is kept once.
+Saved frames are hard links to them: a frame's link count, less one, is the
+number of saves that refer to it, and vt_store_gc removes frames with none
+*/
+#define STORE_HASH_DIGITS   (16)
+
+uint64_t vt_store_hash(const uint8_t *data, size_t length);
+int vt_store_save(const char *dir, const uint8_t *data, size_t length, const char *path);
+int vt_store_gc(const char *dir);
+
+#endif
@@ -0,0 +1,374 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "t42.h"
+#include "archive.h"
+#include "log.h"
+
+#define ESC                 (27)
+#define FF                  (12)
+#define SUBPAGES_INITIAL    (4)
+//  Headers for page FF carry no page, they just end the previous one
+#define FILLER_PAGE         (0xFF)
+
+static void vt_t42_header(struct vt_t42_store *store, int magazine, const uint8_t *packet);
+static void vt_t42_commit(struct vt_t42_store *store, int magazine);
+static uint8_t vt_hamming_encode(int nibble);
+
+void
+vt_t42_init(struct vt_t42_store *store)
+{
+    memset(store, 0, sizeof(struct vt_t42_store));
+    memset(store->hamming, -1, sizeof(store->hamming));
+
+    //  Every code word and every single bit error decodes to its nibble. Anything
+    //  else is a double error
+    for (int n = 0; n < 16; ++n) {
+        uint8_t code = vt_hamming_encode(n);
+        store->hamming[code] = n;
+
+        for (int bit = 0; bit < 8; ++bit) {
+            store->hamming[code ^ (1 << bit)] = n;
+        }
+    }
+
+    //  Odd parity
+    for (int b = 0; b < 256; ++b) {
+        store->parity[b] = __builtin_parity(b) ? (b & 0x7F) : SPACE;
+    }
+}
+
+/*
+Map a t42 file and ingest all of it
+*/
+int
+vt_t42_load(struct vt_t42_store *store, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        log_err();
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        return EXIT_SUCCESS;
+    }
+
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    vt_t42_ingest(store, map, st.st_size);
+    munmap(map, st.st_size);
+    return EXIT_SUCCESS;
+}
+
+/*
+Assemble pages from whole packets. Pages still being sent at the end are kept
+*/
+void
+vt_t42_ingest(struct vt_t42_store *store, const uint8_t *data, size_t length)
+{
+    const uint8_t *end = data + length - length % T42_PACKET_LEN;
+
+    for (const uint8_t *packet = data; packet < end; packet += T42_PACKET_LEN) {
+        int mrag0 = store->hamming[packet[0]];
+        int mrag1 = store->hamming[packet[1]];
+
+        ++store->packet_count;
+
+        if (mrag0 < 0 || mrag1 < 0) {
+            ++store->error_count;
+            continue;
+        }
+
+        int magazine = mrag0 & 7;
+        int row = (mrag0 >> 3) | (mrag1 << 1);
+
+        if (row == 0) {
+            vt_t42_header(store, magazine, packet);
+            continue;
+        }
+
+        struct vt_t42_assembly *assembly = &store->assembly[magazine];
+
+        //  Rows 24 and up aren't displayed
+        if (!assembly->is_active || row >= MAX_ROWS) {
+            continue;
+        }
+
+        uint8_t *out = assembly->rows[row];
+        const uint8_t *in = packet + 2;
+
+        for (int c = 0; c < MAX_COLS; ++c) {
+            out[c] = store->parity[in[c]];
+        }
+
+        assembly->row_mask |= 1 << row;
+    }
+
+    for (int m = 0; m < T42_MAGAZINES; ++m) {
+        vt_t42_commit(store, m);
+    }
+}
+
+/*
+Page numbers are 0x100-0x8FF. Returns NULL if the page wasn't received
+*/
+struct vt_t42_page *
+vt_t42_find(struct vt_t42_store *store, int page)
+{
+    if (page < T42_PAGE_MIN || page > T42_PAGE_MAX) {
+        return NULL;
+    }
+
+    return store->pages[(page >> 8) & 7][page & 0xFF];
+}
+
+/*
+The next received page after page in direction (1 or -1), wrapping around. Returns
+-1 if there are no pages
+*/
+int
+vt_t42_next_page(struct vt_t42_store *store, int page, int direction)
+{
+    int range = T42_PAGE_MAX - T42_PAGE_MIN + 1;
+    int idx = page - T42_PAGE_MIN;
+
+    for (int i = 0; i < range; ++i) {
+        idx = (idx + direction + range) % range;
+
+        if (vt_t42_find(store, idx + T42_PAGE_MIN) != NULL) {
+            return idx + T42_PAGE_MIN;
+        }
+    }
+
+    return -1;
+}
+
+/*
+Convert a subpage to a frame for vt_decoder_decode. Teletext spacing attributes are 
+the same as viewdata's, they're just sent as ESC + code
+*/
+int
+vt_t42_get_frame(struct vt_t42_subpage *subpage, uint8_t frame[T42_FRAME_MAX])
+{
+    int length = 0;
+    frame[length++] = FF;
+
+    for (int r = 0; r < MAX_ROWS; ++r) {
+        for (int c = 0; c < MAX_COLS; ++c) {
+            uint8_t b = subpage->rows[r][c];
+
+            if (b < SPACE) {
+                frame[length++] = ESC;
+                b += 0x40;
+            }
+
+            frame[length++] = b;
+        }
+    }
+
+    return length;
+}
+
+/*
+Append every subpage to an archive, so that pages can be shown with --file and 
+searched
+*/
+int
+vt_t42_export(struct vt_t42_store *store, const char *archive_path, const char *service, time_t when)
+{
+    struct vt_archive archive;
+    uint8_t frame[T42_FRAME_MAX];
+    char page_text[T42_PAGE_TEXT_MAX];
+    int rv = EXIT_SUCCESS;
+
+    if (vt_archive_open(&archive, archive_path) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    for (int page = T42_PAGE_MIN; page <= T42_PAGE_MAX && rv == EXIT_SUCCESS; ++page) {
+        struct vt_t42_page *p = vt_t42_find(store, page);
+
+        if (p == NULL) {
+            continue;
+        }
+
+        snprintf(page_text, T42_PAGE_TEXT_MAX, "%X", page);
+
+        for (int s = 0; s < p->subpage_count && rv == EXIT_SUCCESS; ++s) {
+            int length = vt_t42_get_frame(&p->subpages[s], frame);
+            rv = vt_archive_append(&archive, service, page_text, when, frame, length);
+        }
+    }
+
+    if (vt_archive_close(&archive) != EXIT_SUCCESS) {
+        rv = EXIT_FAILURE;
+    }
+
+    return rv;
+}
+
+void
+vt_t42_free(struct vt_t42_store *store)
+{
+    for (int m = 0; m < T42_MAGAZINES; ++m) {
+        for (int p = 0; p < T42_PAGES; ++p) {
+            if (store->pages[m][p] != NULL) {
+                free(store->pages[m][p]->subpages);
+                free(store->pages[m][p]);
+                store->pages[m][p] = NULL;
+            }
+        }
+    }
+}
+
+static void
+vt_t42_header(struct vt_t42_store *store, int magazine, const uint8_t *packet)
+{
+    int n[8];
+
+    for (int i = 0; i < 8; ++i) {
+        if ((n[i] = store->hamming[packet[2 + i]]) < 0) {
+            ++store->error_count;
+            return;
+        }
+    }
+
+    //  C11 - magazine serial
+    store->is_serial = (n[7] & 1) != 0;
+
+    if (store->is_serial) {
+        for (int m = 0; m < T42_MAGAZINES; ++m) {
+            vt_t42_commit(store, m);
+        }
+    }
+    else {
+        vt_t42_commit(store, magazine);
+    }
+
+    int page = (n[1] << 4) | n[0];
+
+    if (page == FILLER_PAGE) {
+        return;
+    }
+
+    struct vt_t42_assembly *assembly = &store->assembly[magazine];
+    assembly->is_active = true;
+    assembly->page = page;
+    assembly->subcode = (n[2] | (n[3] << 4) | (n[4] << 8) | (n[5] << 12)) & T42_SUBCODE_MASK;
+    //  C4 - erase page
+    assembly->is_erase = (n[3] & 8) != 0;
+    assembly->row_mask = 1;
+
+    //  The first 8 columns of the header are for the receiver's own use. The page
+    //  number goes on its own, where vt_decoder_get_page_number finds it before
+    //  any number in the broadcaster's part of the header
+    uint8_t *out = assembly->rows[0];
+    snprintf((char *)out, MAX_COLS, "   %d%02X  ", magazine == 0 ? 8 : magazine, page);
+
+    for (int c = 8; c < MAX_COLS; ++c) {
+        out[c] = store->parity[packet[2 + c]];
+    }
+}
+
+/*
+Store the page the magazine was sending. Rows that weren't sent keep their previous
+contents unless the page was to be erased
+*/
+static void
+vt_t42_commit(struct vt_t42_store *store, int magazine)
+{
+    struct vt_t42_assembly *assembly = &store->assembly[magazine];
+
+    if (!assembly->is_active) {
+        return;
+    }
+
+    assembly->is_active = false;
+
+    struct vt_t42_page **slot = &store->pages[magazine][assembly->page];
+
+    if (*slot == NULL) {
+        if ((*slot = calloc(1, sizeof(struct vt_t42_page))) == NULL) {
+            log_err();
+            return;
+        }
+
+        ++store->page_count;
+    }
+
+    struct vt_t42_page *page = *slot;
+    struct vt_t42_subpage *subpage = NULL;
+
+    for (int s = 0; s < page->subpage_count && subpage == NULL; ++s) {
+        if (page->subpages[s].subcode == assembly->subcode) {
+            subpage = &page->subpages[s];
+        }
+    }
+
+    if (subpage == NULL) {
+        if (page->subpage_count == page->subpage_capacity) {
+            int capacity = page->subpage_capacity == 0 ? SUBPAGES_INITIAL : page->subpage_capacity * 2;
+            struct vt_t42_subpage *subpages = realloc(page->subpages, capacity * sizeof(struct vt_t42_subpage));
+
+            if (subpages == NULL) {
+                log_err();
+                return;
+            }
+
+            page->subpages = subpages;
+            page->subpage_capacity = capacity;
+        }
+
+        subpage = &page->subpages[page->subpage_count++];
+        subpage->subcode = assembly->subcode;
+        memset(subpage->rows, SPACE, sizeof(subpage->rows));
+    }
+
+    for (int r = 0; r < MAX_ROWS; ++r) {
+        if (assembly->row_mask & (1 << r)) {
+            memcpy(subpage->rows[r], assembly->rows[r], MAX_COLS);
+        }
+        else if (assembly->is_erase) {
+            memset(subpage->rows[r], SPACE, MAX_COLS);
+        }
+    }
+}
+
+/*
+Bits are sent P1 D1 P2 D2 P3 D3 P4 D4, least significant first. P1-P3 are odd 
+parity over three of the data bits, P4 is odd parity over the whole byte
+*/
+static uint8_t
+vt_hamming_encode(int nibble)
+{
+    int d1 = nibble & 1;
+    int d2 = (nibble >> 1) & 1;
+    int d3 = (nibble >> 2) & 1;
+    int d4 = (nibble >> 3) & 1;
+    int p1 = 1 ^ d1 ^ d3 ^ d4;
+    int p2 = 1 ^ d1 ^ d2 ^ d4;
+    int p3 = 1 ^ d1 ^ d2 ^ d3;
+    int p4 = 1 ^ p1 ^ d1 ^ p2 ^ d2 ^ p3 ^ d3 ^ d4;
+
+    return p1 | (d1 << 1) | (p2 << 2) | (d2 << 3) | (p3 << 4) | (d3 << 5) | (p4 << 6) | (d4 << 7);
+}
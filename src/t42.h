@@ -0,0 +1,77 @@
+#ifndef T42_H
+#define T42_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include "decoder.h"
+
+/*
+Broadcast teletext captured as t42: a stream of 42 byte packets, each a Hamming 8/4 
+coded magazine and row address (MRAG) followed by 40 bytes. Row 0 is the page header,
+rows 1-23 are displayed. Page numbers are hex, 0x100-0x8FF, as on a TV
+*/
+#define T42_PACKET_LEN      (42)
+#define T42_MAGAZINES       (8)
+#define T42_PAGES           (256)
+#define T42_PAGE_MIN        (0x100)
+#define T42_PAGE_MAX        (0x8FF)
+//  Mask of the subcode bits that identify a subpage
+#define T42_SUBCODE_MASK    (0x3F7F)
+//  FF then each byte of each row, with control codes sent as ESC + code
+#define T42_FRAME_MAX       (1 + MAX_ROWS * MAX_COLS * 2)
+#define T42_PAGE_TEXT_MAX   (4)
+
+struct vt_t42_subpage
+{
+    uint16_t subcode;
+    uint8_t rows[MAX_ROWS][MAX_COLS];
+};
+
+struct vt_t42_page
+{
+    //  In the order first received
+    struct vt_t42_subpage *subpages;
+    int subpage_count;
+    int subpage_capacity;
+};
+
+//  The page a magazine is currently sending
+struct vt_t42_assembly
+{
+    bool is_active;
+    bool is_erase;
+    uint8_t page;
+    uint16_t subcode;
+    //  Bit per row received
+    uint32_t row_mask;
+    uint8_t rows[MAX_ROWS][MAX_COLS];
+};
+
+struct vt_t42_store
+{
+    //  Indexed by magazine (8 is stored as 0) and page within the magazine
+    struct vt_t42_page *pages[T42_MAGAZINES][T42_PAGES];
+    struct vt_t42_assembly assembly[T42_MAGAZINES];
+    //  In serial mode a header ends the page of every magazine
+    bool is_serial;
+    //  Lookup tables. hamming holds -1 for uncorrectable bytes. Bytes with bad
+    //  parity are replaced by spaces
+    int8_t hamming[256];
+    uint8_t parity[256];
+    uint64_t packet_count;
+    uint64_t error_count;
+    int page_count;
+};
+
+void vt_t42_init(struct vt_t42_store *store);
+int vt_t42_load(struct vt_t42_store *store, const char *path);
+void vt_t42_ingest(struct vt_t42_store *store, const uint8_t *data, size_t length);
+struct vt_t42_page *vt_t42_find(struct vt_t42_store *store, int page);
+int vt_t42_next_page(struct vt_t42_store *store, int page, int direction);
+int vt_t42_get_frame(struct vt_t42_subpage *subpage, uint8_t frame[T42_FRAME_MAX]);
+int vt_t42_export(struct vt_t42_store *store, const char *archive_path, const char *service, time_t when);
+void vt_t42_free(struct vt_t42_store *store);
+
+#endif
@@ -5,7 +5,9 @@ static int vt_parity(int v);
 void
 vt_tele_reset(struct vt_tele_state *state)
 {
+    struct vt_tele_counters counters = state->counters;
     memset(state, 0, sizeof(struct vt_tele_state));
+    state->counters = counters;
 }
 
 bool
@@ -35,6 +37,7 @@ vt_tele_decode(struct vt_tele_state *state, uint8_t *buffer, int count, int fd_o
 
         if (state->in_frame && vt_parity(b) != (b >> 7)) {
             state->parity_error = true;
+            ++state->counters.parity_errors;
         }
 
         //  Discard parity bit
@@ -191,10 +194,12 @@ vt_tele_decode(struct vt_tele_state *state, uint8_t *buffer, int count, int fd_o
 
                         if (state->checksum != state->running_checksum) {
                             state->invalid_checksum = true;
+                            ++state->counters.checksum_failures;
                         }
 
                         state->state = 0;
                         state->end_of_frame = true;
+                        ++state->counters.frames;
                         break;
                 }
                 continue;
@@ -11,6 +11,14 @@
 #define CHAR_SPACE          (0b0100000)
 #define CHAR_BAR            (0b1111100)
 
+//  Totals for the session; kept across vt_tele_reset
+struct vt_tele_counters
+{
+    uint64_t frames;
+    uint64_t checksum_failures;
+    uint64_t parity_errors;
+};
+
 struct vt_tele_state
 {
     int state;
@@ -28,6 +36,7 @@ struct vt_tele_state
     bool invalid_checksum;
     bool end_of_frame;
     bool parity_error;
+    struct vt_tele_counters counters;
 };
 
 void vt_tele_reset(struct vt_tele_state *state);
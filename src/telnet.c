@@ -0,0 +1,185 @@
+#include <string.h>
+#include <unistd.h>
+#include "telnet.h"
+
+enum vt_telnet_parse
+{
+    TN_DATA     = 0,
+    TN_IAC      = 1,
+    TN_OPTION   = 2,
+    TN_SB       = 3,
+    TN_SB_IAC   = 4
+};
+
+static bool vt_is_accepted(uint8_t option);
+static void vt_negotiate(struct vt_telnet_state *state, uint8_t verb, uint8_t option);
+static void vt_reply(struct vt_telnet_state *state, uint8_t verb, uint8_t option);
+
+void
+vt_telnet_reset(struct vt_telnet_state *state)
+{
+    memset(state, 0, sizeof(struct vt_telnet_state));
+}
+
+/*
+Record any negotiation we've sent unprompted (e.g. IAC DO SGA in a vidtexrc preamble)
+so that the host's acknowledgement isn't answered again, which would start a loop
+*/
+void
+vt_telnet_note_sent(struct vt_telnet_state *state, uint8_t *buffer, int count)
+{
+    for (int i = 0; i + 2 < count; ++i) {
+        if (buffer[i] != TELNET_IAC) {
+            continue;
+        }
+
+        switch (buffer[i + 1]) {
+        case TELNET_DO:
+            state->remote[buffer[i + 2]] = true;
+            break;
+        case TELNET_WILL:
+            state->local[buffer[i + 2]] = true;
+            break;
+        }
+    }
+}
+
+/*
+Strip telnet commands from buffer in place and answer option negotiation on fd.
+Returns the number of data bytes left in buffer or -1 if a reply couldn't be sent
+*/
+int
+vt_telnet_filter(struct vt_telnet_state *state, uint8_t *buffer, int count, int fd)
+{
+    int out = 0;
+    state->reply_length = 0;
+
+    for (int bidx = 0; bidx < count; ++bidx) {
+        uint8_t b = buffer[bidx];
+
+        switch (state->state) {
+        case TN_DATA:
+            if (b == TELNET_IAC) {
+                state->state = TN_IAC;
+                state->is_active = true;
+            }
+            else {
+                buffer[out++] = b;
+            }
+            break;
+        case TN_IAC:
+            switch (b) {
+            case TELNET_IAC:
+                //  Escaped data byte
+                buffer[out++] = b;
+                state->state = TN_DATA;
+                break;
+            case TELNET_DO:
+            case TELNET_DONT:
+            case TELNET_WILL:
+            case TELNET_WONT:
+                state->verb = b;
+                state->state = TN_OPTION;
+                break;
+            case TELNET_SB:
+                state->state = TN_SB;
+                break;
+            default:
+                //  NOP, GA, AYT etc. Nothing to display
+                state->state = TN_DATA;
+                break;
+            }
+            break;
+        case TN_OPTION:
+            vt_negotiate(state, state->verb, b);
+            state->state = TN_DATA;
+            break;
+        case TN_SB:
+            if (b == TELNET_IAC) {
+                state->state = TN_SB_IAC;
+            }
+            break;
+        case TN_SB_IAC:
+            //  IAC IAC within a subnegotiation is data; anything but SE is too
+            state->state = b == TELNET_SE ? TN_DATA : TN_SB;
+            break;
+        }
+    }
+
+    if (state->reply_length > 0 && fd > -1) {
+        if (write(fd, state->reply, state->reply_length) != state->reply_length) {
+            return -1;
+        }
+    }
+
+    return out;
+}
+
+static bool
+vt_is_accepted(uint8_t option)
+{
+    switch (option) {
+    case TELNET_OPT_BINARY:
+    case TELNET_OPT_SGA:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+Only state changes are acknowledged (RFC 854) so we can't get into a negotiation loop
+*/
+static void
+vt_negotiate(struct vt_telnet_state *state, uint8_t verb, uint8_t option)
+{
+    switch (verb) {
+    case TELNET_WILL:
+        if (option == TELNET_OPT_ECHO || vt_is_accepted(option)) {
+            //  Host echo is what viewdata services do anyway
+            if (!state->remote[option]) {
+                state->remote[option] = true;
+                vt_reply(state, TELNET_DO, option);
+            }
+        }
+        else {
+            vt_reply(state, TELNET_DONT, option);
+        }
+        break;
+    case TELNET_WONT:
+        if (state->remote[option]) {
+            state->remote[option] = false;
+            vt_reply(state, TELNET_DONT, option);
+        }
+        break;
+    case TELNET_DO:
+        if (vt_is_accepted(option)) {
+            if (!state->local[option]) {
+                state->local[option] = true;
+                vt_reply(state, TELNET_WILL, option);
+            }
+        }
+        else {
+            vt_reply(state, TELNET_WONT, option);
+        }
+        break;
+    case TELNET_DONT:
+        if (state->local[option]) {
+            state->local[option] = false;
+            vt_reply(state, TELNET_WONT, option);
+        }
+        break;
+    }
+}
+
+static void
+vt_reply(struct vt_telnet_state *state, uint8_t verb, uint8_t option)
+{
+    if (state->reply_length + 3 > TELNET_REPLY_MAX) {
+        return;
+    }
+
+    state->reply[state->reply_length++] = TELNET_IAC;
+    state->reply[state->reply_length++] = verb;
+    state->reply[state->reply_length++] = option;
+}
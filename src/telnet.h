@@ -0,0 +1,42 @@
+#ifndef TELNET_H
+#define TELNET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TELNET_IAC          (255)
+#define TELNET_DONT         (254)
+#define TELNET_DO           (253)
+#define TELNET_WONT         (252)
+#define TELNET_WILL         (251)
+#define TELNET_SB           (250)
+#define TELNET_NOP          (241)
+#define TELNET_SE           (240)
+#define TELNET_OPT_BINARY   (0)
+#define TELNET_OPT_ECHO     (1)
+#define TELNET_OPT_SGA      (3)
+#define TELNET_OPT_MAX      (256)
+#define TELNET_REPLY_MAX    (256)
+
+struct vt_telnet_state
+{
+    //  Position within an IAC sequence. 0 when passing data through
+    int state;
+    //  The verb (DO, DONT, WILL, WONT) awaiting its option byte
+    uint8_t verb;
+    //  Options enabled at our end (we sent WILL)
+    bool local[TELNET_OPT_MAX];
+    //  Options enabled at the host's end (we sent DO)
+    bool remote[TELNET_OPT_MAX];
+    //  TRUE once the host has sent any IAC sequence
+    bool is_active;
+    //  Replies are collected here and written once per call
+    uint8_t reply[TELNET_REPLY_MAX];
+    int reply_length;
+};
+
+void vt_telnet_reset(struct vt_telnet_state *state);
+void vt_telnet_note_sent(struct vt_telnet_state *state, uint8_t *buffer, int count);
+int vt_telnet_filter(struct vt_telnet_state *state, uint8_t *buffer, int count, int fd);
+
+#endif
@@ -0,0 +1,210 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "vtout.h"
+#include "log.h"
+
+static void vt_append(struct vt_vtout_state *state, const char *format, ...);
+static void vt_append_utf8(struct vt_vtout_state *state, wchar_t ch);
+static void vt_append_sgr(struct vt_vtout_state *state, struct vt_vtout_cell *cell);
+static bool vt_is_same(struct vt_vtout_cell *a, struct vt_vtout_cell *b);
+static int vt_write(struct vt_vtout_state *state);
+
+void
+vt_vtout_init(struct vt_vtout_state *state, int fd)
+{
+    memset(state, 0, sizeof(struct vt_vtout_state));
+    state->fd = fd;
+}
+
+/*
+Bring the terminal up to date with one write()
+*/
+int
+vt_vtout_flush(struct vt_vtout_state *state, struct vt_decoder_state *decoder)
+{
+    //  Where the terminal's cursor is and its current rendition. Unknown at the start
+    //  of each flush, as curses may have written a status line since the last one
+    int cur_row = -1;
+    int cur_col = -1;
+    struct vt_vtout_cell *sgr = NULL;
+
+    state->length = 0;
+
+    if (!state->is_valid) {
+        vt_append(state, "\033[?25l\033[0m\033[H\033[2J");
+    }
+
+    for (int r = 0; r < MAX_ROWS; ++r) {
+        for (int c = 0; c < MAX_COLS; ++c) {
+            struct vt_decoder_cell *cell = &decoder->cells[r][c];
+            struct vt_vtout_cell next = {
+                .character = vt_decoder_display_char(decoder, cell),
+                .is_bold = (cell->attr.bits & CELL_BOLD) != 0,
+                .is_underlined = (cell->attr.bits & CELL_TENTATIVE) != 0,
+                .color_pair = decoder->mono_mode ? 0 : cell->attr.color_pair
+            };
+            struct vt_vtout_cell *shown = &state->screen[r][c];
+
+            if (state->is_valid && vt_is_same(&next, shown)) {
+                continue;
+            }
+
+            if (state->length == 0 && state->is_cursor_on) {
+                //  Hide the cursor while we draw
+                vt_append(state, "\033[?25l");
+            }
+
+            *shown = next;
+
+            if (r != cur_row || c != cur_col) {
+                if (r == cur_row && c > cur_col && c - cur_col < 4) {
+                    vt_append(state, "\033[%dC", c - cur_col);
+                }
+                else {
+                    vt_append(state, "\033[%d;%dH", r + 1, c + 1);
+                }
+            }
+
+            if (sgr == NULL || sgr->is_bold != shown->is_bold || sgr->is_underlined != shown->is_underlined
+                || sgr->color_pair != shown->color_pair) {
+                vt_append_sgr(state, shown);
+                sgr = shown;
+            }
+
+            vt_append_utf8(state, shown->character);
+            cur_row = r;
+            //  Writing the last column leaves the cursor in an undefined (pending wrap) state
+            cur_col = c + 1 < MAX_COLS ? c + 1 : -1;
+        }
+    }
+
+    int row = decoder->row;
+    int col = decoder->col;
+
+    //  After what's been typed ahead of the host
+    if (decoder->prediction_count > 0) {
+        struct vt_decoder_prediction *last = &decoder->predictions[decoder->prediction_count - 1];
+        row = last->row;
+        col = last->col + 1 < MAX_COLS ? last->col + 1 : last->col;
+    }
+
+    bool is_cursor_moved = state->cursor_row != row || state->cursor_col != col
+        || state->is_cursor_on != decoder->flags.is_cursor_on;
+
+    if (state->length == 0 && !is_cursor_moved) {
+        return EXIT_SUCCESS;
+    }
+
+    state->is_valid = true;
+    state->is_cursor_on = decoder->flags.is_cursor_on;
+    state->cursor_row = row;
+    state->cursor_col = col;
+    vt_append(state, "\033[%d;%dH%s", row + 1, col + 1,
+        state->is_cursor_on ? "\033[?25h" : "\033[?25l");
+    ++state->flushes;
+
+    return vt_write(state);
+}
+
+/*
+Leave the terminal in a sane state
+*/
+void
+vt_vtout_finish(struct vt_vtout_state *state)
+{
+    state->length = 0;
+    vt_append(state, "\033[0m\033[?25h");
+    vt_write(state);
+}
+
+static void
+vt_append(struct vt_vtout_state *state, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(state->buffer + state->length, VTOUT_BUFFER_MAX - state->length, format, args);
+    va_end(args);
+
+    if (n > 0 && state->length + n < VTOUT_BUFFER_MAX) {
+        state->length += n;
+    }
+}
+
+static void
+vt_append_utf8(struct vt_vtout_state *state, wchar_t ch)
+{
+    uint32_t cp = ch;
+    char *out = state->buffer + state->length;
+
+    if (state->length + 4 >= VTOUT_BUFFER_MAX) {
+        return;
+    }
+
+    if (cp < 0x80) {
+        out[0] = cp;
+        state->length += 1;
+    }
+    else if (cp < 0x800) {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+        state->length += 2;
+    }
+    else if (cp < 0x10000) {
+        out[0] = 0xE0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        state->length += 3;
+    }
+    else {
+        out[0] = 0xF0 | (cp >> 18);
+        out[1] = 0x80 | ((cp >> 12) & 0x3F);
+        out[2] = 0x80 | ((cp >> 6) & 0x3F);
+        out[3] = 0x80 | (cp & 0x3F);
+        state->length += 4;
+    }
+}
+
+/*
+Colour pairs are numbered (fg << 3) + bg, except white on black which is pair 0
+*/
+static void
+vt_append_sgr(struct vt_vtout_state *state, struct vt_vtout_cell *cell)
+{
+    int fg = cell->color_pair == 0 ? COLOR_WHITE : (cell->color_pair >> 3) & 7;
+    int bg = cell->color_pair == 0 ? COLOR_BLACK : cell->color_pair & 7;
+
+    vt_append(state, "\033[0;%s%s3%d;4%dm", cell->is_bold ? "1;" : "", cell->is_underlined ? "4;" : "", fg, bg);
+}
+
+static bool
+vt_is_same(struct vt_vtout_cell *a, struct vt_vtout_cell *b)
+{
+    return a->character == b->character && a->is_bold == b->is_bold && a->is_underlined == b->is_underlined
+        && a->color_pair == b->color_pair;
+}
+
+static int
+vt_write(struct vt_vtout_state *state)
+{
+    int offset = 0;
+
+    while (offset < state->length) {
+        ssize_t n = write(state->fd, state->buffer + offset, state->length - offset);
+
+        if (n == -1) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+
+            log_err();
+            return EXIT_FAILURE;
+        }
+
+        offset += n;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+#ifndef VTOUT_H
+#define VTOUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wchar.h>
+#include "decoder.h"
+
+//  Worst case is a cursor move, a full SGR sequence and a 3 byte character per cell
+#define VTOUT_BUFFER_MAX    (MAX_ROWS * MAX_COLS * 32)
+
+struct vt_vtout_cell
+{
+    wchar_t character;
+    bool is_bold;
+    bool is_underlined;
+    short color_pair;
+};
+
+/*
+Renders the decoder's cells straight to a VT100/ANSI terminal, bypassing curses.
+Only cells that differ from what was last written are sent
+*/
+struct vt_vtout_state
+{
+    int fd;
+    //  What the terminal is showing. Invalid until the first flush
+    struct vt_vtout_cell screen[MAX_ROWS][MAX_COLS];
+    bool is_valid;
+    int cursor_row;
+    int cursor_col;
+    bool is_cursor_on;
+    char buffer[VTOUT_BUFFER_MAX];
+    int length;
+    //  Updates written to the terminal
+    uint64_t flushes;
+};
+
+void vt_vtout_init(struct vt_vtout_state *state, int fd);
+int vt_vtout_flush(struct vt_vtout_state *state, struct vt_decoder_state *decoder);
+void vt_vtout_finish(struct vt_vtout_state *state);
+
+#endif
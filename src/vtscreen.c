@@ -0,0 +1,134 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "vtscreen.h"
+
+/*
+Map the screen published as name, e.g. "/vidtex". Returns EXIT_FAILURE, with
+errno set, if there isn't one or it isn't from a compatible vidtex
+*/
+int
+vt_screen_open(struct vt_screen_reader *reader, const char *name)
+{
+    struct stat st;
+
+    reader->screen = NULL;
+    reader->fd = shm_open(name, O_RDONLY, 0);
+
+    if (reader->fd == -1) {
+        return EXIT_FAILURE;
+    }
+
+    if (fstat(reader->fd, &st) == -1) {
+        goto abend;
+    }
+
+    if (st.st_size < (off_t)sizeof(struct vt_screen)) {
+        errno = EPROTO;
+        goto abend;
+    }
+
+    void *map = mmap(NULL, sizeof(struct vt_screen), PROT_READ, MAP_SHARED, reader->fd, 0);
+
+    if (map == MAP_FAILED) {
+        goto abend;
+    }
+
+    reader->screen = map;
+
+    if (reader->screen->magic != VT_SCREEN_MAGIC || reader->screen->version != VT_SCREEN_VERSION
+        || reader->screen->size != sizeof(struct vt_screen)) {
+        errno = EPROTO;
+        goto abend;
+    }
+
+    return EXIT_SUCCESS;
+abend:
+    vt_screen_close(reader);
+    return EXIT_FAILURE;
+}
+
+/*
+Copy the screen into state. If sequence isn't NULL, it's set to the screen's
+sequence number, which changes whenever the screen does. Returns EXIT_FAILURE,
+with errno set to EAGAIN, if an update doesn't finish
+*/
+int
+vt_screen_read(struct vt_screen_reader *reader, struct vt_screen_state *state, uint32_t *sequence)
+{
+    uint32_t start;
+
+    do {
+        if (vt_screen_begin(reader->screen, &start) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+
+        memcpy(state, &reader->screen->state, sizeof(struct vt_screen_state));
+    } while (vt_screen_retry(reader->screen, start));
+
+    if (sequence != NULL) {
+        *sequence = start;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+Start reading screen->state in place, setting sequence for vt_screen_retry.
+Waits for an update in progress to finish, or returns EXIT_FAILURE with errno
+set to EAGAIN if it doesn't
+*/
+int
+vt_screen_begin(const struct vt_screen *screen, uint32_t *sequence)
+{
+    for (int i = 0; i < VT_SCREEN_WAIT_MAX; ++i) {
+        *sequence = atomic_load_explicit(&screen->sequence, memory_order_acquire);
+
+        if ((*sequence & 1) == 0) {
+            return EXIT_SUCCESS;
+        }
+
+        //  Updates are a few microseconds, unless vidtex is descheduled in one
+        if (i >= VT_SCREEN_SPIN_MAX) {
+            sched_yield();
+        }
+    }
+
+    errno = EAGAIN;
+    return EXIT_FAILURE;
+}
+
+/*
+True if what was read since vt_screen_begin returned sequence may be torn, and
+needs reading again
+*/
+bool
+vt_screen_retry(const struct vt_screen *screen, uint32_t sequence)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&screen->sequence, memory_order_relaxed) != sequence;
+}
+
+void
+vt_screen_close(struct vt_screen_reader *reader)
+{
+    int err = errno;
+
+    if (reader->screen != NULL) {
+        munmap((void *)reader->screen, sizeof(struct vt_screen));
+        reader->screen = NULL;
+    }
+
+    if (reader->fd != -1) {
+        close(reader->fd);
+        reader->fd = -1;
+    }
+
+    errno = err;
+}
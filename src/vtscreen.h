@@ -0,0 +1,87 @@
+#ifndef VTSCREEN_H
+#define VTSCREEN_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+The screen that vidtex --shm publishes in a POSIX shared memory object, for
+other processes to read. vidtex updates it whenever it draws, under a seqlock:
+sequence is odd while an update is being written and goes up by two for each.
+Readers take a consistent copy with vt_screen_read, or read in place between
+vt_screen_begin and vt_screen_retry. Neither makes a system call unless an
+update is in progress. One that doesn't finish, because vidtex died in it, makes
+them fail with EAGAIN rather than wait for ever
+
+Link with -lvtscreen
+*/
+#define VT_SCREEN_MAGIC     (0x53585456)    //  "VTXS"
+#define VT_SCREEN_VERSION   (1)
+#define VT_SCREEN_ROWS      (24)
+#define VT_SCREEN_COLS      (40)
+#define VT_SCREEN_PAGE_MAX  (12)
+//  Times the sequence is checked for the end of an update before giving up.
+//  After the first VT_SCREEN_SPIN_MAX, readers yield the CPU between checks
+#define VT_SCREEN_SPIN_MAX  (1000)
+#define VT_SCREEN_WAIT_MAX  (100000)
+
+//  Colours are curses colour numbers: 0 black, 1 red ... 7 white
+#define VT_SCREEN_FG(pair)  ((pair) == 0 ? 7 : (pair) >> 3)
+#define VT_SCREEN_BG(pair)  ((pair) & 7)
+
+enum vt_screen_cell_bits
+{
+    VT_SCREEN_BOLD          = 1 << 0,
+    VT_SCREEN_FLASH         = 1 << 1,
+    VT_SCREEN_CONCEALED     = 1 << 2,
+    //  A mosaic (graphics) character
+    VT_SCREEN_MOSAIC        = 1 << 3,
+    //  Typed, and not yet echoed by the host
+    VT_SCREEN_TENTATIVE     = 1 << 4
+};
+
+struct vt_screen_cell
+{
+    //  The character as drawn: a code point in the font vidtex was told to use
+    uint16_t character;
+    //  Foreground and background. See VT_SCREEN_FG and VT_SCREEN_BG
+    uint8_t color_pair;
+    //  vt_screen_cell_bits
+    uint8_t bits;
+};
+
+struct vt_screen_state
+{
+    int32_t row;
+    int32_t col;
+    uint32_t is_cursor_on;
+    //  From the header row. Empty if it has none
+    char page[VT_SCREEN_PAGE_MAX];
+    struct vt_screen_cell cells[VT_SCREEN_ROWS][VT_SCREEN_COLS];
+};
+
+struct vt_screen
+{
+    uint32_t magic;
+    uint32_t version;
+    //  Of this structure
+    uint32_t size;
+    _Atomic uint32_t sequence;
+    struct vt_screen_state state;
+};
+
+struct vt_screen_reader
+{
+    int fd;
+    const struct vt_screen *screen;
+};
+
+int vt_screen_open(struct vt_screen_reader *reader, const char *name);
+int vt_screen_read(struct vt_screen_reader *reader, struct vt_screen_state *state, uint32_t *sequence);
+int vt_screen_begin(const struct vt_screen *screen, uint32_t *sequence);
+bool vt_screen_retry(const struct vt_screen *screen, uint32_t sequence);
+void vt_screen_close(struct vt_screen_reader *reader);
+
+#endif
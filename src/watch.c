@@ -0,0 +1,655 @@
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "watch.h"
+#include "bedstead.h"
+#include "evloop.h"
+#include "net.h"
+#include "store.h"
+#include "log.h"
+
+#define BUFFER_LEN          (256)
+#define TIMESTR_MAX         (32)
+//  So that a signal landing just before a wait isn't missed for long
+#define WATCH_WAIT_MAX_MS   (1000)
+
+static int vt_watch_load(const char *path, struct vt_watch_service *services, int service_count,
+    struct vt_watch **watches, int *count);
+static char *vt_watch_trim(char *token);
+static void *vt_watch_resolve(void *arg);
+static void vt_watch_visit(struct vt_evloop *loop, struct vt_watch *watch);
+static void vt_watch_connected(struct vt_evloop *loop, struct vt_watch *watch, int revents);
+static void vt_watch_data(struct vt_evloop *loop, struct vt_watch *watch, uint8_t *buffer, int nread);
+static void vt_watch_settled(struct vt_evloop *loop, struct vt_watch *watch);
+static void vt_watch_complete(struct vt_evloop *loop, struct vt_watch *watch);
+static void vt_watch_finish(struct vt_evloop *loop, struct vt_watch *watch, const char *error);
+static long vt_watch_next_timeout(struct vt_evloop *loop, struct vt_watch *watches, int count, long now);
+static long vt_watch_due(struct vt_watch *watch);
+static void vt_watch_step(struct vt_evloop *loop, struct vt_watch *watch, long now);
+static void vt_watch_event(struct vt_watch *watch, const char *event, const char *page,
+    uint64_t previous, const char *error);
+static void vt_print_json_string(const char *s);
+
+/*
+Visit the pages listed in path on their schedules until is_stopping is set,
+writing a line of JSON to stdout for each first visit, change and failure
+*/
+int
+vt_watch_run(struct vt_rc_state *rc_state, const char *path, volatile sig_atomic_t *is_stopping)
+{
+    int service_count = rc_state->rc_data_count;
+    int count = 0;
+    int rv = EXIT_FAILURE;
+    struct vt_evloop loop;
+    bool is_loop_open = false;
+    struct vt_watch *watches = NULL;
+
+    struct vt_watch_service *services = calloc(service_count > 0 ? service_count : 1,
+        sizeof(struct vt_watch_service));
+    pthread_t *threads = calloc(service_count > 0 ? service_count : 1, sizeof(pthread_t));
+    //  pthread_t is opaque, so there's no value meaning not started
+    bool *is_started = calloc(service_count > 0 ? service_count : 1, sizeof(bool));
+    struct vt_evloop_event *events = malloc(EVLOOP_QUEUE_DEPTH * sizeof(struct vt_evloop_event));
+
+    if (services == NULL || threads == NULL || is_started == NULL || events == NULL) {
+        log_err();
+        goto cleanup;
+    }
+
+    for (int i = 0; i < service_count; ++i) {
+        services[i].entry = rc_state->rc_data[i];
+    }
+
+    if (vt_watch_load(path, services, service_count, &watches, &count) != EXIT_SUCCESS) {
+        goto cleanup;
+    }
+
+    if (count == 0) {
+        fprintf(stderr, "No pages to watch in %s\n", path);
+        goto cleanup;
+    }
+
+    //  Only the services that have pages watched
+    for (int i = 0; i < count; ++i) {
+        int s = watches[i].service - services;
+
+        if (is_started[s] || services[s].error[0] != 0) {
+            continue;
+        }
+
+        if ((errno = pthread_create(&threads[s], NULL, vt_watch_resolve, &services[s])) != 0) {
+            log_err();
+            snprintf(services[s].error, WATCH_ERROR_MAX, "thread");
+        }
+        else {
+            is_started[s] = true;
+        }
+    }
+
+    for (int i = 0; i < service_count; ++i) {
+        if (is_started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    if (vt_evloop_init(&loop, count, true) != EXIT_SUCCESS) {
+        goto cleanup;
+    }
+
+    is_loop_open = true;
+
+    //  First visits are spread over each page's interval, not all made at once
+    long start = vt_net_now_ms();
+
+    for (int i = 0; i < count; ++i) {
+        watches[i].due = start + watches[i].interval_ms * i / count;
+    }
+
+    while (!*is_stopping) {
+        long timeout = vt_watch_next_timeout(&loop, watches, count, vt_net_now_ms());
+
+        if (timeout > WATCH_WAIT_MAX_MS) {
+            timeout = WATCH_WAIT_MAX_MS;
+        }
+
+        int nevents = vt_evloop_wait(&loop, events, EVLOOP_QUEUE_DEPTH, timeout);
+
+        if (nevents == -1) {
+            goto cleanup;
+        }
+
+        for (int i = 0; i < nevents; ++i) {
+            struct vt_watch *watch = events[i].user;
+
+            //  Finished by an earlier event
+            if (watch->slot != events[i].slot) {
+                continue;
+            }
+
+            if (events[i].type == EVLOOP_POLL) {
+                vt_watch_connected(&loop, watch, events[i].result);
+            }
+            else {
+                vt_watch_data(&loop, watch, events[i].data, events[i].result);
+            }
+        }
+    }
+
+    rv = EXIT_SUCCESS;
+cleanup:
+    for (int i = 0; i < count; ++i) {
+        if (watches[i].stage != WATCH_WAITING) {
+            vt_watch_finish(&loop, &watches[i], NULL);
+        }
+    }
+
+    for (int i = 0; services != NULL && i < service_count; ++i) {
+        if (services[i].addr != NULL) {
+            freeaddrinfo(services[i].addr);
+        }
+    }
+
+    if (is_loop_open) {
+        vt_evloop_free(&loop);
+    }
+
+    free(watches);
+    free(services);
+    free(threads);
+    free(is_started);
+    free(events);
+    return rv;
+}
+
+/*
+One page a line: the name of a service in vidtexrc, the page number (- for the
+service's first frame) and, optionally, the seconds between visits. Fields are
+delimited by tab, ',' or '|' as in vidtexrc
+*/
+static int
+vt_watch_load(const char *path, struct vt_watch_service *services, int service_count,
+    struct vt_watch **watches, int *count)
+{
+    FILE *fin = fopen(path, "rt");
+
+    if (fin == NULL) {
+        log_err();
+        return EXIT_FAILURE;
+    }
+
+    char buffer[BUFFER_LEN];
+    int line = 0;
+    int capacity = 0;
+
+    while (fgets(buffer, BUFFER_LEN, fin) != NULL) {
+        ++line;
+
+        char *name = vt_watch_trim(strtok(buffer, "\t\n,|"));
+
+        if (name == NULL || name[0] == '#') {
+            continue;
+        }
+
+        char *page = vt_watch_trim(strtok(NULL, "\t\n,|"));
+        char *interval = vt_watch_trim(strtok(NULL, "\t\n,|"));
+        struct vt_watch_service *service = NULL;
+
+        for (int i = 0; i < service_count; ++i) {
+            if (strcmp(services[i].entry->name, name) == 0) {
+                service = &services[i];
+                break;
+            }
+        }
+
+        if (service == NULL) {
+            fprintf(stderr, "No service named %s in vidtexrc, at line %d\n", name, line);
+            goto abend;
+        }
+
+        if (page == NULL) {
+            fprintf(stderr, "No page specified at line %d\n", line);
+            goto abend;
+        }
+
+        if (*count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            struct vt_watch *grown = realloc(*watches, capacity * sizeof(struct vt_watch));
+
+            if (grown == NULL) {
+                log_err();
+                goto abend;
+            }
+
+            *watches = grown;
+        }
+
+        struct vt_watch *watch = &(*watches)[(*count)++];
+        memset(watch, 0, sizeof(struct vt_watch));
+        watch->service = service;
+        watch->fd = -1;
+        watch->slot = -1;
+        watch->stage = WATCH_WAITING;
+
+        //  Frames other than 'a' can't be asked for, so the letter is dropped
+        int len = 0;
+
+        while (strcmp(page, "-") != 0 && isdigit(page[len]) && len < PAGE_NUMBER_MAX - 1) {
+            watch->page[len] = page[len];
+            ++len;
+        }
+
+        int secs = interval != NULL ? atoi(interval) : WATCH_INTERVAL_SECS;
+        watch->interval_ms = (secs > 0 ? secs : WATCH_INTERVAL_SECS) * 1000L;
+    }
+
+    fclose(fin);
+    return EXIT_SUCCESS;
+
+abend:
+    fclose(fin);
+    return EXIT_FAILURE;
+}
+
+/*
+token without the white space around it, or NULL if there's nothing else
+*/
+static char *
+vt_watch_trim(char *token)
+{
+    if (token == NULL) {
+        return NULL;
+    }
+
+    while (isspace(*token)) {
+        ++token;
+    }
+
+    int idx = strlen(token) - 1;
+
+    while (idx > -1 && isspace(token[idx])) {
+        token[idx--] = 0;
+    }
+
+    return token[0] != 0 ? token : NULL;
+}
+
+static void *
+vt_watch_resolve(void *arg)
+{
+    struct vt_watch_service *service = arg;
+    int rv = vt_net_resolve(service->entry->host, service->entry->port, &service->addr);
+
+    if (rv != 0) {
+        service->addr = NULL;
+        snprintf(service->error, WATCH_ERROR_MAX, "%s", gai_strerror(rv));
+    }
+
+    return NULL;
+}
+
+/*
+Start a visit, or carry on with the visit's next address. Completes in
+vt_watch_connected
+*/
+static void
+vt_watch_visit(struct vt_evloop *loop, struct vt_watch *watch)
+{
+    if (watch->stage == WATCH_WAITING) {
+        if (watch->service->addr == NULL) {
+            vt_watch_finish(loop, watch, watch->service->error);
+            return;
+        }
+
+        watch->next_addr = watch->service->addr;
+        watch->due = vt_net_now_ms();
+        watch->deadline = watch->due + WATCH_TIMEOUT_MS;
+        watch->stage = WATCH_CONNECTING;
+    }
+
+    for (; watch->next_addr != NULL; watch->next_addr = watch->next_addr->ai_next) {
+        struct addrinfo *addr = watch->next_addr;
+
+        watch->fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol);
+
+        if (watch->fd == -1) {
+            continue;
+        }
+
+        if (connect(watch->fd, addr->ai_addr, addr->ai_addrlen) == -1 && errno != EINPROGRESS) {
+            close(watch->fd);
+            watch->fd = -1;
+            continue;
+        }
+
+        watch->slot = vt_evloop_add(loop, watch->fd, watch);
+
+        if (watch->slot == -1 || vt_evloop_poll(loop, watch->slot, POLLOUT) != EXIT_SUCCESS) {
+            vt_watch_finish(loop, watch, strerror(errno));
+        }
+
+        return;
+    }
+
+    vt_watch_finish(loop, watch, errno != 0 ? strerror(errno) : "connect");
+}
+
+static void
+vt_watch_connected(struct vt_evloop *loop, struct vt_watch *watch, int revents)
+{
+    struct vt_rc_entry *entry = watch->service->entry;
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if (revents < 0) {
+        err = -revents;
+    }
+    else if (getsockopt(watch->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+        err = errno;
+    }
+
+    if (err != 0) {
+        //  On to the next address
+        vt_evloop_remove(loop, watch->slot);
+        close(watch->fd);
+        watch->fd = watch->slot = -1;
+        watch->next_addr = watch->next_addr->ai_next;
+        errno = err;
+        vt_watch_visit(loop, watch);
+        return;
+    }
+
+    uint8_t preamble[PREAMBLE_MAX];
+    int preamble_len = vt_rc_get_preamble(entry, preamble);
+    vt_telnet_reset(&watch->telnet_state);
+    vt_telnet_note_sent(&watch->telnet_state, preamble, preamble_len);
+
+    int nodelay = 1;
+    setsockopt(watch->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    if (write(watch->fd, preamble, preamble_len) != preamble_len) {
+        vt_watch_finish(loop, watch, "preamble");
+        return;
+    }
+
+    watch->decoder = calloc(1, sizeof(struct vt_decoder_state));
+
+    if (watch->decoder == NULL) {
+        log_err();
+        vt_watch_finish(loop, watch, "memory");
+        return;
+    }
+
+    watch->decoder->map_char = &bed_map_char;
+    vt_decoder_init(watch->decoder);
+    watch->stage = WATCH_ARRIVING;
+    watch->stage_start = vt_net_now_ms();
+    watch->last_read = 0;
+
+    if (vt_evloop_read(loop, watch->slot) != EXIT_SUCCESS) {
+        vt_watch_finish(loop, watch, "read");
+    }
+}
+
+static void
+vt_watch_data(struct vt_evloop *loop, struct vt_watch *watch, uint8_t *buffer, int nread)
+{
+    //  Filtered in place, then decoded from the loop's buffer
+    if (nread > 0) {
+        nread = vt_telnet_filter(&watch->telnet_state, buffer, nread, watch->fd);
+    }
+    else {
+        nread = -1;
+    }
+
+    if (nread == -1) {
+        //  Some hosts send a page and hang up
+        if (watch->last_read > 0 && (watch->stage == WATCH_NAVIGATING || watch->page[0] == 0)) {
+            vt_watch_complete(loop, watch);
+        }
+        else {
+            vt_watch_finish(loop, watch, "closed by host");
+        }
+        return;
+    }
+
+    //  Otherwise it was all telnet negotiation
+    if (nread > 0) {
+        watch->last_read = vt_net_now_ms();
+        vt_decoder_decode(watch->decoder, buffer, nread);
+    }
+
+    if (vt_evloop_read(loop, watch->slot) != EXIT_SUCCESS) {
+        vt_watch_finish(loop, watch, "read");
+    }
+}
+
+/*
+The host has gone quiet. After the service's first frame, ask for the page,
+the way a user would. After the page, that's the visit done
+*/
+static void
+vt_watch_settled(struct vt_evloop *loop, struct vt_watch *watch)
+{
+    if (watch->stage == WATCH_NAVIGATING || watch->page[0] == 0) {
+        vt_watch_complete(loop, watch);
+        return;
+    }
+
+    uint8_t nav[PAGE_NUMBER_MAX + 2] = {'*'};
+    int nav_len = 1;
+
+    for (char *p = watch->page; *p != 0; ++p) {
+        nav[nav_len++] = *p;
+    }
+
+    nav[nav_len++] = '_';
+    vt_telnet_note_sent(&watch->telnet_state, nav, nav_len);
+
+    if (write(watch->fd, nav, nav_len) != nav_len) {
+        vt_watch_finish(loop, watch, "write");
+        return;
+    }
+
+    watch->stage = WATCH_NAVIGATING;
+    watch->stage_start = vt_net_now_ms();
+    watch->last_read = 0;
+}
+
+/*
+Hash the page, leaving out the header row as it often has the time or a
+counter, and report it if it's the first visit or the hash has changed
+*/
+static void
+vt_watch_complete(struct vt_evloop *loop, struct vt_watch *watch)
+{
+    struct vt_decoder_state *decoder = watch->decoder;
+    char page[PAGE_NUMBER_MAX] = {0};
+    uint64_t previous = watch->hash;
+
+    vt_decoder_get_page_number(decoder, page, PAGE_NUMBER_MAX);
+    watch->hash = vt_store_hash((const uint8_t *)decoder->cells[1],
+        sizeof(decoder->cells) - sizeof(decoder->cells[0]));
+
+    if (!watch->has_hash) {
+        vt_watch_event(watch, "seen", page, 0, NULL);
+    }
+    else if (watch->hash != previous) {
+        vt_watch_event(watch, "changed", page, previous, NULL);
+    }
+
+    watch->has_hash = true;
+    vt_watch_finish(loop, watch, NULL);
+}
+
+/*
+End the visit and wait for the next. error is NULL if the visit ended normally
+*/
+static void
+vt_watch_finish(struct vt_evloop *loop, struct vt_watch *watch, const char *error)
+{
+    struct vt_rc_entry *entry = watch->service->entry;
+
+    if (error != NULL) {
+        vt_watch_event(watch, "error", "", 0, error);
+    }
+
+    if (watch->decoder != NULL) {
+        vt_decoder_free(watch->decoder);
+        free(watch->decoder);
+        watch->decoder = NULL;
+    }
+
+    if (watch->slot != -1) {
+        vt_evloop_remove(loop, watch->slot);
+        watch->slot = -1;
+    }
+
+    if (watch->fd != -1) {
+        if (watch->stage != WATCH_CONNECTING && entry->postamble_length > 0) {
+            //  Log off politely. Failure doesn't matter
+            if (write(watch->fd, entry->postamble, entry->postamble_length) == -1) {
+                errno = 0;
+            }
+        }
+
+        close(watch->fd);
+        watch->fd = -1;
+    }
+
+    //  Visits that overran their interval skip a turn rather than run back to back
+    long now = vt_net_now_ms();
+    watch->due += watch->interval_ms;
+
+    if (watch->due <= now) {
+        watch->due = now + watch->interval_ms;
+    }
+
+    watch->stage = WATCH_WAITING;
+}
+
+/*
+Move on every watch that's due. Returns how long until the next is
+*/
+static long
+vt_watch_next_timeout(struct vt_evloop *loop, struct vt_watch *watches, int count, long now)
+{
+    long timeout = -1;
+
+    for (int i = 0; i < count; ++i) {
+        struct vt_watch *watch = &watches[i];
+        long due = vt_watch_due(watch);
+
+        while (due <= now) {
+            vt_watch_step(loop, watch, now);
+            due = vt_watch_due(watch);
+        }
+
+        if (timeout == -1 || due - now < timeout) {
+            timeout = due - now;
+        }
+    }
+
+    return timeout;
+}
+
+/*
+When the watch next needs moving on, if nothing is read first
+*/
+static long
+vt_watch_due(struct vt_watch *watch)
+{
+    if (watch->stage == WATCH_WAITING) {
+        return watch->due;
+    }
+
+    if (watch->stage != WATCH_CONNECTING && watch->last_read > 0
+        && watch->last_read + WATCH_IDLE_MS < watch->deadline) {
+        return watch->last_read + WATCH_IDLE_MS;
+    }
+
+    return watch->deadline;
+}
+
+static void
+vt_watch_step(struct vt_evloop *loop, struct vt_watch *watch, long now)
+{
+    switch (watch->stage) {
+    case WATCH_WAITING:
+        vt_watch_visit(loop, watch);
+        break;
+    case WATCH_CONNECTING:
+        vt_watch_finish(loop, watch, "connect timeout");
+        break;
+    default:
+        if (now < watch->deadline) {
+            vt_watch_settled(loop, watch);
+        }
+        else if (watch->last_read == 0) {
+            vt_watch_finish(loop, watch, watch->stage == WATCH_ARRIVING ? "no data" : "no response");
+        }
+        else {
+            //  Never went quiet
+            vt_watch_finish(loop, watch, "timeout");
+        }
+        break;
+    }
+}
+
+static void
+vt_watch_event(struct vt_watch *watch, const char *event, const char *page,
+    uint64_t previous, const char *error)
+{
+    char timestr[TIMESTR_MAX];
+    time_t now = time(NULL);
+
+    strftime(timestr, TIMESTR_MAX, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    printf("{\"time\":\"%s\",\"service\":", timestr);
+    vt_print_json_string(watch->service->entry->name);
+    printf(",\"watch\":\"%s\",\"event\":\"%s\"", watch->page[0] != 0 ? watch->page : "-", event);
+
+    if (error != NULL) {
+        printf(",\"error\":");
+        vt_print_json_string(error);
+    }
+    else {
+        printf(",\"page\":\"%s\",\"hash\":\"%016" PRIx64 "\"", page, watch->hash);
+    }
+
+    if (strcmp(event, "changed") == 0) {
+        printf(",\"previous\":\"%016" PRIx64 "\"", previous);
+    }
+
+    printf("}\n");
+    //  Read line by line by whatever is watching
+    fflush(stdout);
+}
+
+static void
+vt_print_json_string(const char *s)
+{
+    putchar('"');
+
+    for (; *s != 0; ++s) {
+        if (*s == '"' || *s == '\\') {
+            printf("\\%c", *s);
+        }
+        else if ((unsigned char)*s < 0x20) {
+            printf("\\u%04x", *s);
+        }
+        else {
+            putchar(*s);
+        }
+    }
+
+    putchar('"');
+}
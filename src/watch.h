@@ -0,0 +1,70 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <netdb.h>
+#include "decoder.h"
+#include "telnet.h"
+#include "rc.h"
+
+//  Time allowed for a visit, from connecting to the page settling
+#define WATCH_TIMEOUT_MS        (20000)
+//  A frame is taken to be complete when the host has been quiet for this long
+#define WATCH_IDLE_MS           (500)
+#define WATCH_INTERVAL_SECS     (300)
+#define WATCH_ERROR_MAX         (64)
+
+/*
+A service that has pages watched. Its host name is looked up once, at the start
+*/
+struct vt_watch_service
+{
+    struct vt_rc_entry *entry;
+    struct addrinfo *addr;
+    char error[WATCH_ERROR_MAX];
+};
+
+enum vt_watch_stage
+{
+    //  Until due
+    WATCH_WAITING,
+    WATCH_CONNECTING,
+    //  For the service's first frame, before asking for the page
+    WATCH_ARRIVING,
+    //  For the page
+    WATCH_NAVIGATING
+};
+
+/*
+A page visited every interval_ms. Each visit is a connection of its own, and
+every visit in progress is handled on one event loop
+*/
+struct vt_watch
+{
+    struct vt_watch_service *service;
+    //  Digits only. Empty to watch the service's first frame
+    char page[PAGE_NUMBER_MAX];
+    long interval_ms;
+    enum vt_watch_stage stage;
+    //  The next visit when waiting, otherwise when this one started
+    long due;
+    long deadline;
+    struct addrinfo *next_addr;
+    int fd;
+    //  In the event loop. -1 if not in it
+    int slot;
+    long stage_start;
+    long last_read;
+    struct vt_telnet_state telnet_state;
+    //  Headless, for the length of the visit
+    struct vt_decoder_state *decoder;
+    //  Of the cells below the header row, when last visited
+    bool has_hash;
+    uint64_t hash;
+};
+
+int vt_watch_run(struct vt_rc_state *rc_state, const char *path, volatile sig_atomic_t *is_stopping);
+
+#endif